@@ -31,6 +31,15 @@
      return aabb(small, big);
  }
  
+ // box of a linearly moving object at s in [0,1] between its box0 and box1.
+ // Conservative for a node too: the union of the interpolated children
+ // boxes always lies inside the interpolation of their unions.
+ inline aabb interpolate_box( const aabb &box0, const aabb &box1, float s )
+ {
+     return aabb( box0.min() + s * ( box1.min() - box0.min() ),
+                  box0.max() + s * ( box1.max() - box0.max() ) );
+ }
+ 
  
 #if 0
  inline bool aabb::hit( const ray&r, float t_min, float t_max ) const
@@ -57,29 +66,28 @@
  }
 #endif
  
+ // 1 + 2 * gamma(3): scales the far plane distances so that the rounding
+ // of ( plane - origin ) * inv_dir never drops a box the ray grazes.
+ const float SLAB_FAR_SCALE = 1.00000036f;
+ 
+ // Branchless slabs on the ray cached inverse direction and signs. A NaN t
+ // (0 * inf: origin on a plane the ray is parallel to) fails both compares
+ // and leaves the interval untouched.
  inline bool aabb::hit( const ray&r, float t_min, float t_max ) const
  {
-     // test the overlap of the 3 intervals (in 3 dimensions)
+     const vec3 &inv_dir = r.inv_direction();
      for ( int a = 0; a < 3; ++a )
      {
-         float invD = 1.0f / r.direction()[a];
-         float t0 = ( _min[a] - r.origin()[a] ) * invD;
-         float t1 = ( _max[a] - r.origin()[a] ) * invD;
-         if ( invD < 0.0f )
-         {
-             std::swap( t0, t1 );
-         }
+         float near_plane = r.sign( a ) ? _max[a] : _min[a];
+         float far_plane = r.sign( a ) ? _min[a] : _max[a];
+         float t0 = ( near_plane - r._origin[a] ) * inv_dir[a];
+         float t1 = ( far_plane - r._origin[a] ) * inv_dir[a] * SLAB_FAR_SCALE;
          
          t_min = t0 > t_min ? t0 : t_min;
          t_max = t1 < t_max ? t1 : t_max;
-         
-         if ( t_max <= t_min )
-         {
-             return false;
-         }
      }
      
-     return true;
+     return t_min < t_max;
  }
  
  
@@ -0,0 +1,213 @@
+#ifndef _RAYTRACER_BENCH_H_
+#define _RAYTRACER_BENCH_H_
+
+// Closest hit and any hit benchmark of several acceleration structures over the same scene.
+// Single threaded, same rays for everybody: half coherent camera rays,
+// half incoherent diffuse bounces from their hit points.
+
+struct bench_entry
+{
+    const char *name;
+    hitable *accel;
+    size_t node_bytes; // nodes and motion boxes, the primitives are shared
+    size_t nb_prims;
+};
+
+void make_bench_rays( hitable *world, camera *cam, int nb_rays, std::vector<ray> &rays )
+{
+    rays.clear();
+    rays.reserve( nb_rays );
+
+    int nb_primary = nb_rays / 2;
+    for ( int i = 0; i < nb_primary; ++i )
+    {
+        rays.push_back( cam->get_ray( RAN01(), RAN01() ) );
+    }
+
+    for ( int i = 0; (int)rays.size() < nb_rays; ++i )
+    {
+        const ray &primary = rays[ i % nb_primary ];
+        hit_record rec;
+        if ( world->hit( primary, 0.001f, FLT_MAX, rec ) )
+        {
+            vec3 n = unit_vector( rec.normal );
+            if ( dot( n, primary.direction() ) > 0.0f )
+            {
+                n = -n;
+            }
+            rays.push_back( ray( rec.p, n + random_in_unit_sphere(), primary.time() ) );
+        }
+        else
+        {
+            rays.push_back( cam->get_ray( RAN01(), RAN01() ) );
+        }
+    }
+}
+
+void bench_acceleration_structures( bench_entry *entries, int nb_entries, camera *cam, int nb_rays )
+{
+    std::vector<ray> rays;
+    make_bench_rays( entries[0].accel, cam, nb_rays, rays );
+
+    // first entry is the reference for the hit distances
+    // (volumes scatter at random distances, they show up as mismatches).
+    std::vector<float> reference( rays.size() );
+
+    std::cout << "Benchmark           : " << rays.size() << " rays, 1 thread\n";
+    for ( int e = 0; e < nb_entries; ++e )
+    {
+        reset_thread_stats();
+        int nb_hits = 0;
+        int nb_mismatches = 0;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for ( size_t i = 0; i < rays.size(); ++i )
+        {
+            hit_record rec;
+            float t = FLT_MAX;
+            if ( entries[e].accel->hit( rays[i], 0.001f, FLT_MAX, rec ) )
+            {
+                ++nb_hits;
+                t = rec.t;
+            }
+
+            if ( e == 0 )
+            {
+                reference[i] = t;
+            }
+            else if ( fabsf( reference[i] - t ) > 1e-3f * fabsf( reference[i] ) )
+            {
+                ++nb_mismatches;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration<double, std::milli>( end - start ).count();
+
+        std::cout << std::fixed << std::setprecision(2)
+            << "  " << std::setw(10) << std::left << entries[e].name << std::right
+            << " : " << std::setw(8) << ( rays.size() / ( ms * 1000.0 ) ) << " Mrays/s, "
+            << std::setw(6) << ( (double)tl_stats.nb_node_visits / (double)rays.size() ) << " nodes/ray, "
+            << nb_hits << " hits, " << nb_mismatches << " mismatches, "
+            << ( (double)entries[e].node_bytes / (double)( entries[e].nb_prims ? entries[e].nb_prims : 1 ) ) << " node bytes/prim\n";
+
+        // same rays as visibility queries, checked against the closest hits
+        reset_thread_stats();
+        nb_hits = 0;
+        nb_mismatches = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for ( size_t i = 0; i < rays.size(); ++i )
+        {
+            bool occluded = entries[e].accel->occluded( rays[i], 0.001f, FLT_MAX );
+            nb_hits += occluded ? 1 : 0;
+            nb_mismatches += ( occluded != ( reference[i] < FLT_MAX ) ) ? 1 : 0;
+        }
+        end = std::chrono::high_resolution_clock::now();
+        ms = std::chrono::duration<double, std::milli>( end - start ).count();
+
+        std::cout << std::fixed << std::setprecision(2)
+            << "  " << std::setw(10) << std::left << "  any hit" << std::right
+            << " : " << std::setw(8) << ( rays.size() / ( ms * 1000.0 ) ) << " Mrays/s, "
+            << std::setw(6) << ( (double)tl_stats.nb_node_visits / (double)rays.size() ) << " nodes/ray, "
+            << nb_hits << " hits, " << nb_mismatches << " mismatches\n";
+    }
+}
+
+// Triangle intersection kernels alone, one thread: each ray against the
+// same triangles, TRIANGLE_GROUP_SIZE times more than a leaf holds so the
+// vertex arrays stay in the L1 cache. The scalar test is the reference.
+void bench_triangle_kernels( int nb_rays )
+{
+    const int nb_triangles = 16 * TRIANGLE_GROUP_SIZE;
+
+    // small triangles in a unit cube, rays from a sphere around it towards the cube
+    std::vector<vec3> p( 3 * nb_triangles );
+    std::vector<float> data( 9 * ( nb_triangles + TRIANGLE_GROUP_SIZE ), 0.0f );
+    const float *verts[9];
+    for ( int i = 0; i < 9; ++i )
+    {
+        verts[i] = data.data() + i * ( nb_triangles + TRIANGLE_GROUP_SIZE );
+    }
+    for ( int i = 0; i < nb_triangles; ++i )
+    {
+        vec3 center( RAN01(), RAN01(), RAN01() );
+        for ( int k = 0; k < 3; ++k )
+        {
+            p[3 * i + k] = center + 0.3f * random_in_unit_sphere();
+            for ( int a = 0; a < 3; ++a )
+            {
+                data[( 3 * k + a ) * ( nb_triangles + TRIANGLE_GROUP_SIZE ) + i] = p[3 * i + k][a];
+            }
+        }
+    }
+
+    std::vector<ray> rays( nb_rays );
+    for ( int i = 0; i < nb_rays; ++i )
+    {
+        vec3 o = vec3( 0.5f, 0.5f, 0.5f ) + 2.0f * unit_vector( random_in_unit_sphere() );
+        vec3 target( RAN01(), RAN01(), RAN01() );
+        rays[i] = ray( o, target - o );
+    }
+
+    std::vector<float> reference( nb_rays );
+    std::cout << "Triangle kernels    : " << nb_rays << " rays x " << nb_triangles << " triangles, 1 thread\n";
+    for ( int kernel = 0; kernel < 3; ++kernel )
+    {
+        // 0: scalar, 1: groups of 4, 2: groups of 8 (scalar lanes without avx)
+        int nb_hits = 0;
+        int nb_mismatches = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for ( int i = 0; i < nb_rays; ++i )
+        {
+            triangle_ray tr( rays[i] );
+            float closest = FLT_MAX;
+            float t[8], b0[8], b1[8], b2[8];
+            for ( int j = 0; j < nb_triangles; )
+            {
+                int mask = 0;
+                int width = 1;
+                if ( kernel == 0 )
+                {
+                    mask = intersect_triangle( tr, p[3 * j], p[3 * j + 1], p[3 * j + 2], 0.001f, closest, t[0], b0[0], b1[0], b2[0] ) ? 1 : 0;
+                }
+                else if ( kernel == 1 )
+                {
+                    mask = intersect_triangle_group<4>( tr, verts, j, 0.001f, closest, t, b0, b1, b2 );
+                    width = 4;
+                }
+                else
+                {
+                    mask = intersect_triangle_group<8>( tr, verts, j, 0.001f, closest, t, b0, b1, b2 );
+                    width = 8;
+                }
+                for ( int lane = 0; mask; ++lane, mask >>= 1 )
+                {
+                    if ( ( mask & 1 ) && t[lane] < closest )
+                    {
+                        closest = t[lane];
+                    }
+                }
+                j += width;
+            }
+
+            nb_hits += ( closest < FLT_MAX ) ? 1 : 0;
+            if ( kernel == 0 )
+            {
+                reference[i] = closest;
+            }
+            else if ( reference[i] != closest )
+            {
+                ++nb_mismatches;
+            }
+        }
+        auto end = std::chrono::high_resolution_clock::now();
+        double ms = std::chrono::duration<double, std::milli>( end - start ).count();
+
+        const char *names[] = { "scalar", "group 4", "group 8" };
+        std::cout << std::fixed << std::setprecision(2)
+            << "  " << std::setw(10) << std::left << names[kernel] << std::right
+            << " : " << std::setw(8) << ( (double)nb_rays * nb_triangles / ( ms * 1000.0 ) ) << " Mtris/s, "
+            << nb_hits << " hits, " << nb_mismatches << " mismatches\n";
+    }
+}
+
+#endif // _RAYTRACER_BENCH_H_
@@ -1,25 +1,80 @@
 #ifndef _RAYTRACER_BOX_H_
 #define _RAYTRACER_BOX_H_
 
+// Axis aligned box, one slab test instead of six rects: the hit is the
+// entry face, or the exit face from inside, with the outward normal and
+// the uv of the matching rect.
 struct box : public hitable
 {
     box() {}
-    box( const vec3 &p0, const vec3 &p1, material *mat ) 
-        : pmin(p0), pmax(p1)
+    box( const vec3 &p0, const vec3 &p1, material *mat, bool flip_normal = false ) 
+        : pmin(p0), pmax(p1), mat_ptr(mat), flip(flip_normal) {}
+    
+    // entry and exit distances over the three slabs, and their axis.
+    inline bool slabs( const ray &r, float &t_near, int &near_axis, float &t_far, int &far_axis ) const
     {
-        hitable **list = new hitable*[6];
-        list[0] = new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p1.z(), mat);
-        list[1] = new flip_normals(new xy_rect(p0.x(), p1.x(), p0.y(), p1.y(), p0.z(), mat));
-        list[2] = new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p1.y(), mat);
-        list[3] = new flip_normals(new xz_rect(p0.x(), p1.x(), p0.z(), p1.z(), p0.y(), mat));
-        list[4] = new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p1.x(), mat);
-        list[5] = new flip_normals(new yz_rect(p0.y(), p1.y(), p0.z(), p1.z(), p0.x(), mat));
-        list_ptr = new hitable_list( list, 6 );
+        const vec3 &inv_dir = r.inv_direction();
+        t_near = -FLT_MAX; t_far = FLT_MAX;
+        near_axis = -1; far_axis = -1;
+        for ( int a = 0; a < 3; ++a )
+        {
+            float ta = ( ( r.sign( a ) ? pmax[a] : pmin[a] ) - r._origin[a] ) * inv_dir[a];
+            float tb = ( ( r.sign( a ) ? pmin[a] : pmax[a] ) - r._origin[a] ) * inv_dir[a];
+            if ( ta > t_near ) { t_near = ta; near_axis = a; }
+            if ( tb < t_far ) { t_far = tb; far_axis = a; }
+        }
+        return near_axis >= 0 && t_near <= t_far;
     }
     
     virtual bool hit( const ray &r, float t0, float t1, hit_record &rec ) const override
     {
-        return list_ptr->hit(r,t0,t1,rec);
+        float t_near, t_far;
+        int near_axis, far_axis;
+        if ( !slabs( r, t_near, near_axis, t_far, far_axis ) )
+        {
+            return false;
+        }
+        
+        int axis;
+        bool on_max;
+        if ( t_near >= t0 && t_near <= t1 )
+        {
+            rec.t = t_near;
+            axis = near_axis;
+            on_max = r.sign( axis ) != 0;
+        }
+        else if ( t_far >= t0 && t_far <= t1 )
+        {
+            rec.t = t_far;
+            axis = far_axis;
+            on_max = r.sign( axis ) == 0;
+        }
+        else
+        {
+            return false;
+        }
+        
+        // u, v along the two other axes, in xyz order like the rects
+        int u_axis = ( axis == 0 ) ? 1 : 0;
+        int v_axis = ( axis == 2 ) ? 1 : 2;
+        rec.p = r.point_at_parameter( rec.t );
+        rec.u = ( rec.p[u_axis] - pmin[u_axis] ) / ( pmax[u_axis] - pmin[u_axis] );
+        rec.v = ( rec.p[v_axis] - pmin[v_axis] ) / ( pmax[v_axis] - pmin[v_axis] );
+        rec.normal = vec3( 0, 0, 0 );
+        rec.normal[axis] = ( on_max != flip ) ? 1.0f : -1.0f;
+        rec.mat_ptr = mat_ptr;
+        return true;
+    }
+    
+    virtual bool occluded( const ray &r, float t0, float t1 ) const override
+    {
+        float t_near, t_far;
+        int near_axis, far_axis;
+        if ( !slabs( r, t_near, near_axis, t_far, far_axis ) )
+        {
+            return false;
+        }
+        return ( t_near >= t0 && t_near <= t1 ) || ( t_far >= t0 && t_far <= t1 );
     }
     
     virtual bool bounding_box(float t0, float t1, aabb &box) const override
@@ -28,9 +83,11 @@ struct box : public hitable
         return true;
     }
     
+    virtual int kind() const override { return HITABLE_BOX; }
+    
     vec3 pmin, pmax;
-    hitable *list_ptr;
+    material *mat_ptr = nullptr;
+    bool flip = false; // inward normals, a flip_normals folded by the scene compiler
 };
 
 #endif // _RAYTRACER_BOX_H_
- 
\ No newline at end of file
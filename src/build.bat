@@ -4,7 +4,9 @@ set DebugCompilerFlags=/MTd /Od
 set ReleaseCompilerFlags=/MT /O2 /Oi /fp:fast
 set CompilerConfigFlags=%DebugCompilerFlags%
 REM /WX
-set CommonCompilerFlags=%CompilerConfigFlags% /nologo /Gm- /GR- /EHa- /EHsc- /W4 /wd4201 /wd4100 /wd4189 /wd4505 /wd4996 /Zi /FC -DHANDMADE_INTERNAL=1 -DHANDMADE_SLOW=1 -DHANDMADE_WIN32=1
+REM SSE2 is implied on x64, AVX2 enables the 8-wide code paths
+set ArchCompilerFlags=/arch:AVX2
+set CommonCompilerFlags=%CompilerConfigFlags% %ArchCompilerFlags% /nologo /Gm- /GR- /EHa- /EHsc- /W4 /wd4201 /wd4100 /wd4189 /wd4505 /wd4996 /Zi /FC -DHANDMADE_INTERNAL=1 -DHANDMADE_SLOW=1 -DHANDMADE_WIN32=1
 
 set CommonLinkerFlags=/incremental:no /opt:ref user32.lib gdi32.lib winmm.lib
 
@@ -18,7 +20,10 @@ del lock.tmp
 
 cl %CommonCompilerFlags% ..\src\win32_raytracer.cpp /Fmwin32_raytracer.map /link %CommonLinkerFlags% 
 
+cl %CommonCompilerFlags% ..\src\mesh_convert.cpp /Fmmesh_convert.map /link %CommonLinkerFlags% 
+
 xcopy main.exe ..\bin\ /Y /R /H
 xcopy win32_raytracer.exe ..\bin\ /Y /R /H
+xcopy mesh_convert.exe ..\bin\ /Y /R /H
 
 popd
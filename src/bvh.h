@@ -64,22 +64,229 @@
      }
  }
  
+ enum bvh_builder
+ {
+     BVH_BUILDER_MEDIAN, // random axis, split at n/2
+     BVH_BUILDER_SAH,    // binned surface area heuristic
+     BVH_BUILDER_LBVH,   // morton codes (lbvh.h)
+ };
+ 
+ struct bvh_build_params
+ {
+     int builder = BVH_BUILDER_SAH;
+     int nb_bins = 16;
+     int max_leaf_size = 4;
+     float traversal_cost = 1.0f;
+     float intersection_cost = 1.0f;
+     // parallel build, serial when pool is null.
+     thread_pool *pool = nullptr;
+     int task_min_size = 4096;
+     int data_parallel_min_size = 65536;
+     // lbvh: 30 or 63 bits codes, top bits grouped in treelets rebuilt with SAH (0: none)
+     int morton_bits = 30;
+     int lbvh_treelet_bits = 0;
+     // motion blur: a node interpolates its shutter open/close boxes with the ray
+     // time when its swept box is that much larger (interpolation isn't free).
+     float motion_min_growth = 1.25f;
+ };
+ 
+ // used by every bvh_node built without explicit params (scenes included).
+ global bvh_build_params g_bvh_build_params;
+ 
+ // deepest tree the traversal stacks (64 entries, asserted only) can walk.
+ const int BVH_MAX_DEPTH = 62;
+ 
+ enum bvh_traversal
+ {
+     BVH_TRAVERSAL_UNORDERED, // both children against the full [t_min, t_max]
+     BVH_TRAVERSAL_ORDERED,   // nearest child first, far child culled by the closest hit
+ };
+ 
+ global int g_bvh_traversal = BVH_TRAVERSAL_ORDERED;
+ 
+ // primitive bounds and centroids are computed once before a SAH build.
+ struct bvh_build_primitive
+ {
+     aabb box;
+     vec3 centroid;
+     hitable *ptr;
+ };
+ 
  struct bvh_node : public hitable
  {
      bvh_node() {}
-     bvh_node( hitable **l, int n, float time0, float time1);
+     bvh_node( hitable **l, int n, float time0, float time1, 
+              const bvh_build_params &params = g_bvh_build_params );
      virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec) const override;
+     virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
      virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+     virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override;
+     virtual int kind() const override { return HITABLE_BVH_NODE; }
+     
+     void build_median( hitable **l, int n, float time0, float time1, const bvh_build_params &params );
+     void build_sah( bvh_build_primitive *prims, int n, const bvh_build_params &params, 
+                    bool can_wait, task_counter *pending );
+     float update_sah_cost( float time0, float time1, const bvh_build_params &params );
+     void build_lbvh( bvh_build_primitive *prims, int n, float time0, float time1, 
+                     const bvh_build_params &params );
+     void emit_lbvh( bvh_build_primitive *prims, const uint64_t *codes, int n, int bit,
+                    const bvh_build_params &params, task_counter *pending, int depth );
+     aabb update_bounds( float time0, float time1 );
+     void set_motion_bounds( float time0, float time1, const bvh_build_params &params );
+     void update_motion_bounds( float time0, float time1, const bvh_build_params &params );
+     inline bool hit_box( const ray &r, float t_min, float t_max ) const;
      
      hitable *left;
      hitable *right;
      aabb box;
+     // boxes at shutter open and close (box is the whole swept volume),
+     // the ray time interpolates them when moving is set.
+     aabb box_t0;
+     aabb box_t1;
+     bool moving = false;
+     float time0 = 0.0f;
+     float inv_duration = 1.0f;
+     // split axis, left child is on the negative side.
+     int axis = 0;
+     // expected cost of a ray hitting this node's box, in units of traversal_cost.
+     float sah_cost = 0.0f;
  };
  
- bvh_node::bvh_node( hitable **l, int n, float time0, float time1 )
+ inline float surface_area( const aabb &b )
+ {
+     vec3 d = b.max() - b.min();
+     return 2.0f * ( d.x() * d.y() + d.y() * d.z() + d.z() * d.x() );
+ }
+ 
+ inline aabb empty_box()
+ {
+     return aabb( vec3( FLT_MAX, FLT_MAX, FLT_MAX ), vec3( -FLT_MAX, -FLT_MAX, -FLT_MAX ) );
+ }
+ 
+ // child cost weighted by the probability of hitting it knowing we hit the parent.
+ inline float child_sah_cost( const aabb &parent, const aabb &child, float child_cost )
+ {
+     float parent_area = surface_area( parent );
+     if ( parent_area <= 0.0f )
+     {
+         return child_cost;
+     }
+     return ( surface_area( child ) / parent_area ) * child_cost;
+ }
+ 
+ // a leaf with more than one primitive is a plain list.
+ hitable *make_bvh_leaf( bvh_build_primitive *prims, int n )
+ {
+     if ( n == 1 )
+     {
+         return prims[0].ptr;
+     }
+     
+     hitable **list = new hitable*[n];
+     for ( int i = 0; i < n; ++i )
+     {
+         list[i] = prims[i].ptr;
+     }
+     return new hitable_list( list, n );
+ }
+ 
+ // frees the inner nodes and leaf lists of a built tree, not the primitives
+ // (so only for trees whose primitives are not lists themselves).
+ void free_bvh_tree( hitable *h )
+ {
+     if ( h->kind() == HITABLE_BVH_NODE )
+     {
+         bvh_node *node = (bvh_node*)h;
+         free_bvh_tree( node->left );
+         if ( node->right != node->left )
+         {
+             free_bvh_tree( node->right );
+         }
+         delete node;
+     }
+     else if ( h->kind() == HITABLE_LIST )
+     {
+         hitable_list *list = (hitable_list*)h;
+         delete [] list->list;
+         delete list;
+     }
+ }
+ 
+ // levels of bvh_nodes from h down to its deepest primitive.
+ int bvh_depth( const hitable *h )
+ {
+     if ( h->kind() != HITABLE_BVH_NODE )
+     {
+         return 0;
+     }
+     const bvh_node *node = (const bvh_node*)h;
+     int left_depth = bvh_depth( node->left );
+     int right_depth = ( node->right != node->left ) ? bvh_depth( node->right ) : 0;
+     return 1 + ( left_depth > right_depth ? left_depth : right_depth );
+ }
+ 
+ bvh_node::bvh_node( hitable **l, int n, float time0, float time1, const bvh_build_params &params )
+ {
+     if ( params.builder == BVH_BUILDER_SAH || params.builder == BVH_BUILDER_LBVH )
+     {
+         bvh_build_primitive *prims = new bvh_build_primitive[n];
+         auto compute_bounds = [&]( int chunk, int begin, int end )
+         {
+             for ( int i = begin; i < end; ++i )
+             {
+                 if ( !l[i]->bounding_box( time0, time1, prims[i].box ) )
+                 {
+                     std::cerr << "no bounding box in bvh_node constructor\n";
+                 }
+                 prims[i].centroid = 0.5f * ( prims[i].box.min() + prims[i].box.max() );
+                 prims[i].ptr = l[i];
+             }
+         };
+         
+         if ( params.pool && n >= params.data_parallel_min_size )
+         {
+             parallel_for( params.pool, n, 4 * params.pool->num_threads, compute_bounds );
+         }
+         else
+         {
+             compute_bounds( 0, 0, n );
+         }
+         
+         if ( params.builder == BVH_BUILDER_LBVH )
+         {
+             build_lbvh( prims, n, time0, time1, params );
+         }
+         else if ( params.pool )
+         {
+             task_counter pending;
+             build_sah( prims, n, params, true, &pending );
+             pending.wait();
+         }
+         else
+         {
+             build_sah( prims, n, params, false, nullptr );
+         }
+         update_sah_cost( time0, time1, params );
+         update_motion_bounds( time0, time1, params );
+         
+         // keep the input list in leaf order
+         for ( int i = 0; i < n; ++i )
+         {
+             l[i] = prims[i].ptr;
+         }
+         
+         delete [] prims;
+     }
+     else
+     {
+         build_median( l, n, time0, time1, params );
+     }
+ }
+ 
+ void bvh_node::build_median( hitable **l, int n, float time0, float time1, const bvh_build_params &params )
  {
      // 1) choose a random separating axis
-     int axis = int(3.0f*RAN01()); 
+     axis = int(3.0f*RAN01()); 
      
      if ( axis == 0 )
      {
@@ -106,8 +313,8 @@
      }
      else
      {
-         left  = new bvh_node( l,         n/2,     time0, time1 );
-         right = new bvh_node( l + (n/2), n-(n/2), time0, time1 );
+         left  = new bvh_node( l,         n/2,     time0, time1, params );
+         right = new bvh_node( l + (n/2), n-(n/2), time0, time1, params );
      }
      
      aabb box_left, box_right;
@@ -118,15 +325,463 @@
      }
      
      box = surrounding_box( box_left, box_right );
+     
+     float left_cost = ( n > 2 ) ? ((bvh_node*)left)->sah_cost : params.intersection_cost;
+     float right_cost = ( n > 2 ) ? ((bvh_node*)right)->sah_cost : params.intersection_cost;
+     sah_cost = params.traversal_cost + 
+         child_sah_cost( box, box_left, left_cost ) + 
+         child_sah_cost( box, box_right, right_cost );
+     
+     // children are complete nodes already
+     set_motion_bounds( time0, time1, params );
+ }
+ 
+ inline bool worth_interpolating( const aabb &box0, const aabb &box1, const bvh_build_params &params )
+ {
+     float swept = surface_area( surrounding_box( box0, box1 ) );
+     float interpolated = 0.5f * ( surface_area( box0 ) + surface_area( box1 ) );
+     return swept > params.motion_min_growth * interpolated;
+ }
+ 
+ void bvh_node::set_motion_bounds( float t0, float t1, const bvh_build_params &params )
+ {
+     aabb left0, left1, right0, right1;
+     left->motion_bounding_box( t0, t1, left0, left1 );
+     right->motion_bounding_box( t0, t1, right0, right1 );
+     box_t0 = surrounding_box( left0, right0 );
+     box_t1 = surrounding_box( left1, right1 );
+     moving = worth_interpolating( box_t0, box_t1, params );
+     time0 = t0;
+     inv_duration = ( t1 > t0 ) ? 1.0f / ( t1 - t0 ) : 0.0f;
+ }
+ 
+ // bottom-up, for trees whose inner nodes did not go through the constructor.
+ void bvh_node::update_motion_bounds( float t0, float t1, const bvh_build_params &params )
+ {
+     if ( left->kind() == HITABLE_BVH_NODE )
+     {
+         ((bvh_node*)left)->update_motion_bounds( t0, t1, params );
+     }
+     if ( right != left && right->kind() == HITABLE_BVH_NODE )
+     {
+         ((bvh_node*)right)->update_motion_bounds( t0, t1, params );
+     }
+     set_motion_bounds( t0, t1, params );
+ }
+ 
+ inline bool bvh_node::hit_box( const ray &r, float t_min, float t_max ) const
+ {
+     if ( !moving )
+     {
+         return box.hit( r, t_min, t_max );
+     }
+     float s = ( r.time() - time0 ) * inv_duration;
+     return interpolate_box( box_t0, box_t1, s ).hit( r, t_min, t_max );
+ }
+ 
+ // bins of all three axes, filled in one pass over the primitives.
+ const int max_sah_bins = 64;
+ 
+ struct bvh_bins
+ {
+     int count[3][max_sah_bins];
+     aabb box[3][max_sah_bins];
+ };
+ 
+ inline void clear_bins( bvh_bins &bins, int nb_bins )
+ {
+     for ( int a = 0; a < 3; ++a )
+     {
+         for ( int b = 0; b < nb_bins; ++b )
+         {
+             bins.count[a][b] = 0;
+             bins.box[a][b] = empty_box();
+         }
+     }
+ }
+ 
+ inline int bin_index( const vec3 &centroid, int axis, const vec3 &cmin, const vec3 &scale, int nb_bins )
+ {
+     int b = int( ( centroid[axis] - cmin[axis] ) * scale[axis] );
+     return b > nb_bins - 1 ? nb_bins - 1 : b;
+ }
+ 
+ void fill_bins( const bvh_build_primitive *prims, int begin, int end, 
+                const vec3 &cmin, const vec3 &scale, int nb_bins, bvh_bins &bins )
+ {
+     for ( int i = begin; i < end; ++i )
+     {
+         for ( int a = 0; a < 3; ++a )
+         {
+             int b = bin_index( prims[i].centroid, a, cmin, scale, nb_bins );
+             bins.count[a][b]++;
+             bins.box[a][b] = surrounding_box( bins.box[a][b], prims[i].box );
+         }
+     }
+ }
+ 
+ // Subtrees above params.task_min_size are built as tasks on params.pool.
+ // Nodes above params.data_parallel_min_size are split by the calling thread,
+ // which computes their bounds, bins and partition on the pool and waits:
+ // only the thread that owns the build (not a pool thread) may do that.
+ struct bvh_build_task : public task
+ {
+     virtual void run() override
+     {
+         node->build_sah( prims, n, *params, false, pending );
+         pending->done();
+     }
+     
+     bvh_node *node;
+     bvh_build_primitive *prims;
+     int n;
+     const bvh_build_params *params;
+     task_counter *pending;
+ };
+ 
+ void bvh_node::build_sah( bvh_build_primitive *prims, int n, const bvh_build_params &params, 
+                          bool can_wait, task_counter *pending )
+ {
+     thread_pool *pool = pending ? params.pool : nullptr;
+     bool data_parallel = pool && can_wait && n >= params.data_parallel_min_size;
+     int nb_chunks = data_parallel ? 4 * pool->num_threads : 1;
+     
+     // 0) node and centroid bounds
+     box = empty_box();
+     aabb centroid_box = empty_box();
+     if ( data_parallel )
+     {
+         aabb *chunk_boxes = new aabb[2 * nb_chunks];
+         parallel_for( pool, n, nb_chunks, [&]( int chunk, int begin, int end )
+         {
+             aabb b = empty_box();
+             aabb c = empty_box();
+             for ( int i = begin; i < end; ++i )
+             {
+                 b = surrounding_box( b, prims[i].box );
+                 c = surrounding_box( c, aabb( prims[i].centroid, prims[i].centroid ) );
+             }
+             chunk_boxes[2 * chunk] = b;
+             chunk_boxes[2 * chunk + 1] = c;
+         });
+         for ( int c = 0; c < nb_chunks; ++c )
+         {
+             box = surrounding_box( box, chunk_boxes[2 * c] );
+             centroid_box = surrounding_box( centroid_box, chunk_boxes[2 * c + 1] );
+         }
+         delete [] chunk_boxes;
+     }
+     else
+     {
+         for ( int i = 0; i < n; ++i )
+         {
+             box = surrounding_box( box, prims[i].box );
+             centroid_box = surrounding_box( centroid_box, aabb( prims[i].centroid, prims[i].centroid ) );
+         }
+     }
+     
+     int mid = n / 2;
+     bool make_leaf = ( n <= 2 );
+     
+     // default split axis (leaves, no good plane): largest centroid extent.
+     vec3 centroid_extent = centroid_box.max() - centroid_box.min();
+     axis = 0;
+     if ( centroid_extent.y() > centroid_extent[axis] ) axis = 1;
+     if ( centroid_extent.z() > centroid_extent[axis] ) axis = 2;
+     
+     if ( !make_leaf )
+     {
+         // 1) bin the centroids along each axis and sweep the bins
+         //    to find the cheapest split plane.
+         int nb_bins = params.nb_bins < 2 ? 2 : ( params.nb_bins > max_sah_bins ? max_sah_bins : params.nb_bins );
+         vec3 cmin = centroid_box.min();
+         vec3 scale;
+         for ( int a = 0; a < 3; ++a )
+         {
+             scale[a] = centroid_extent[a] > 0.0f ? nb_bins / centroid_extent[a] : 0.0f;
+         }
+         
+         bvh_bins *bins = new bvh_bins[nb_chunks];
+         if ( data_parallel )
+         {
+             parallel_for( pool, n, nb_chunks, [&]( int chunk, int begin, int end )
+             {
+                 clear_bins( bins[chunk], nb_bins );
+                 fill_bins( prims, begin, end, cmin, scale, nb_bins, bins[chunk] );
+             });
+             for ( int c = 1; c < nb_chunks; ++c )
+             {
+                 for ( int a = 0; a < 3; ++a )
+                 {
+                     for ( int b = 0; b < nb_bins; ++b )
+                     {
+                         bins[0].count[a][b] += bins[c].count[a][b];
+                         bins[0].box[a][b] = surrounding_box( bins[0].box[a][b], bins[c].box[a][b] );
+                     }
+                 }
+             }
+         }
+         else
+         {
+             clear_bins( bins[0], nb_bins );
+             fill_bins( prims, 0, n, cmin, scale, nb_bins, bins[0] );
+         }
+         
+         float box_area = surface_area( box );
+         float best_cost = FLT_MAX;
+         int best_axis = -1;
+         int best_split = 0;
+         
+         for ( int a = 0; a < 3; ++a )
+         {
+             if ( centroid_extent[a] <= 0.0f )
+             {
+                 continue;
+             }
+             
+             const int *bin_count = bins[0].count[a];
+             const aabb *bin_box = bins[0].box[a];
+             
+             // right to left sweep: area and count of everything after the plane
+             float right_area[max_sah_bins];
+             int right_count[max_sah_bins];
+             aabb acc = empty_box();
+             int count = 0;
+             for ( int b = nb_bins - 1; b > 0; --b )
+             {
+                 acc = surrounding_box( acc, bin_box[b] );
+                 count += bin_count[b];
+                 right_area[b] = count ? surface_area( acc ) : 0.0f;
+                 right_count[b] = count;
+             }
+             
+             // left to right sweep: evaluate the plane between bin b-1 and b
+             acc = empty_box();
+             count = 0;
+             for ( int b = 1; b < nb_bins; ++b )
+             {
+                 acc = surrounding_box( acc, bin_box[b-1] );
+                 count += bin_count[b-1];
+                 if ( count == 0 || right_count[b] == 0 )
+                 {
+                     continue;
+                 }
+                 float cost = params.traversal_cost + params.intersection_cost * 
+                     ( surface_area( acc ) * count + right_area[b] * right_count[b] ) / box_area;
+                 if ( cost < best_cost )
+                 {
+                     best_cost = cost;
+                     best_axis = a;
+                     best_split = b;
+                 }
+             }
+         }
+         delete [] bins;
+         
+         float leaf_cost = params.intersection_cost * n;
+         if ( n <= params.max_leaf_size && leaf_cost <= best_cost )
+         {
+             make_leaf = true;
+         }
+         else if ( best_axis >= 0 )
+         {
+             // 2) partition the primitives around the chosen plane
+             if ( data_parallel )
+             {
+                 // count per chunk, then scatter to a copy at the chunk offsets
+                 int *chunk_left = new int[nb_chunks];
+                 parallel_for( pool, n, nb_chunks, [&]( int chunk, int begin, int end )
+                 {
+                     int c = 0;
+                     for ( int i = begin; i < end; ++i )
+                     {
+                         c += ( bin_index( prims[i].centroid, best_axis, cmin, scale, nb_bins ) < best_split );
+                     }
+                     chunk_left[chunk] = c;
+                 });
+                 
+                 int total_left = 0;
+                 for ( int c = 0; c < nb_chunks; ++c )
+                 {
+                     total_left += chunk_left[c];
+                 }
+                 
+                 bvh_build_primitive *sorted = new bvh_build_primitive[n];
+                 parallel_for( pool, n, nb_chunks, [&]( int chunk, int begin, int end )
+                 {
+                     int left_offset = 0;
+                     int right_offset = total_left;
+                     for ( int c = 0; c < chunk; ++c )
+                     {
+                         left_offset += chunk_left[c];
+                     }
+                     right_offset += begin - left_offset;
+                     for ( int i = begin; i < end; ++i )
+                     {
+                         if ( bin_index( prims[i].centroid, best_axis, cmin, scale, nb_bins ) < best_split )
+                         {
+                             sorted[left_offset++] = prims[i];
+                         }
+                         else
+                         {
+                             sorted[right_offset++] = prims[i];
+                         }
+                     }
+                 });
+                 parallel_for( pool, n, nb_chunks, [&]( int chunk, int begin, int end )
+                 {
+                     for ( int i = begin; i < end; ++i )
+                     {
+                         prims[i] = sorted[i];
+                     }
+                 });
+                 delete [] sorted;
+                 delete [] chunk_left;
+                 mid = total_left;
+             }
+             else
+             {
+                 bvh_build_primitive *first = prims;
+                 bvh_build_primitive *last = prims + n;
+                 while ( first < last )
+                 {
+                     if ( bin_index( first->centroid, best_axis, cmin, scale, nb_bins ) < best_split )
+                     {
+                         ++first;
+                     }
+                     else
+                     {
+                         std::swap( *first, *--last );
+                     }
+                 }
+                 mid = int( first - prims );
+             }
+             axis = best_axis;
+         }
+         
+         // all centroids in the same spot (or a degenerate partition):
+         // there is no good plane, just split the list in two.
+         if ( !make_leaf && ( mid == 0 || mid == n ) )
+         {
+             mid = n / 2;
+         }
+     }
+     
+     if ( make_leaf )
+     {
+         if ( n == 1 )
+         {
+             left = right = prims[0].ptr;
+         }
+         else
+         {
+             left  = make_bvh_leaf( prims,       mid );
+             right = make_bvh_leaf( prims + mid, n - mid );
+         }
+         return;
+     }
+     
+     bvh_node *left_node  = new bvh_node();
+     bvh_node *right_node = new bvh_node();
+     left = left_node;
+     right = right_node;
+     
+     // 3) children: the right one goes to the pool if it is big enough,
+     //    unless it is still big enough to be split in parallel by this thread.
+     int right_n = n - mid;
+     if ( pool && right_n >= params.task_min_size && 
+         !( can_wait && right_n >= params.data_parallel_min_size ) )
+     {
+         bvh_build_task *t = new bvh_build_task();
+         t->node = right_node;
+         t->prims = prims + mid;
+         t->n = right_n;
+         t->params = &params;
+         t->pending = pending;
+         pending->add();
+         pool->addTask( t );
+     }
+     else
+     {
+         right_node->build_sah( prims + mid, right_n, params, can_wait, pending );
+     }
+     
+     left_node->build_sah( prims, mid, params, can_wait, pending );
+ }
+ 
+ // bottom-up, once the (possibly parallel) build is done.
+ float bvh_node::update_sah_cost( float time0, float time1, const bvh_build_params &params )
+ {
+     hitable *children[2] = { left, right };
+     float cost = params.traversal_cost;
+     for ( int c = 0; c < 2; ++c )
+     {
+         hitable *child = children[c];
+         aabb child_box;
+         child->bounding_box( time0, time1, child_box );
+         
+         float child_cost;
+         if ( child->kind() == HITABLE_BVH_NODE )
+         {
+             child_cost = ((bvh_node*)child)->update_sah_cost( time0, time1, params );
+         }
+         else if ( child->kind() == HITABLE_LIST )
+         {
+             child_cost = params.intersection_cost * ((hitable_list*)child)->list_size;
+         }
+         else
+         {
+             child_cost = params.intersection_cost;
+         }
+         cost += child_sah_cost( box, child_box, child_cost );
+     }
+     
+     sah_cost = cost;
+     return cost;
  }
  
  bool bvh_node::hit( const ray &r, float t_min, float t_max, hit_record &rec) const
  {
-     if ( box.hit( r, t_min, t_max ) )
+     if ( g_bvh_traversal == BVH_TRAVERSAL_ORDERED )
+     {
+         if ( !hit_box( r, t_min, t_max ) )
+         {
+             return false;
+         }
+         
+         ++tl_stats.nb_node_visits;
+         
+         // near child first, its hit distance becomes the far child's t_max,
+         // so the far child's box test culls it when it is behind the hit.
+         hitable *near_child = left;
+         hitable *far_child = right;
+         if ( r.sign( axis ) )
+         {
+             std::swap( near_child, far_child );
+         }
+         
+         bool hit_near = near_child->hit( r, t_min, t_max, rec );
+         if ( far_child == near_child )
+         {
+             return hit_near;
+         }
+         
+         hit_record far_rec;
+         if ( far_child->hit( r, t_min, hit_near ? rec.t : t_max, far_rec ) )
+         {
+             rec = far_rec;
+             return true;
+         }
+         return hit_near;
+     }
+     
+     if ( hit_box( r, t_min, t_max ) )
      {
+         ++tl_stats.nb_node_visits;
          hit_record left_rec, right_rec;
          bool hit_left = left->hit( r, t_min, t_max, left_rec );
-         bool hit_right = right->hit( r, t_min, t_max, right_rec );
+         // single primitive nodes point twice to it, don't intersect it again.
+         bool hit_right = ( right != left ) && right->hit( r, t_min, t_max, right_rec );
          if ( hit_left && hit_right )
          {
              if ( left_rec.t < right_rec.t )
@@ -162,11 +817,93 @@
      }
  }
  
+ // any hit: no ordering, the first child that hits ends it.
+ bool bvh_node::occluded( const ray &r, float t_min, float t_max ) const
+ {
+     if ( !hit_box( r, t_min, t_max ) )
+     {
+         return false;
+     }
+     
+     ++tl_stats.nb_node_visits;
+     if ( left->occluded( r, t_min, t_max ) )
+     {
+         return true;
+     }
+     return ( right != left ) && right->occluded( r, t_min, t_max );
+ }
+ 
  bool bvh_node::bounding_box( float t0, float t1, aabb &b ) const
  {
      b = box;
      return true;
  }
  
+ bool bvh_node::motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const
+ {
+     box0 = box_t0;
+     box1 = box_t1;
+     return true;
+ }
+ 
+
+// Unbounded primitives (infinite planes) in the bvh would give it an
+// infinite root box, every ray would go down to their leaf. They are
+// kept out of it and tested next to the tree instead.
+struct scene_root : public hitable
+{
+    // t may be null, when every primitive is unbounded.
+    scene_root( hitable *t, hitable **l, int n ) : tree(t), unbounded(l, l + n) {}
+    virtual int kind() const override { return HITABLE_SCENE_ROOT; }
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override
+    {
+        bool hit_tree = tree && tree->hit( r, t_min, t_max, rec );
+        bool hit_other = hit_unbounded( r, t_min, hit_tree ? rec.t : t_max, rec );
+        return hit_tree || hit_other;
+    }
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+    {
+        for ( hitable *h : unbounded )
+        {
+            if ( h->occluded( r, t_min, t_max ) )
+            {
+                return true;
+            }
+        }
+        return tree && tree->occluded( r, t_min, t_max );
+    }
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override { return false; }
+    
+    // closer than t_max, rec is left alone on a miss.
+    bool hit_unbounded( const ray &r, float t_min, float t_max, hit_record &rec ) const
+    {
+        hit_record temp_rec;
+        bool hit_anything = false;
+        for ( hitable *h : unbounded )
+        {
+            if ( h->hit( r, t_min, t_max, temp_rec ) )
+            {
+                hit_anything = true;
+                t_max = temp_rec.t;
+                rec = temp_rec;
+            }
+        }
+        return hit_anything;
+    }
+    
+    hitable *tree;
+    std::vector<hitable*> unbounded;
+};
+
+// moves the primitives without bounds to the end of l, returns how many have some.
+int partition_unbounded( hitable **l, int n, float time0, float time1 )
+{
+    hitable **end = std::stable_partition( l, l + n, [time0, time1]( hitable *h )
+    {
+        aabb box;
+        return h->bounding_box( time0, time1, box );
+    } );
+    return (int)( end - l );
+}
+
 #endif // _RAYTRACER_BVH_H_
- 
\ No newline at end of file
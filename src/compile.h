@@ -0,0 +1,267 @@
+#ifndef _RAYTRACER_COMPILE_H_
+#define _RAYTRACER_COMPILE_H_
+
+// Scene compile pass, run once on a scenes.h world before the bvh build.
+// Static transform chains (translate, rotate_y) and flip_normals are folded
+// into the primitives: rects become world space quads with their normal
+// already flipped, translated spheres and boxes are moved and get their
+// flip flag, nested lists and bvh_nodes are flattened. Anything else under
+// a transform keeps a single instance wrapper instead of the chain, and a
+// flip_normals above it when flipped. The object of an instance can be
+// shared (a blas): only the wrappers above it are folded, it is kept whole.
+// Motion transforms are split into their segments. The scene graph is left
+// untouched.
+struct scene_compiler
+{
+    void compile( hitable *h, const mat34 &object_to_world, bool transformed, bool flip );
+    hitable *fold_wrappers( hitable *h, mat34 &object_to_world, bool &flip, material *&mat );
+    hitable *bake( hitable *h, const mat34 &object_to_world, bool transformed, bool flip );
+
+    std::vector<hitable*> prims;
+    int nb_folded = 0; // wrappers removed
+};
+
+inline bool is_translation( const mat34 &m )
+{
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 3; ++j )
+        {
+            if ( m.m[i][j] != ( ( i == j ) ? 1.0f : 0.0f ) )
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// rotate_y moves the ray by the inverse of this one
+inline mat34 rotate_y_matrix( const rotate_y *rot )
+{
+    mat34 m = mat34_identity();
+    m.m[0][0] = rot->cos_theta;  m.m[0][2] = rot->sin_theta;
+    m.m[2][0] = -rot->sin_theta; m.m[2][2] = rot->cos_theta;
+    return m;
+}
+
+// the rect spanned by u and v from q, its normal n, in world space.
+inline hitable *bake_rect( const vec3 &q, const vec3 &u, const vec3 &v, const vec3 &n,
+                           material *mat, const mat34 &object_to_world, bool flip )
+{
+    vec3 normal = unit_vector( transform_normal( inverse( object_to_world ), n ) );
+    return new quad( transform_point( object_to_world, q ),
+                     transform_vector( object_to_world, u ),
+                     transform_vector( object_to_world, v ),
+                     flip ? -normal : normal, mat );
+}
+
+void scene_compiler::compile( hitable *h, const mat34 &object_to_world, bool transformed, bool flip )
+{
+    switch ( h->kind() )
+    {
+        case HITABLE_LIST:
+        {
+            hitable_list *l = (hitable_list*)h;
+            for ( int i = 0; i < l->list_size; ++i )
+            {
+                compile( l->list[i], object_to_world, transformed, flip );
+            }
+            return;
+        }
+        case HITABLE_BVH_NODE:
+        {
+            bvh_node *node = (bvh_node*)h;
+            compile( node->left, object_to_world, transformed, flip );
+            if ( node->right != node->left )
+            {
+                compile( node->right, object_to_world, transformed, flip );
+            }
+            return;
+        }
+        case HITABLE_FLIP_NORMALS:
+        {
+            ++nb_folded;
+            compile( ( (flip_normals*)h )->ptr, object_to_world, transformed, !flip );
+            return;
+        }
+        case HITABLE_TRANSLATE:
+        {
+            ++nb_folded;
+            translate *t = (translate*)h;
+            compile( t->ptr, object_to_world * mat34_translation( t->offset ), true, flip );
+            return;
+        }
+        case HITABLE_ROTATE_Y:
+        {
+            ++nb_folded;
+            rotate_y *rot = (rotate_y*)h;
+            compile( rot->ptr, object_to_world * rotate_y_matrix( rot ), true, flip );
+            return;
+        }
+        case HITABLE_INSTANCE:
+        {
+            mat34 m = object_to_world;
+            material *mat = nullptr;
+            hitable *object = fold_wrappers( h, m, flip, mat );
+            if ( mat )
+            {
+                hitable *out = new instance( object, m, mat );
+                prims.push_back( flip ? new flip_normals( out ) : out );
+            }
+            else
+            {
+                prims.push_back( bake( object, m, true, flip ) );
+            }
+            return;
+        }
+        case HITABLE_MOTION_TRANSFORM:
+        {
+            motion_transform *m = (motion_transform*)h;
+            if ( !transformed && !flip && m->hasbox )
+            {
+                for ( int s = 0; s < m->nb_segments(); ++s )
+                {
+                    prims.push_back( new motion_segment( m, s ) );
+                }
+                return;
+            }
+            prims.push_back( bake( h, object_to_world, transformed, flip ) );
+            return;
+        }
+        default:
+        {
+            prims.push_back( bake( h, object_to_world, transformed, flip ) );
+            return;
+        }
+    }
+}
+
+// the first object under the chain of transforms and flips from h, their
+// product is appended to object_to_world. mat gets the outermost instance
+// material, it replaces the inner ones.
+hitable *scene_compiler::fold_wrappers( hitable *h, mat34 &object_to_world, bool &flip, material *&mat )
+{
+    for (;;)
+    {
+        switch ( h->kind() )
+        {
+            case HITABLE_TRANSLATE:
+            {
+                translate *t = (translate*)h;
+                object_to_world = object_to_world * mat34_translation( t->offset );
+                h = t->ptr;
+                break;
+            }
+            case HITABLE_ROTATE_Y:
+            {
+                rotate_y *rot = (rotate_y*)h;
+                object_to_world = object_to_world * rotate_y_matrix( rot );
+                h = rot->ptr;
+                break;
+            }
+            case HITABLE_INSTANCE:
+            {
+                instance *inst = (instance*)h;
+                object_to_world = object_to_world * inst->object_to_world;
+                mat = mat ? mat : inst->mat_ptr;
+                h = inst->blas;
+                break;
+            }
+            case HITABLE_FLIP_NORMALS:
+            {
+                flip = !flip;
+                h = ( (flip_normals*)h )->ptr;
+                break;
+            }
+            default:
+                return h;
+        }
+        ++nb_folded;
+    }
+}
+
+hitable *scene_compiler::bake( hitable *h, const mat34 &object_to_world, bool transformed, bool flip )
+{
+    if ( !transformed && !flip )
+    {
+        return h;
+    }
+
+    bool translation = is_translation( object_to_world );
+    vec3 offset( object_to_world.m[0][3], object_to_world.m[1][3], object_to_world.m[2][3] );
+    switch ( h->kind() )
+    {
+        case HITABLE_XY_RECT:
+        {
+            xy_rect *r = (xy_rect*)h;
+            if ( translation && !flip )
+            {
+                return new xy_rect( r->x0 + offset.x(), r->x1 + offset.x(), r->y0 + offset.y(), r->y1 + offset.y(),
+                                    r->z + offset.z(), r->mat_ptr );
+            }
+            return bake_rect( vec3( r->x0, r->y0, r->z ), vec3( r->x1 - r->x0, 0, 0 ), vec3( 0, r->y1 - r->y0, 0 ),
+                              vec3( 0, 0, 1 ), r->mat_ptr, object_to_world, flip );
+        }
+        case HITABLE_XZ_RECT:
+        {
+            xz_rect *r = (xz_rect*)h;
+            if ( translation && !flip )
+            {
+                return new xz_rect( r->x0 + offset.x(), r->x1 + offset.x(), r->z0 + offset.z(), r->z1 + offset.z(),
+                                    r->y + offset.y(), r->mat_ptr );
+            }
+            return bake_rect( vec3( r->x0, r->y, r->z0 ), vec3( r->x1 - r->x0, 0, 0 ), vec3( 0, 0, r->z1 - r->z0 ),
+                              vec3( 0, 1, 0 ), r->mat_ptr, object_to_world, flip );
+        }
+        case HITABLE_YZ_RECT:
+        {
+            yz_rect *r = (yz_rect*)h;
+            if ( translation && !flip )
+            {
+                return new yz_rect( r->y0 + offset.y(), r->y1 + offset.y(), r->z0 + offset.z(), r->z1 + offset.z(),
+                                    r->x + offset.x(), r->mat_ptr );
+            }
+            return bake_rect( vec3( r->x, r->y0, r->z0 ), vec3( 0, r->y1 - r->y0, 0 ), vec3( 0, 0, r->z1 - r->z0 ),
+                              vec3( 1, 0, 0 ), r->mat_ptr, object_to_world, flip );
+        }
+        case HITABLE_BOX:
+        {
+            box *b = (box*)h;
+            if ( translation )
+            {
+                return new box( b->pmin + offset, b->pmax + offset, b->mat_ptr, b->flip != flip );
+            }
+            break;
+        }
+        case HITABLE_SPHERE:
+        {
+            // rotated spheres would rotate their texture coordinates
+            sphere *s = (sphere*)h;
+            if ( translation )
+            {
+                return new sphere( s->center + offset, s->radius, s->mat, s->flip != flip );
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    hitable *out = transformed ? new instance( h, object_to_world ) : h;
+    return flip ? new flip_normals( out ) : out;
+}
+
+// flat primitive list of world, for the bvh build.
+std::vector<hitable*> compile_scene( hitable *world, int *nb_folded = nullptr )
+{
+    scene_compiler c;
+    c.compile( world, mat34_identity(), false, false );
+    if ( nb_folded )
+    {
+        *nb_folded = c.nb_folded;
+    }
+    return c.prims;
+}
+
+#endif // _RAYTRACER_COMPILE_H_
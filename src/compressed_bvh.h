@@ -0,0 +1,378 @@
+#ifndef _RAYTRACER_COMPRESSED_BVH_H_
+#define _RAYTRACER_COMPRESSED_BVH_H_
+
+// Wide bvh with quantized children boxes: each node keeps its own box as
+// an origin and a scale per axis, its children boxes are 8 bit offsets on
+// a 255 steps grid over it, rounded outwards so that no hit is missed.
+// 72 bytes per node for N=4 (124 uncompressed), 120 for N=8 (244).
+// Moving nodes are stored with their swept boxes.
+template <int N>
+struct compressed_bvh_node
+{
+    float origin[3];
+    float scale[3];
+    uint8_t qmin[3][N];
+    uint8_t qmax[3][N];
+    int32_t child[N];     // >= 0: inner node index, < 0: leaf starting at primitive ~child
+    uint16_t nb_prims[N]; // 0 for inner nodes and empty slots
+};
+
+// Same as wide_slab_test, with the planes t = ( origin + q * scale - o ) / d
+// computed as q * a + b, a and b being per node and per axis.
+template <int N>
+inline int compressed_slab_test( const compressed_bvh_node<N> &node, const ray &r, float t_min, float t_max, float *t_entry )
+{
+    const vec3 &inv_dir = r.inv_direction();
+    float a[3], b[3];
+    for ( int k = 0; k < 3; ++k )
+    {
+        a[k] = node.scale[k] * inv_dir[k];
+        b[k] = ( node.origin[k] - r._origin[k] ) * inv_dir[k];
+    }
+
+    int mask = 0;
+    for ( int i = 0; i < N; ++i )
+    {
+        float t_near = t_min;
+        float t_far = t_max;
+        for ( int k = 0; k < 3; ++k )
+        {
+            const uint8_t *near_plane = r.sign( k ) ? node.qmax[k] : node.qmin[k];
+            const uint8_t *far_plane = r.sign( k ) ? node.qmin[k] : node.qmax[k];
+            float t0 = (float)near_plane[i] * a[k] + b[k];
+            float t1 = ( (float)far_plane[i] * a[k] + b[k] ) * SLAB_FAR_SCALE;
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far = t1 < t_far ? t1 : t_far;
+        }
+        t_entry[i] = t_near;
+        if ( t_near < t_far )
+        {
+            mask |= ( 1 << i );
+        }
+    }
+    return mask;
+}
+
+#if RAYTRACER_SSE
+inline __m128 load_quantized4( const uint8_t *q )
+{
+    int32_t bytes = (int32_t)( (uint32_t)q[0] | ( (uint32_t)q[1] << 8 ) | ( (uint32_t)q[2] << 16 ) | ( (uint32_t)q[3] << 24 ) );
+    __m128i zero = _mm_setzero_si128();
+    __m128i x = _mm_cvtsi32_si128( bytes );
+    x = _mm_unpacklo_epi8( x, zero );
+    x = _mm_unpacklo_epi16( x, zero );
+    return _mm_cvtepi32_ps( x );
+}
+
+template <>
+inline int compressed_slab_test<4>( const compressed_bvh_node<4> &node, const ray &r, float t_min, float t_max, float *t_entry )
+{
+    __m128 t_near = _mm_set1_ps( t_min );
+    __m128 t_far = _mm_set1_ps( t_max );
+    __m128 far_scale = _mm_set1_ps( SLAB_FAR_SCALE );
+    for ( int k = 0; k < 3; ++k )
+    {
+        __m128 a = _mm_set1_ps( node.scale[k] * r.inv_direction()[k] );
+        __m128 b = _mm_set1_ps( ( node.origin[k] - r._origin[k] ) * r.inv_direction()[k] );
+        const uint8_t *near_plane = r.sign( k ) ? node.qmax[k] : node.qmin[k];
+        const uint8_t *far_plane = r.sign( k ) ? node.qmin[k] : node.qmax[k];
+        __m128 t0 = _mm_add_ps( _mm_mul_ps( load_quantized4( near_plane ), a ), b );
+        __m128 t1 = _mm_mul_ps( _mm_add_ps( _mm_mul_ps( load_quantized4( far_plane ), a ), b ), far_scale );
+        // NaN (0 * inf) in the first operand returns the second one: ignored slab.
+        t_near = _mm_max_ps( t0, t_near );
+        t_far = _mm_min_ps( t1, t_far );
+    }
+    _mm_storeu_ps( t_entry, t_near );
+    return _mm_movemask_ps( _mm_cmplt_ps( t_near, t_far ) );
+}
+#endif
+
+#if RAYTRACER_AVX2
+inline __m256 load_quantized8( const uint8_t *q )
+{
+    return _mm256_cvtepi32_ps( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)q ) ) );
+}
+
+template <>
+inline int compressed_slab_test<8>( const compressed_bvh_node<8> &node, const ray &r, float t_min, float t_max, float *t_entry )
+{
+    __m256 t_near = _mm256_set1_ps( t_min );
+    __m256 t_far = _mm256_set1_ps( t_max );
+    __m256 far_scale = _mm256_set1_ps( SLAB_FAR_SCALE );
+    for ( int k = 0; k < 3; ++k )
+    {
+        __m256 a = _mm256_set1_ps( node.scale[k] * r.inv_direction()[k] );
+        __m256 b = _mm256_set1_ps( ( node.origin[k] - r._origin[k] ) * r.inv_direction()[k] );
+        const uint8_t *near_plane = r.sign( k ) ? node.qmax[k] : node.qmin[k];
+        const uint8_t *far_plane = r.sign( k ) ? node.qmin[k] : node.qmax[k];
+        __m256 t0 = _mm256_add_ps( _mm256_mul_ps( load_quantized8( near_plane ), a ), b );
+        __m256 t1 = _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( load_quantized8( far_plane ), a ), b ), far_scale );
+        t_near = _mm256_max_ps( t0, t_near );
+        t_far = _mm256_min_ps( t1, t_far );
+    }
+    _mm256_storeu_ps( t_entry, t_near );
+    return _mm256_movemask_ps( _mm256_cmp_ps( t_near, t_far, _CMP_LT_OQ ) );
+}
+#endif
+
+template <int N>
+struct compressed_bvh : public hitable
+{
+    compressed_bvh() {}
+    // collapses the tree into a wide_bvh first, then quantizes its nodes.
+    compressed_bvh( const bvh_node *root, float time0, float time1 );
+
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+
+    void compress( const wide_bvh<N> &w );
+
+    std::vector< compressed_bvh_node<N> > nodes;
+    std::vector<hitable*> prims;
+    aabb bounds;
+};
+
+typedef compressed_bvh<4> cbvh4;
+typedef compressed_bvh<8> cbvh8;
+
+template <int N>
+compressed_bvh<N>::compressed_bvh( const bvh_node *root, float time0, float time1 )
+{
+    wide_bvh<N> w( root, time0, time1 );
+    compress( w );
+}
+
+template <int N>
+void compressed_bvh<N>::compress( const wide_bvh<N> &w )
+{
+    prims = w.prims;
+    bounds = w.bounds;
+    nodes.resize( w.nodes.size() );
+
+    for ( size_t n = 0; n < w.nodes.size(); ++n )
+    {
+        const wide_bvh_node<N> &src = w.nodes[n];
+        compressed_bvh_node<N> &dst = nodes[n];
+
+        // swept children boxes, empty slots are inverted
+        float bmin[3][N], bmax[3][N];
+        for ( int k = 0; k < 3; ++k )
+        {
+            for ( int i = 0; i < N; ++i )
+            {
+                bmin[k][i] = src.bmin[k][i];
+                bmax[k][i] = src.bmax[k][i];
+                if ( src.moving )
+                {
+                    bmin[k][i] = ffmin( bmin[k][i], w.motion[n].bmin[k][i] );
+                    bmax[k][i] = ffmax( bmax[k][i], w.motion[n].bmax[k][i] );
+                }
+            }
+        }
+
+        for ( int k = 0; k < 3; ++k )
+        {
+            float lo = FLT_MAX;
+            float hi = -FLT_MAX;
+            for ( int i = 0; i < N; ++i )
+            {
+                if ( bmin[k][i] <= bmax[k][i] )
+                {
+                    lo = ffmin( lo, bmin[k][i] );
+                    hi = ffmax( hi, bmax[k][i] );
+                }
+            }
+
+            // the grid must reach hi in float arithmetic too
+            float scale = ( hi > lo ) ? ( hi - lo ) / 255.0f : 1.0f;
+            while ( lo + 255.0f * scale < hi )
+            {
+                scale = nextafterf( scale, FLT_MAX );
+            }
+            dst.origin[k] = lo;
+            dst.scale[k] = scale;
+
+            for ( int i = 0; i < N; ++i )
+            {
+                if ( bmin[k][i] > bmax[k][i] )
+                {
+                    // empty slot: min above max, never hit
+                    dst.qmin[k][i] = 1;
+                    dst.qmax[k][i] = 0;
+                    continue;
+                }
+
+                // round outwards, then fix what the float math rounded inwards
+                int q0 = (int)floorf( ( bmin[k][i] - lo ) / scale );
+                int q1 = (int)ceilf( ( bmax[k][i] - lo ) / scale );
+                q0 = q0 < 0 ? 0 : ( q0 > 255 ? 255 : q0 );
+                q1 = q1 < 0 ? 0 : ( q1 > 255 ? 255 : q1 );
+                while ( q0 > 0 && lo + q0 * scale > bmin[k][i] )
+                {
+                    --q0;
+                }
+                while ( q1 < 255 && lo + q1 * scale < bmax[k][i] )
+                {
+                    ++q1;
+                }
+                dst.qmin[k][i] = (uint8_t)q0;
+                dst.qmax[k][i] = (uint8_t)q1;
+            }
+        }
+
+        for ( int i = 0; i < N; ++i )
+        {
+            dst.child[i] = src.child[i];
+            dst.nb_prims[i] = src.nb_prims[i];
+        }
+    }
+}
+
+template <int N>
+bool compressed_bvh<N>::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    if ( nodes.empty() || !bounds.hit( r, t_min, t_max ) )
+    {
+        return false;
+    }
+
+
+    struct stack_entry
+    {
+        int32_t child;
+        uint32_t nb_prims;
+        float t_entry;
+    };
+
+    const int max_stack_size = 64 * N;
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size].child = 0;
+    stack[stack_size].nb_prims = 0;
+    stack[stack_size].t_entry = t_min;
+    ++stack_size;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+    hit_record temp_rec;
+
+    while ( stack_size > 0 )
+    {
+        stack_entry e = stack[--stack_size];
+        if ( e.t_entry >= closest_so_far )
+        {
+            ++tl_stats.nb_culled_nodes;
+            continue;
+        }
+
+        if ( e.child < 0 )
+        {
+            uint32_t first = (uint32_t)~e.child;
+            for ( uint32_t i = first; i < first + e.nb_prims; ++i )
+            {
+                if ( prims[i]->hit( r, t_min, closest_so_far, temp_rec ) )
+                {
+                    hit_anything = true;
+                    closest_so_far = temp_rec.t;
+                    rec = temp_rec;
+                }
+            }
+            continue;
+        }
+
+        const compressed_bvh_node<N> &node = nodes[e.child];
+        ++tl_stats.nb_node_visits;
+
+        float t_entry[N];
+        int mask = compressed_slab_test<N>( node, r, t_min, closest_so_far, t_entry );
+
+        // hit children sorted far to near, so the nearest is on top of the stack
+        int order[N];
+        int nb_hit = 0;
+        for ( int i = 0; i < N; ++i )
+        {
+            if ( mask & ( 1 << i ) )
+            {
+                int j = nb_hit++;
+                while ( j > 0 && t_entry[order[j-1]] < t_entry[i] )
+                {
+                    order[j] = order[j-1];
+                    --j;
+                }
+                order[j] = i;
+            }
+        }
+
+        assert( stack_size + nb_hit <= max_stack_size );
+        for ( int k = 0; k < nb_hit; ++k )
+        {
+            int i = order[k];
+            stack[stack_size].child = node.child[i];
+            stack[stack_size].nb_prims = node.nb_prims[i];
+            stack[stack_size].t_entry = t_entry[i];
+            ++stack_size;
+        }
+    }
+
+    return hit_anything;
+}
+
+template <int N>
+bool compressed_bvh<N>::occluded( const ray &r, float t_min, float t_max ) const
+{
+    if ( nodes.empty() || !bounds.hit( r, t_min, t_max ) )
+    {
+        return false;
+    }
+
+
+    const int max_stack_size = 64 * N;
+    uint32_t stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while ( stack_size > 0 )
+    {
+        const compressed_bvh_node<N> &node = nodes[stack[--stack_size]];
+        ++tl_stats.nb_node_visits;
+
+        float t_entry[N];
+        int mask = compressed_slab_test<N>( node, r, t_min, t_max, t_entry );
+        for ( int i = 0; i < N; ++i )
+        {
+            if ( !( mask & ( 1 << i ) ) )
+            {
+                continue;
+            }
+
+            if ( node.child[i] < 0 )
+            {
+                uint32_t first = (uint32_t)~node.child[i];
+                for ( uint32_t p = first; p < first + node.nb_prims[i]; ++p )
+                {
+                    if ( prims[p]->occluded( r, t_min, t_max ) )
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size++] = (uint32_t)node.child[i];
+            }
+        }
+    }
+
+    return false;
+}
+
+template <int N>
+bool compressed_bvh<N>::bounding_box( float t0, float t1, aabb &box ) const
+{
+    box = bounds;
+    return true;
+}
+
+#endif // _RAYTRACER_COMPRESSED_BVH_H_
@@ -0,0 +1,271 @@
+#ifndef _RAYTRACER_HEIGHTFIELD_H_
+#define _RAYTRACER_HEIGHTFIELD_H_
+
+// Terrain as a 2D array of heights over a grid of nx * nz cells in xz,
+// one float per cell or per vertex instead of a hitable per cell. Rays
+// walk the cells they cross in order (2D DDA) and stop at the first one
+// hit. Cells under the ray are skipped without a test, and blocks of
+// HEIGHTFIELD_BLOCK x HEIGHTFIELD_BLOCK cells under the ray in one step
+// (their max height is kept, a float per block).
+//
+//   HEIGHTFIELD_COLUMNS  one height per cell, a box from base up to it
+//                        (the book2 floor), nx * nz heights.
+//   HEIGHTFIELD_SMOOTH   one height per grid vertex, two triangles per
+//                        cell, (nx + 1) * (nz + 1) heights.
+//
+// Heights are stored row by row along x.
+enum heightfield_type
+{
+    HEIGHTFIELD_COLUMNS,
+    HEIGHTFIELD_SMOOTH,
+};
+
+const int HEIGHTFIELD_BLOCK = 16;
+
+struct heightfield : public hitable
+{
+    heightfield( int t, int _nx, int _nz, const vec3 &corner, float _dx, float _dz,
+                 std::vector<float> &&h, material *mat );
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override
+    {
+        box = aabb( bmin, bmax );
+        return true;
+    }
+    virtual int kind() const override { return HITABLE_HEIGHTFIELD; }
+
+    // the first cell hit along r in ]t_min, t_max[ has the closest hit.
+    bool traverse( const ray &r, float t_min, float t_max, hit_record &rec ) const;
+    bool hit_cell( const ray &r, const triangle_ray &tr, int i, int j, float t_min, float t_max, hit_record &rec ) const;
+    float cell_max( int i, int j ) const;
+    // where the ray leaves the x (and z) boundaries of cell or block [i0, i1[.
+    float x_exit( const ray &r, int i0, int i1 ) const { return ( ( r.sign( 0 ) ? i0 : i1 ) * dx + x0 - r._origin.x() ) * r.inv_direction().x(); }
+    float z_exit( const ray &r, int j0, int j1 ) const { return ( ( r.sign( 2 ) ? j0 : j1 ) * dz + z0 - r._origin.z() ) * r.inv_direction().z(); }
+    vec3 vertex( int i, int j ) const { return vec3( x0 + i * dx, heights[j * ( nx + 1 ) + i], z0 + j * dz ); }
+    vec3 vertex_normal( int i, int j ) const;
+
+    int type;
+    int nx, nz;
+    float x0, base, z0;
+    float dx, dz;
+    std::vector<float> heights;
+    std::vector<float> block_max; // nbx * nbz
+    int nbx, nbz;
+    vec3 bmin, bmax;
+    material *mat_ptr;
+};
+
+heightfield::heightfield( int t, int _nx, int _nz, const vec3 &corner, float _dx, float _dz,
+                          std::vector<float> &&h, material *mat )
+    : type(t), nx(_nx), nz(_nz), x0(corner.x()), base(corner.y()), z0(corner.z()), dx(_dx), dz(_dz),
+      heights(std::move(h)), mat_ptr(mat)
+{
+    assert( heights.size() == ( ( type == HEIGHTFIELD_COLUMNS ) ? (size_t)nx * nz : (size_t)( nx + 1 ) * ( nz + 1 ) ) );
+    float lo = ( type == HEIGHTFIELD_COLUMNS ) ? base : FLT_MAX;
+    float hi = -FLT_MAX;
+    for ( float y : heights )
+    {
+        lo = ffmin( lo, y );
+        hi = ffmax( hi, y );
+    }
+    bmin = vec3( x0, lo, z0 );
+    bmax = vec3( x0 + nx * dx, hi, z0 + nz * dz );
+    
+    nbx = ( nx + HEIGHTFIELD_BLOCK - 1 ) / HEIGHTFIELD_BLOCK;
+    nbz = ( nz + HEIGHTFIELD_BLOCK - 1 ) / HEIGHTFIELD_BLOCK;
+    block_max.assign( (size_t)nbx * nbz, -FLT_MAX );
+    for ( int j = 0; j < nz; ++j )
+    {
+        for ( int i = 0; i < nx; ++i )
+        {
+            float &m = block_max[( j / HEIGHTFIELD_BLOCK ) * nbx + i / HEIGHTFIELD_BLOCK];
+            m = ffmax( m, cell_max( i, j ) );
+        }
+    }
+}
+
+float heightfield::cell_max( int i, int j ) const
+{
+    if ( type == HEIGHTFIELD_COLUMNS )
+    {
+        return heights[j * nx + i];
+    }
+    const float *row0 = &heights[j * ( nx + 1 ) + i];
+    const float *row1 = row0 + nx + 1;
+    return ffmax( ffmax( row0[0], row0[1] ), ffmax( row1[0], row1[1] ) );
+}
+
+// central differences, one sided on the borders.
+vec3 heightfield::vertex_normal( int i, int j ) const
+{
+    int i0 = ( i > 0 ) ? i - 1 : i, i1 = ( i < nx ) ? i + 1 : i;
+    int j0 = ( j > 0 ) ? j - 1 : j, j1 = ( j < nz ) ? j + 1 : j;
+    float sx = ( heights[j * ( nx + 1 ) + i1] - heights[j * ( nx + 1 ) + i0] ) / ( ( i1 - i0 ) * dx );
+    float sz = ( heights[j1 * ( nx + 1 ) + i] - heights[j0 * ( nx + 1 ) + i] ) / ( ( j1 - j0 ) * dz );
+    return unit_vector( vec3( -sx, 1.0f, -sz ) );
+}
+
+bool heightfield::hit_cell( const ray &r, const triangle_ray &tr, int i, int j, float t_min, float t_max, hit_record &rec ) const
+{
+    if ( type == HEIGHTFIELD_COLUMNS )
+    {
+        box column( vec3( x0 + i * dx, base, z0 + j * dz ), vec3( x0 + ( i + 1 ) * dx, heights[j * nx + i], z0 + ( j + 1 ) * dz ), mat_ptr );
+        return column.box::hit( r, t_min, t_max, rec );
+    }
+
+    // (00, 10, 11) and (00, 11, 01), the vertices shared with the
+    // neighbours are the same floats: watertight across cells too.
+    vec3 p00 = vertex( i, j ), p10 = vertex( i + 1, j ), p11 = vertex( i + 1, j + 1 ), p01 = vertex( i, j + 1 );
+    float t, b0, b1, b2;
+    int hit_tri = -1;
+    float closest = t_max;
+    float w[3];
+    if ( intersect_triangle( tr, p00, p10, p11, t_min, closest, t, b0, b1, b2 ) )
+    {
+        hit_tri = 0; closest = t; w[0] = b0; w[1] = b1; w[2] = b2;
+    }
+    if ( intersect_triangle( tr, p00, p11, p01, t_min, closest, t, b0, b1, b2 ) )
+    {
+        hit_tri = 1; closest = t; w[0] = b0; w[1] = b1; w[2] = b2;
+    }
+    if ( hit_tri < 0 )
+    {
+        return false;
+    }
+
+    vec3 n00 = vertex_normal( i, j ), n11 = vertex_normal( i + 1, j + 1 );
+    vec3 n = ( hit_tri == 0 ) ? w[0] * n00 + w[1] * vertex_normal( i + 1, j ) + w[2] * n11
+                              : w[0] * n00 + w[1] * n11 + w[2] * vertex_normal( i, j + 1 );
+    rec.t = closest;
+    rec.p = r.point_at_parameter( rec.t );
+    rec.normal = unit_vector( n );
+    rec.u = ( rec.p.x() - x0 ) / ( nx * dx );
+    rec.v = ( rec.p.z() - z0 ) / ( nz * dz );
+    rec.mat_ptr = mat_ptr;
+    return true;
+}
+
+bool heightfield::traverse( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    float t_enter;
+    if ( !slab_test( bmin, bmax, r, t_min, t_max, t_enter ) )
+    {
+        return false;
+    }
+
+    // exit of the bounds, slab_test only gives the entry
+    const vec3 &o = r._origin;
+    const vec3 &d = r._direction;
+    const vec3 &inv_dir = r.inv_direction();
+    float t_exit = t_max;
+    for ( int a = 0; a < 3; ++a )
+    {
+        float far_plane = r.sign( a ) ? bmin[a] : bmax[a];
+        float t = ( far_plane - o[a] ) * inv_dir[a];
+        t_exit = ( t < t_exit ) ? t : t_exit;
+    }
+
+    // start cell, clamped: the entry point is on the border
+    vec3 p = r.point_at_parameter( t_enter );
+    int i = (int)floorf( ( p.x() - x0 ) / dx );
+    int j = (int)floorf( ( p.z() - z0 ) / dz );
+    i = ( i < 0 ) ? 0 : ( i >= nx ) ? nx - 1 : i;
+    j = ( j < 0 ) ? 0 : ( j >= nz ) ? nz - 1 : j;
+
+    // x (z) boundaries of the current cell are never crossed with a zero direction on x (z)
+    int step_i = r.sign( 0 ) ? -1 : 1;
+    int step_j = r.sign( 2 ) ? -1 : 1;
+    float t_delta_x = ( d.x() != 0.0f ) ? dx * fabsf( inv_dir.x() ) : FLT_MAX;
+    float t_delta_z = ( d.z() != 0.0f ) ? dz * fabsf( inv_dir.z() ) : FLT_MAX;
+    float t_next_x = ( d.x() != 0.0f ) ? x_exit( r, i, i + 1 ) : FLT_MAX;
+    float t_next_z = ( d.z() != 0.0f ) ? z_exit( r, j, j + 1 ) : FLT_MAX;
+
+    triangle_ray tr( r );
+    float t_cell_enter = t_enter;
+    int block = -1;
+    for (;;)
+    {
+        // on entering a block: skip it whole when the ray stays above it
+        int bi = i / HEIGHTFIELD_BLOCK, bj = j / HEIGHTFIELD_BLOCK;
+        if ( bj * nbx + bi != block )
+        {
+            block = bj * nbx + bi;
+            int i0 = bi * HEIGHTFIELD_BLOCK, i1 = ( i0 + HEIGHTFIELD_BLOCK < nx ) ? i0 + HEIGHTFIELD_BLOCK : nx;
+            int j0 = bj * HEIGHTFIELD_BLOCK, j1 = ( j0 + HEIGHTFIELD_BLOCK < nz ) ? j0 + HEIGHTFIELD_BLOCK : nz;
+            float t_block_x = ( d.x() != 0.0f ) ? x_exit( r, i0, i1 ) : FLT_MAX;
+            float t_block_z = ( d.z() != 0.0f ) ? z_exit( r, j0, j1 ) : FLT_MAX;
+            float t_block_exit = ffmin( ffmin( t_block_x, t_block_z ), t_exit );
+            float y_low = o.y() + d.y() * ( ( d.y() < 0.0f ) ? t_block_exit : t_cell_enter );
+            if ( y_low > block_max[block] )
+            {
+                if ( t_block_exit >= t_exit )
+                {
+                    return false;
+                }
+                // first cell of the next block, the other index from the exit point
+                vec3 q = r.point_at_parameter( t_block_exit );
+                if ( t_block_x < t_block_z )
+                {
+                    i = ( step_i > 0 ) ? i1 : i0 - 1;
+                    j = (int)floorf( ( q.z() - z0 ) / dz );
+                    j = ( j < j0 ) ? j0 : ( j >= j1 ) ? j1 - 1 : j;
+                }
+                else
+                {
+                    j = ( step_j > 0 ) ? j1 : j0 - 1;
+                    i = (int)floorf( ( q.x() - x0 ) / dx );
+                    i = ( i < i0 ) ? i0 : ( i >= i1 ) ? i1 - 1 : i;
+                }
+                if ( i < 0 || i >= nx || j < 0 || j >= nz )
+                {
+                    return false;
+                }
+                t_next_x = ( d.x() != 0.0f ) ? x_exit( r, i, i + 1 ) : FLT_MAX;
+                t_next_z = ( d.z() != 0.0f ) ? z_exit( r, j, j + 1 ) : FLT_MAX;
+                t_cell_enter = t_block_exit;
+                continue;
+            }
+        }
+
+        float t_cell_exit = ffmin( ffmin( t_next_x, t_next_z ), t_exit );
+
+        // lowest point of the ray over the cell above the cell: nothing to hit
+        float y_low = o.y() + d.y() * ( ( d.y() < 0.0f ) ? t_cell_exit : t_cell_enter );
+        if ( y_low <= cell_max( i, j ) && hit_cell( r, tr, i, j, t_min, t_max, rec ) )
+        {
+            return true;
+        }
+
+        if ( t_cell_exit >= t_exit )
+        {
+            return false;
+        }
+        t_cell_enter = t_cell_exit;
+        if ( t_next_x < t_next_z )
+        {
+            i += step_i;
+            t_next_x += t_delta_x;
+            if ( i < 0 || i >= nx ) { return false; }
+        }
+        else
+        {
+            j += step_j;
+            t_next_z += t_delta_z;
+            if ( j < 0 || j >= nz ) { return false; }
+        }
+    }
+}
+
+bool heightfield::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    return traverse( r, t_min, t_max, rec );
+}
+
+bool heightfield::occluded( const ray &r, float t_min, float t_max ) const
+{
+    hit_record rec;
+    return traverse( r, t_min, t_max, rec );
+}
+
+#endif // _RAYTRACER_HEIGHTFIELD_H_
@@ -12,17 +12,83 @@
      material *mat_ptr;
  };
  
+ // no RTTI in this build, passes over the scene graph (like flattening
+ // a bvh) use this to recognize the few structs they know about.
+ enum hitable_kind
+ {
+     HITABLE_OTHER,
+     HITABLE_LIST,
+     HITABLE_BVH_NODE,
+     HITABLE_SPHERE,
+     HITABLE_MOVING_SPHERE,
+     HITABLE_LINEAR_BVH,
+     HITABLE_FLIP_NORMALS,
+     HITABLE_TRANSLATE,
+     HITABLE_ROTATE_Y,
+     HITABLE_INSTANCE,
+     HITABLE_MOTION_TRANSFORM,
+     HITABLE_BOX,
+     HITABLE_XY_RECT,
+     HITABLE_XZ_RECT,
+     HITABLE_YZ_RECT,
+     HITABLE_TRIANGLE,
+     HITABLE_SPHERE_CLOUD,
+     HITABLE_HEIGHTFIELD,
+     HITABLE_INFINITE_PLANE,
+     HITABLE_SDF,
+     HITABLE_SCENE_ROOT,
+ };
+ 
  struct hitable
  {
+     virtual ~hitable() {}
      virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const = 0;
      virtual bool bounding_box( float t0, float t1, aabb &box ) const = 0;
      virtual float pdf_value( const vec3 &o, const vec3 &v ) const { return 0.0f; }
      virtual vec3 random( const vec3 &o ) const { return vec3(1,0,0); }
+     virtual int kind() const { return HITABLE_OTHER; }
+     // any hit in ]t_min, t_max[, no surface data. Shadow and light sampling
+     // rays only need a yes or no, so cheaper overrides stop at the first hit.
+     virtual bool occluded( const ray &r, float t_min, float t_max ) const
+     {
+         hit_record rec;
+         return hit( r, t_min, t_max, rec );
+     }
+     // closest hits of rays[ids[0..n[] (a packet), each in ]t_min, closest[k][.
+     // Like hit() ray by ray: hits[k] is set, closest[k] and recs[k] updated
+     // for the rays that hit. Primitives tracing several rays at once override it.
+     virtual void hit_rays( const ray *rays, const int *ids, int n, float t_min,
+                            float *closest, hit_record *recs, bool *hits ) const
+     {
+         hit_record rec;
+         for ( int j = 0; j < n; ++j )
+         {
+             int k = ids[j];
+             if ( hit( rays[k], t_min, closest[k], rec ) )
+             {
+                 closest[k] = rec.t;
+                 recs[k] = rec;
+                 hits[k] = true;
+             }
+         }
+     }
+     // boxes at t0 and t1, the motion in between being linear. 
+     // Anything that does not know better is static over the swept box.
+     virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const
+     {
+         if ( !bounding_box( t0, t1, box0 ) )
+         {
+             return false;
+         }
+         box1 = box0;
+         return true;
+     }
  };
  
  struct flip_normals : public hitable
  {
      flip_normals(hitable *h) : ptr(h) {}
+     virtual int kind() const override { return HITABLE_FLIP_NORMALS; }
      
      virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override
      {
@@ -42,6 +108,16 @@
          return ptr->bounding_box(t0, t1, box);
      }
      
+     virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override
+     {
+         return ptr->motion_bounding_box(t0, t1, box0, box1);
+     }
+     
+     virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+     {
+         return ptr->occluded(r, t_min, t_max);
+     }
+     
      hitable *ptr;
  };
  
@@ -7,9 +7,12 @@
      hitable_list() {}
      hitable_list( hitable **l, int n) : list(l), list_size(n) {}
      virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec) const override;
+     virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
      virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+     virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override;
      virtual float pdf_value( const vec3 &o, const vec3 &v ) const override;
      virtual vec3 random( const vec3 &o ) const override;
+     virtual int kind() const override { return HITABLE_LIST; }
      
      hitable ** list;
      int list_size;
@@ -33,6 +36,18 @@
      return hit_anything;
  }
  
+ bool hitable_list::occluded( const ray &r, float t_min, float t_max ) const
+ {
+     for ( int i = 0; i < list_size; ++i )
+     {
+         if ( list[i]->occluded( r, t_min, t_max ) )
+         {
+             return true;
+         }
+     }
+     return false;
+ }
+ 
  bool hitable_list::bounding_box( float t0, float t1, aabb &box ) const
  {
      if (list_size < 1) return false;
@@ -64,6 +79,27 @@
      return true;
  }
  
+ bool hitable_list::motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const
+ {
+     if ( list_size < 1 || !list[0]->motion_bounding_box( t0, t1, box0, box1 ) )
+     {
+         return false;
+     }
+     
+     for( int i = 1; i < list_size; ++i )
+     {
+         aabb temp_box0, temp_box1;
+         if ( !list[i]->motion_bounding_box( t0, t1, temp_box0, temp_box1 ) )
+         {
+             return false;
+         }
+         box0 = surrounding_box( box0, temp_box0 );
+         box1 = surrounding_box( box1, temp_box1 );
+     }
+     
+     return true;
+ }
+ 
  float hitable_list::pdf_value( const vec3 &o, const vec3 &v ) const
  {
      float weight = 1.0f / list_size;
@@ -0,0 +1,87 @@
+#ifndef _RAYTRACER_INSTANCE_H_
+#define _RAYTRACER_INSTANCE_H_
+
+// Two level instancing: a bottom level (BLAS) is built once per unique
+// geometry, instances (transforms.h) point to it with their own transform,
+// and a top level (tlas) is a bvh over the instances boxes. Memory only
+// grows with the unique geometry, and moving instances only rebuilds the
+// top level.
+
+// a shared bottom level: the bvh_node tree of the geometry, flattened.
+hitable *make_blas( hitable **l, int n, float time0, float time1 )
+{
+    return new linear_bvh( new bvh_node( l, n, time0, time1 ), time0, time1 );
+}
+
+struct tlas : public hitable
+{
+    tlas( instance **l, int n, float t0, float t1 )
+        : instances(l, l + n), time0(t0), time1(t1)
+    {
+        rebuild();
+    }
+
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override
+    {
+        return accel && accel->hit( r, t_min, t_max, rec );
+    }
+
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+    {
+        return accel && accel->occluded( r, t_min, t_max );
+    }
+
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override
+    {
+        return accel && accel->bounding_box( t0, t1, box );
+    }
+
+    virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override
+    {
+        if ( !accel )
+        {
+            return false;
+        }
+        box0 = root->box_t0;
+        box1 = root->box_t1;
+        return true;
+    }
+
+    // moves an instance, call rebuild() once all of them are moved.
+    void set_transform( int i, const mat34 &object_to_world )
+    {
+        instances[i]->set_transform( object_to_world );
+    }
+
+    void rebuild();
+
+    std::vector<instance*> instances;
+    bvh_node *root = nullptr;
+    linear_bvh *accel = nullptr;
+    float time0 = 0.0f;
+    float time1 = 1.0f;
+};
+
+// only the top level, the bottom levels are untouched.
+void tlas::rebuild()
+{
+    if ( root )
+    {
+        free_bvh_tree( root );
+        delete accel;
+        root = nullptr;
+        accel = nullptr;
+    }
+
+    if ( instances.empty() )
+    {
+        return;
+    }
+
+    // bvh_node reorders the list it gets
+    std::vector<hitable*> list( instances.begin(), instances.end() );
+    root = new bvh_node( &list[0], (int)list.size(), time0, time1 );
+    accel = new linear_bvh( root, time0, time1 );
+}
+
+#endif // _RAYTRACER_INSTANCE_H_
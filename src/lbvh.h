@@ -0,0 +1,458 @@
+#ifndef _RAYTRACER_LBVH_H_
+#define _RAYTRACER_LBVH_H_
+
+// Linear bvh builder (Lauterbach et al. 2009, HLBVH flavour of pbrt):
+// centroids are quantized to a 2^k grid and sorted along a Morton curve,
+// the hierarchy falls out of the sorted codes, one level per code bit
+// where the range changes value. Much faster than SAH, somewhat worse trees.
+// Produces bvh_nodes, so everything built from bvh_node works unchanged.
+
+struct morton_primitive
+{
+    uint64_t code;
+    int index;
+};
+
+// spreads the low 10 (resp. 21) bits of x so that there are 2 zeros between each
+inline uint32_t left_shift_3( uint32_t x )
+{
+    x &= 0x3ff;
+    x = ( x | ( x << 16 ) ) & 0x030000ff;
+    x = ( x | ( x <<  8 ) ) & 0x0300f00f;
+    x = ( x | ( x <<  4 ) ) & 0x030c30c3;
+    x = ( x | ( x <<  2 ) ) & 0x09249249;
+    return x;
+}
+
+inline uint64_t left_shift_3( uint64_t x )
+{
+    x &= 0x1fffff;
+    x = ( x | ( x << 32 ) ) & 0x001f00000000ffffull;
+    x = ( x | ( x << 16 ) ) & 0x001f0000ff0000ffull;
+    x = ( x | ( x <<  8 ) ) & 0x100f00f00f00f00full;
+    x = ( x | ( x <<  4 ) ) & 0x10c30c30c30c30c3ull;
+    x = ( x | ( x <<  2 ) ) & 0x1249249249249249ull;
+    return x;
+}
+
+// x goes to bits 3i+2, y to 3i+1, z to 3i.
+inline uint64_t encode_morton_3( uint32_t x, uint32_t y, uint32_t z, int morton_bits )
+{
+    if ( morton_bits <= 30 )
+    {
+        return ( left_shift_3( x ) << 2 ) | ( left_shift_3( y ) << 1 ) | left_shift_3( z );
+    }
+    return ( left_shift_3( (uint64_t)x ) << 2 ) | ( left_shift_3( (uint64_t)y ) << 1 ) | left_shift_3( (uint64_t)z );
+}
+
+// split axis of a node cut on a given code bit
+inline int morton_bit_axis( int bit )
+{
+    return 2 - ( bit % 3 );
+}
+
+// LSD radix sort, 8 bits per pass. With a pool, each pass builds one
+// histogram per chunk and the chunks scatter their items in parallel
+// at their own offsets, which keeps the sort stable.
+void radix_sort( morton_primitive *items, int n, int nb_key_bits, thread_pool *pool )
+{
+    const int bits_per_pass = 8;
+    const int nb_buckets = 1 << bits_per_pass;
+    int nb_passes = ( nb_key_bits + bits_per_pass - 1 ) / bits_per_pass;
+    int nb_chunks = pool ? 4 * pool->num_threads : 1;
+
+    morton_primitive *temp = new morton_primitive[n];
+    int *histograms = new int[nb_chunks * nb_buckets];
+
+    morton_primitive *in = items;
+    morton_primitive *out = temp;
+    for ( int pass = 0; pass < nb_passes; ++pass )
+    {
+        int shift = pass * bits_per_pass;
+
+        auto count = [&]( int chunk, int begin, int end )
+        {
+            int *h = histograms + chunk * nb_buckets;
+            for ( int b = 0; b < nb_buckets; ++b )
+            {
+                h[b] = 0;
+            }
+            for ( int i = begin; i < end; ++i )
+            {
+                h[ ( in[i].code >> shift ) & ( nb_buckets - 1 ) ]++;
+            }
+        };
+
+        auto scatter = [&]( int chunk, int begin, int end )
+        {
+            int *h = histograms + chunk * nb_buckets;
+            for ( int i = begin; i < end; ++i )
+            {
+                out[ h[ ( in[i].code >> shift ) & ( nb_buckets - 1 ) ]++ ] = in[i];
+            }
+        };
+
+        if ( pool )
+        {
+            parallel_for( pool, n, nb_chunks, count );
+        }
+        else
+        {
+            count( 0, 0, n );
+        }
+
+        // bucket major, chunk minor: histograms become start offsets
+        int offset = 0;
+        for ( int b = 0; b < nb_buckets; ++b )
+        {
+            for ( int c = 0; c < nb_chunks; ++c )
+            {
+                int nb = histograms[ c * nb_buckets + b ];
+                histograms[ c * nb_buckets + b ] = offset;
+                offset += nb;
+            }
+        }
+
+        if ( pool )
+        {
+            parallel_for( pool, n, nb_chunks, scatter );
+        }
+        else
+        {
+            scatter( 0, 0, n );
+        }
+
+        std::swap( in, out );
+    }
+
+    if ( in != items )
+    {
+        for ( int i = 0; i < n; ++i )
+        {
+            items[i] = in[i];
+        }
+    }
+
+    delete [] histograms;
+    delete [] temp;
+}
+
+struct lbvh_emit_task : public task
+{
+    virtual void run() override
+    {
+        node->emit_lbvh( prims, codes, n, bit, *params, pending, depth );
+        pending->done();
+    }
+
+    bvh_node *node;
+    bvh_build_primitive *prims;
+    const uint64_t *codes;
+    int n;
+    int bit;
+    const bvh_build_params *params;
+    task_counter *pending;
+    int depth;
+};
+
+// Clustered or multi-scale inputs can take one level per code bit (63)
+// and more for duplicate codes: past this depth the ranges are split in
+// half, 2^31 primitives take at most 31 more levels, under BVH_MAX_DEPTH.
+const int LBVH_MEDIAN_DEPTH = BVH_MAX_DEPTH - 31;
+
+// prims and codes are sorted. Bits above 'bit' are the same for the whole range.
+// depth: of this node in the final tree.
+void bvh_node::emit_lbvh( bvh_build_primitive *prims, const uint64_t *codes, int n, int bit,
+                         const bvh_build_params &params, task_counter *pending, int depth )
+{
+    // skip the bits where the whole range is on the same side
+    while ( bit >= 0 && n > params.max_leaf_size )
+    {
+        uint64_t mask = 1ull << bit;
+        if ( ( codes[0] & mask ) != ( codes[n-1] & mask ) )
+        {
+            break;
+        }
+        --bit;
+    }
+
+    if ( n <= 2 || n <= params.max_leaf_size )
+    {
+        if ( n == 1 )
+        {
+            left = right = prims[0].ptr;
+        }
+        else
+        {
+            left  = make_bvh_leaf( prims,         n / 2 );
+            right = make_bvh_leaf( prims + n / 2, n - n / 2 );
+        }
+        axis = bit >= 0 ? morton_bit_axis( bit ) : 0;
+        return;
+    }
+
+    int mid;
+    if ( bit < 0 || depth >= LBVH_MEDIAN_DEPTH )
+    {
+        // all codes are equal (no spatial information left) or too deep:
+        // split the list, still in curve order.
+        mid = n / 2;
+        axis = bit >= 0 ? morton_bit_axis( bit ) : 0;
+    }
+    else
+    {
+        // first code with the bit set
+        uint64_t mask = 1ull << bit;
+        int lo = 0;
+        int hi = n - 1;
+        while ( lo + 1 != hi )
+        {
+            int m = ( lo + hi ) / 2;
+            if ( codes[m] & mask )
+            {
+                hi = m;
+            }
+            else
+            {
+                lo = m;
+            }
+        }
+        mid = hi;
+        axis = morton_bit_axis( bit );
+    }
+
+    bvh_node *left_node  = new bvh_node();
+    bvh_node *right_node = new bvh_node();
+    left = left_node;
+    right = right_node;
+
+    int right_n = n - mid;
+    thread_pool *pool = pending ? params.pool : nullptr;
+    if ( pool && right_n >= params.task_min_size )
+    {
+        lbvh_emit_task *t = new lbvh_emit_task();
+        t->node = right_node;
+        t->prims = prims + mid;
+        t->codes = codes + mid;
+        t->n = right_n;
+        t->bit = bit - 1;
+        t->params = &params;
+        t->pending = pending;
+        t->depth = depth + 1;
+        pending->add();
+        pool->addTask( t );
+    }
+    else
+    {
+        right_node->emit_lbvh( prims + mid, codes + mid, right_n, bit - 1, params, pending, depth + 1 );
+    }
+
+    left_node->emit_lbvh( prims, codes, mid, bit - 1, params, pending, depth + 1 );
+}
+
+// node boxes are only known once all the (possibly parallel) emission is done.
+aabb bvh_node::update_bounds( float time0, float time1 )
+{
+    aabb box_left, box_right;
+    if ( left->kind() == HITABLE_BVH_NODE )
+    {
+        box_left = ((bvh_node*)left)->update_bounds( time0, time1 );
+    }
+    else
+    {
+        left->bounding_box( time0, time1, box_left );
+    }
+
+    if ( right == left )
+    {
+        box_right = box_left;
+    }
+    else if ( right->kind() == HITABLE_BVH_NODE )
+    {
+        box_right = ((bvh_node*)right)->update_bounds( time0, time1 );
+    }
+    else
+    {
+        right->bounding_box( time0, time1, box_right );
+    }
+
+    box = surrounding_box( box_left, box_right );
+    return box;
+}
+
+// frees the nodes of a top tree built over roots (sorted), not the roots.
+internal void free_top_nodes( bvh_node *top, const std::vector<hitable*> &roots )
+{
+    hitable *children[2] = { top->left, top->right };
+    for ( int c = 0; c < ( top->right != top->left ? 2 : 1 ); ++c )
+    {
+        if ( children[c]->kind() == HITABLE_BVH_NODE && 
+             !std::binary_search( roots.begin(), roots.end(), children[c] ) )
+        {
+            free_top_nodes( (bvh_node*)children[c], roots );
+            delete children[c];
+        }
+    }
+}
+
+// prims (bounds and centroids already computed) are reordered along the curve.
+void bvh_node::build_lbvh( bvh_build_primitive *prims, int n, float time0, float time1,
+                          const bvh_build_params &params )
+{
+    thread_pool *pool = params.pool;
+    int nb_chunks = pool ? 4 * pool->num_threads : 1;
+    int morton_bits = params.morton_bits > 30 ? 63 : 30;
+    int bits_per_axis = morton_bits / 3;
+    float grid_size = (float)( 1 << bits_per_axis );
+
+    aabb centroid_box = empty_box();
+    for ( int i = 0; i < n; ++i )
+    {
+        centroid_box = surrounding_box( centroid_box, aabb( prims[i].centroid, prims[i].centroid ) );
+    }
+
+    // 1) quantize the centroids and compute their codes
+    morton_primitive *items = new morton_primitive[n];
+    vec3 cmin = centroid_box.min();
+    vec3 extent = centroid_box.max() - centroid_box.min();
+    auto encode = [&]( int chunk, int begin, int end )
+    {
+        for ( int i = begin; i < end; ++i )
+        {
+            uint32_t q[3];
+            for ( int a = 0; a < 3; ++a )
+            {
+                float f = extent[a] > 0.0f ? ( prims[i].centroid[a] - cmin[a] ) / extent[a] : 0.0f;
+                float g = f * grid_size;
+                q[a] = g >= grid_size - 1.0f ? (uint32_t)grid_size - 1 : (uint32_t)g;
+            }
+            items[i].code = encode_morton_3( q[0], q[1], q[2], morton_bits );
+            items[i].index = i;
+        }
+    };
+
+    if ( pool && n >= params.data_parallel_min_size )
+    {
+        parallel_for( pool, n, nb_chunks, encode );
+    }
+    else
+    {
+        encode( 0, 0, n );
+    }
+
+    // 2) sort them
+    radix_sort( items, n, morton_bits, ( n >= params.data_parallel_min_size ) ? pool : nullptr );
+
+    bvh_build_primitive *sorted = new bvh_build_primitive[n];
+    uint64_t *codes = new uint64_t[n];
+    for ( int i = 0; i < n; ++i )
+    {
+        sorted[i] = prims[ items[i].index ];
+        codes[i] = items[i].code;
+    }
+    for ( int i = 0; i < n; ++i )
+    {
+        prims[i] = sorted[i];
+    }
+    delete [] sorted;
+    delete [] items;
+
+    // 3) emit the hierarchy
+    int treelet_bits = params.lbvh_treelet_bits;
+    if ( treelet_bits <= 0 || treelet_bits >= morton_bits )
+    {
+        if ( pool )
+        {
+            task_counter pending;
+            emit_lbvh( prims, codes, n, morton_bits - 1, params, &pending, 0 );
+            pending.wait();
+        }
+        else
+        {
+            emit_lbvh( prims, codes, n, morton_bits - 1, params, nullptr, 0 );
+        }
+        update_bounds( time0, time1 );
+        delete [] codes;
+        return;
+    }
+
+    // treelets: runs of primitives sharing the top treelet_bits bits are emitted
+    // from the codes, then a SAH build over the treelets makes the top levels.
+    // Treelets start at the depth of a balanced top, the one built when the
+    // SAH top ends up too deep.
+    int low_bits = morton_bits - treelet_bits;
+    int top_depth = ( treelet_bits < 31 ) ? treelet_bits : 31;
+    std::vector<bvh_build_primitive> treelets;
+    task_counter pending;
+    int start = 0;
+    while ( start < n )
+    {
+        int end = start + 1;
+        while ( end < n && ( codes[end] >> low_bits ) == ( codes[start] >> low_bits ) )
+        {
+            ++end;
+        }
+
+        bvh_build_primitive t;
+        t.ptr = prims[start].ptr;
+        if ( end - start > 1 )
+        {
+            bvh_node *root = new bvh_node();
+            root->emit_lbvh( prims + start, codes + start, end - start, low_bits - 1,
+                            params, pool ? &pending : nullptr, top_depth );
+            t.ptr = root;
+        }
+        treelets.push_back( t );
+        start = end;
+    }
+    pending.wait();
+
+    for ( size_t i = 0; i < treelets.size(); ++i )
+    {
+        bvh_build_primitive &t = treelets[i];
+        if ( t.ptr->kind() == HITABLE_BVH_NODE )
+        {
+            t.box = ((bvh_node*)t.ptr)->update_bounds( time0, time1 );
+        }
+        else
+        {
+            t.ptr->bounding_box( time0, time1, t.box );
+        }
+        t.centroid = 0.5f * ( t.box.min() + t.box.max() );
+    }
+
+    if ( treelets.size() == 1 && treelets[0].ptr->kind() == HITABLE_BVH_NODE )
+    {
+        // its children are kept, only the node itself is copied
+        bvh_node *single = (bvh_node*)treelets[0].ptr;
+        *this = *single;
+        delete single;
+    }
+    else
+    {
+        // one treelet per leaf, lists would hide their nodes from the flattening.
+        bvh_build_params top_params = params;
+        top_params.max_leaf_size = 1;
+        top_params.pool = nullptr;
+        std::vector<bvh_build_primitive> curve_order = treelets;
+        build_sah( &treelets[0], (int)treelets.size(), top_params, false, nullptr );
+        if ( bvh_depth( this ) > BVH_MAX_DEPTH )
+        {
+            // balanced: equal codes split the treelets in halves
+            std::vector<hitable*> roots( curve_order.size() );
+            for ( size_t i = 0; i < curve_order.size(); ++i )
+            {
+                roots[i] = curve_order[i].ptr;
+            }
+            std::sort( roots.begin(), roots.end() );
+            free_top_nodes( this, roots );
+            std::vector<uint64_t> no_codes( curve_order.size(), 0 );
+            emit_lbvh( &curve_order[0], no_codes.data(), (int)curve_order.size(), -1, top_params, nullptr, 0 );
+        }
+        update_bounds( time0, time1 );
+    }
+
+    delete [] codes;
+}
+
+#endif // _RAYTRACER_LBVH_H_
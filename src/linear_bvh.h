@@ -0,0 +1,824 @@
+#ifndef _RAYTRACER_LINEAR_BVH_H_
+#define _RAYTRACER_LINEAR_BVH_H_
+
+// The whole bvh in one contiguous array, in depth first order:
+// the first child of an inner node is always the next node in the array,
+// so only the second child index has to be stored.
+struct linear_bvh_node
+{
+    vec3 bmin;
+    uint32_t offset;   // leaf: first primitive, inner node: second child
+    vec3 bmax;
+    uint16_t nb_prims; // 0 for inner nodes
+    uint8_t axis;      // inner nodes: split axis, leaves: number of leading spheres
+    uint8_t flags;     // leaves: number of triangles after the spheres in the upper bits
+};
+
+enum linear_bvh_node_flags
+{
+    LINEAR_BVH_MOVING = 1, // box interpolated with the ray time, see linear_bvh_motion
+};
+
+const int LINEAR_BVH_TRIANGLES_SHIFT = 1;
+const int LINEAR_BVH_MAX_LEAF_TRIANGLES = 127;
+const uint32_t LINEAR_BVH_MAX_LEAF_PRIMS = UINT16_MAX;
+
+static_assert( sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes" );
+
+// Spheres of the leaves, stored at their index in prims and intersected
+// without virtual calls. A static sphere is a moving one that doesn't move:
+// center(t) = center + ( t - time0 ) * inv_duration * delta.
+struct linear_bvh_spheres
+{
+    std::vector<float> cx, cy, cz;
+    std::vector<float> dx, dy, dz;
+    std::vector<float> radius;
+    std::vector<float> time0;
+    std::vector<float> inv_duration;
+    std::vector<material*> mat;
+};
+
+// Triangles of the leaves, at their index in prims too, as the 9 vertex
+// coordinate arrays of the group tests (see mesh.h): a leaf tests its
+// triangles TRIANGLE_GROUP_SIZE at a time.
+struct linear_bvh_triangles
+{
+    std::vector<float> data;
+    const float *verts[9] = {};
+};
+
+// box at shutter close of moving nodes (their own box is then the one at shutter
+// open), in a separate array so that static scenes don't pay for it.
+struct linear_bvh_motion
+{
+    vec3 bmin;
+    vec3 bmax;
+};
+
+struct linear_bvh : public hitable
+{
+    linear_bvh() {}
+    // converts an already built tree, bvh_node children are flattened,
+    // anything else (lists included) ends up in the primitive array.
+    linear_bvh( const bvh_node *root, float time0, float time1 );
+    // static nodes built elsewhere (a mapped mesh file), used in place, as
+    // the triangle arrays when given (else they are copied from p).
+    linear_bvh( const linear_bvh_node *n, uint32_t nb, std::vector<hitable*> &&p,
+                const float *const *triangle_verts = nullptr );
+
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    virtual int kind() const override { return HITABLE_LINEAR_BVH; }
+
+    bool hit_ordered( const ray &r, float s,
+                     float t_min, float t_max, hit_record &rec ) const;
+    uint32_t flatten( const bvh_node *node );
+    uint32_t add_leaf( hitable *h );
+    void add_leaf_primitives( hitable *h );
+    void set_leaf( uint32_t index, uint32_t first, uint32_t end,
+                  const aabb &box0, const aabb &box1, bool moving );
+    uint32_t add_leaf_range( uint32_t first, uint32_t end );
+    uint8_t sort_leaf( uint32_t first, uint32_t end, uint8_t &flags );
+    void build_spheres();
+    void build_triangles();
+    inline bool hit_leaf( const linear_bvh_node &node, const ray &r, float t_min, 
+                         float &closest_so_far, hit_record &rec ) const;
+    inline bool hit_leaf_soa( const linear_bvh_node &node, const ray &r, float t_min, 
+                             float &closest_so_far, hit_record &rec ) const;
+    inline void hit_leaf_rays( const linear_bvh_node &node, const ray *rays, const int *ids, int n, 
+                              float t_min, float *closest, hit_record *recs, bool *hits ) const;
+    inline bool occluded_leaf( const linear_bvh_node &node, const ray &r, float t_min, float t_max ) const;
+    void set_node_box( uint32_t index, const aabb &box0, const aabb &box1, bool moving );
+    inline bool node_hit( uint32_t index, float s, const ray &r,
+                         float t_min, float t_max, float &t_entry ) const;
+
+    std::vector<linear_bvh_node> nodes;
+    const linear_bvh_node *node_array = nullptr; // nodes.data(), or external nodes
+    uint32_t nb_nodes = 0;
+    std::vector<linear_bvh_motion> motion; // empty when nothing moves
+    std::vector<hitable*> prims;
+    linear_bvh_spheres spheres;
+    linear_bvh_triangles triangles;
+    bool has_motion = false;
+    float time0 = 0.0f;
+    float time1 = 1.0f;
+};
+
+linear_bvh::linear_bvh( const bvh_node *root, float t0, float t1 ) : time0(t0), time1(t1)
+{
+    flatten( root );
+    node_array = nodes.data();
+    nb_nodes = (uint32_t)nodes.size();
+    build_spheres();
+    build_triangles();
+}
+
+linear_bvh::linear_bvh( const linear_bvh_node *n, uint32_t nb, std::vector<hitable*> &&p,
+                        const float *const *triangle_verts )
+    : node_array(n), nb_nodes(nb), prims(std::move(p))
+{
+    build_spheres();
+    if ( triangle_verts )
+    {
+        for ( int i = 0; i < 9; ++i )
+        {
+            triangles.verts[i] = triangle_verts[i];
+        }
+        return;
+    }
+    build_triangles();
+}
+
+// static nodes get the swept box.
+void linear_bvh::set_node_box( uint32_t index, const aabb &box0, const aabb &box1, bool moving )
+{
+    linear_bvh_node &n = nodes[index];
+    if ( !moving )
+    {
+        aabb swept = surrounding_box( box0, box1 );
+        n.bmin = swept.min();
+        n.bmax = swept.max();
+        return;
+    }
+
+    if ( motion.size() < nodes.size() )
+    {
+        motion.resize( nodes.size() );
+    }
+    n.bmin = box0.min();
+    n.bmax = box0.max();
+    n.flags |= LINEAR_BVH_MOVING;
+    motion[index].bmin = box1.min();
+    motion[index].bmax = box1.max();
+    has_motion = true;
+}
+
+// flipped spheres are left to their own hit.
+inline bool is_sphere( const hitable *h )
+{
+    return ( h->kind() == HITABLE_SPHERE && !( (const sphere*)h )->flip ) || 
+           h->kind() == HITABLE_MOVING_SPHERE;
+}
+
+inline bool is_triangle( const hitable *h )
+{
+    return h->kind() == HITABLE_TRIANGLE;
+}
+
+// spheres go first in the leaf, returns how many (at most 255), then the
+// triangles, their count goes in the flags.
+uint8_t linear_bvh::sort_leaf( uint32_t first, uint32_t last, uint8_t &flags )
+{
+    hitable **begin = prims.data() + first;
+    hitable **end = prims.data() + last;
+    size_t nb = std::stable_partition( begin, end, is_sphere ) - begin;
+    nb = ( nb > 255 ) ? 255 : nb;
+    size_t nb_triangles = std::stable_partition( begin + nb, end, is_triangle ) - ( begin + nb );
+    nb_triangles = ( nb_triangles > LINEAR_BVH_MAX_LEAF_TRIANGLES ) ? LINEAR_BVH_MAX_LEAF_TRIANGLES : nb_triangles;
+    flags = (uint8_t)( nb_triangles << LINEAR_BVH_TRIANGLES_SHIFT );
+    return (uint8_t)nb;
+}
+
+void linear_bvh::build_triangles()
+{
+    if ( std::none_of( prims.begin(), prims.end(), is_triangle ) )
+    {
+        return;
+    }
+
+    // padded for the group loads past the last triangle
+    size_t stride = prims.size() + TRIANGLE_GROUP_SIZE;
+    triangles.data.assign( 9 * stride, 0.0f );
+    for ( int i = 0; i < 9; ++i )
+    {
+        triangles.verts[i] = triangles.data.data() + i * stride;
+    }
+
+    for ( size_t i = 0; i < prims.size(); ++i )
+    {
+        if ( !is_triangle( prims[i] ) )
+        {
+            continue;
+        }
+        const triangle *t = (const triangle*)prims[i];
+        for ( int k = 0; k < 3; ++k )
+        {
+            vec3 p = t->vertex( k );
+            for ( int a = 0; a < 3; ++a )
+            {
+                triangles.data[( 3 * k + a ) * stride + i] = p[a];
+            }
+        }
+    }
+}
+
+void linear_bvh::build_spheres()
+{
+    // no sphere data at all for sphere-less trees (meshes)
+    if ( std::none_of( prims.begin(), prims.end(), is_sphere ) )
+    {
+        return;
+    }
+
+    size_t n = prims.size();
+    spheres.cx.resize( n ); spheres.cy.resize( n ); spheres.cz.resize( n );
+    spheres.dx.resize( n ); spheres.dy.resize( n ); spheres.dz.resize( n );
+    spheres.radius.resize( n );
+    spheres.time0.resize( n );
+    spheres.inv_duration.resize( n );
+    spheres.mat.resize( n );
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+        vec3 center, delta;
+        float radius = 0.0f, t0 = 0.0f, inv_duration = 0.0f;
+        material *mat = nullptr;
+        if ( prims[i]->kind() == HITABLE_SPHERE )
+        {
+            sphere *s = (sphere*)prims[i];
+            center = s->center;
+            delta = vec3( 0.0f, 0.0f, 0.0f );
+            radius = s->radius;
+            mat = s->mat;
+        }
+        else if ( prims[i]->kind() == HITABLE_MOVING_SPHERE )
+        {
+            moving_sphere *s = (moving_sphere*)prims[i];
+            center = s->center0;
+            delta = s->center1 - s->center0;
+            radius = s->radius;
+            t0 = s->time0;
+            inv_duration = 1.0f / ( s->time1 - s->time0 );
+            mat = s->mat_ptr;
+        }
+        else
+        {
+            continue;
+        }
+
+        spheres.cx[i] = center.x(); spheres.cy[i] = center.y(); spheres.cz[i] = center.z();
+        spheres.dx[i] = delta.x(); spheres.dy[i] = delta.y(); spheres.dz[i] = delta.z();
+        spheres.radius[i] = radius;
+        spheres.time0[i] = t0;
+        spheres.inv_duration[i] = inv_duration;
+        spheres.mat[i] = mat;
+    }
+}
+
+// Leading spheres first: the closest one only gets its surface data
+// once the loop is done. Then the other primitives, through hitable.
+inline bool linear_bvh::hit_leaf( const linear_bvh_node &node, const ray &r, float t_min, 
+                                 float &closest_so_far, hit_record &rec ) const
+{
+    bool hit_anything = hit_leaf_soa( node, r, t_min, closest_so_far, rec );
+    uint32_t end_triangles = node.offset + node.axis + ( node.flags >> LINEAR_BVH_TRIANGLES_SHIFT );
+    uint32_t end = node.offset + node.nb_prims;
+    hit_record temp_rec;
+    for ( uint32_t i = end_triangles; i < end; ++i )
+    {
+        if ( prims[i]->hit( r, t_min, closest_so_far, temp_rec ) )
+        {
+            hit_anything = true;
+            closest_so_far = temp_rec.t;
+            rec = temp_rec;
+        }
+    }
+    return hit_anything;
+}
+
+// Several rays through the same leaf (a packet): the spheres and triangles
+// ray by ray, the other primitives get all the rays at once.
+inline void linear_bvh::hit_leaf_rays( const linear_bvh_node &node, const ray *rays, const int *ids, int n, 
+                                      float t_min, float *closest, hit_record *recs, bool *hits ) const
+{
+    for ( int j = 0; j < n; ++j )
+    {
+        int k = ids[j];
+        hits[k] |= hit_leaf_soa( node, rays[k], t_min, closest[k], recs[k] );
+    }
+    uint32_t end_triangles = node.offset + node.axis + ( node.flags >> LINEAR_BVH_TRIANGLES_SHIFT );
+    uint32_t end = node.offset + node.nb_prims;
+    for ( uint32_t i = end_triangles; i < end; ++i )
+    {
+        prims[i]->hit_rays( rays, ids, n, t_min, closest, recs, hits );
+    }
+}
+
+// the leading spheres and triangles of a leaf, from their SoA arrays.
+inline bool linear_bvh::hit_leaf_soa( const linear_bvh_node &node, const ray &r, float t_min, 
+                                     float &closest_so_far, hit_record &rec ) const
+{
+    bool hit_anything = false;
+    uint32_t first = node.offset;
+    uint32_t end_spheres = first + node.axis;
+    uint32_t end_triangles = end_spheres + ( node.flags >> LINEAR_BVH_TRIANGLES_SHIFT );
+
+    if ( first < end_spheres )
+    {
+        vec3 o = r.origin();
+        vec3 d = r.direction();
+        float a = dot( d, d );
+        int best = -1;
+        for ( uint32_t i = first; i < end_spheres; ++i )
+        {
+            float s = ( r.time() - spheres.time0[i] ) * spheres.inv_duration[i];
+            float ocx = o.x() - ( spheres.cx[i] + s * spheres.dx[i] );
+            float ocy = o.y() - ( spheres.cy[i] + s * spheres.dy[i] );
+            float ocz = o.z() - ( spheres.cz[i] + s * spheres.dz[i] );
+            float b = ocx * d.x() + ocy * d.y() + ocz * d.z();
+            float c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radius[i] * spheres.radius[i];
+            float discriminant = b*b - a*c;
+            if ( discriminant > 0.0f )
+            {
+                float sq = sqrtf( discriminant );
+                float t = ( -b - sq ) / a;
+                if ( !( t < closest_so_far && t > t_min ) )
+                {
+                    t = ( -b + sq ) / a;
+                }
+                if ( t < closest_so_far && t > t_min )
+                {
+                    closest_so_far = t;
+                    best = (int)i;
+                }
+            }
+        }
+
+        if ( best >= 0 )
+        {
+            float s = ( r.time() - spheres.time0[best] ) * spheres.inv_duration[best];
+            vec3 center( spheres.cx[best] + s * spheres.dx[best], 
+                         spheres.cy[best] + s * spheres.dy[best], 
+                         spheres.cz[best] + s * spheres.dz[best] );
+            rec.t = closest_so_far;
+            rec.p = r.point_at_parameter( rec.t );
+            rec.normal = ( rec.p - center ) / spheres.radius[best];
+            get_sphere_uv( rec.normal, rec.u, rec.v );
+            rec.mat_ptr = spheres.mat[best];
+            hit_anything = true;
+        }
+    }
+
+    // then the triangles, same for the closest one
+    if ( end_spheres < end_triangles )
+    {
+        triangle_ray tr( r );
+        int best = -1;
+        float best_b0 = 0.0f, best_b1 = 0.0f, best_b2 = 0.0f;
+        for ( uint32_t i = end_spheres; i < end_triangles; i += TRIANGLE_GROUP_SIZE )
+        {
+            float t[TRIANGLE_GROUP_SIZE], b0[TRIANGLE_GROUP_SIZE], b1[TRIANGLE_GROUP_SIZE], b2[TRIANGLE_GROUP_SIZE];
+            int mask = intersect_triangle_group<TRIANGLE_GROUP_SIZE>( tr, triangles.verts, i, t_min, closest_so_far, t, b0, b1, b2 );
+            uint32_t nb_lanes = end_triangles - i;
+            if ( nb_lanes < TRIANGLE_GROUP_SIZE )
+            {
+                mask &= ( 1 << nb_lanes ) - 1;
+            }
+            // lowest lane first on ties, like a loop over the triangles
+            for ( int lane = 0; mask; ++lane, mask >>= 1 )
+            {
+                if ( ( mask & 1 ) && t[lane] < closest_so_far )
+                {
+                    closest_so_far = t[lane];
+                    best = (int)i + lane;
+                    best_b0 = b0[lane];
+                    best_b1 = b1[lane];
+                    best_b2 = b2[lane];
+                }
+            }
+        }
+
+        if ( best >= 0 )
+        {
+            ( (const triangle*)prims[best] )->set_hit_record( r, closest_so_far, best_b0, best_b1, best_b2, rec );
+            hit_anything = true;
+        }
+    }
+    return hit_anything;
+}
+
+inline bool linear_bvh::occluded_leaf( const linear_bvh_node &node, const ray &r, float t_min, float t_max ) const
+{
+    uint32_t first = node.offset;
+    uint32_t end_spheres = first + node.axis;
+    uint32_t end_triangles = end_spheres + ( node.flags >> LINEAR_BVH_TRIANGLES_SHIFT );
+    uint32_t end = first + node.nb_prims;
+
+    vec3 o = r.origin();
+    vec3 d = r.direction();
+    float a = dot( d, d );
+    for ( uint32_t i = first; i < end_spheres; ++i )
+    {
+        float s = ( r.time() - spheres.time0[i] ) * spheres.inv_duration[i];
+        float ocx = o.x() - ( spheres.cx[i] + s * spheres.dx[i] );
+        float ocy = o.y() - ( spheres.cy[i] + s * spheres.dy[i] );
+        float ocz = o.z() - ( spheres.cz[i] + s * spheres.dz[i] );
+        float b = ocx * d.x() + ocy * d.y() + ocz * d.z();
+        float c = ocx * ocx + ocy * ocy + ocz * ocz - spheres.radius[i] * spheres.radius[i];
+        float discriminant = b*b - a*c;
+        if ( discriminant > 0.0f )
+        {
+            float sq = sqrtf( discriminant );
+            float t0 = ( -b - sq ) / a;
+            float t1 = ( -b + sq ) / a;
+            if ( ( t0 < t_max && t0 > t_min ) || ( t1 < t_max && t1 > t_min ) )
+            {
+                return true;
+            }
+        }
+    }
+
+    if ( end_spheres < end_triangles )
+    {
+        triangle_ray tr( r );
+        for ( uint32_t i = end_spheres; i < end_triangles; i += TRIANGLE_GROUP_SIZE )
+        {
+            float t[TRIANGLE_GROUP_SIZE], b0[TRIANGLE_GROUP_SIZE], b1[TRIANGLE_GROUP_SIZE], b2[TRIANGLE_GROUP_SIZE];
+            int mask = intersect_triangle_group<TRIANGLE_GROUP_SIZE>( tr, triangles.verts, i, t_min, t_max, t, b0, b1, b2 );
+            uint32_t nb_lanes = end_triangles - i;
+            if ( nb_lanes < TRIANGLE_GROUP_SIZE )
+            {
+                mask &= ( 1 << nb_lanes ) - 1;
+            }
+            if ( mask )
+            {
+                return true;
+            }
+        }
+    }
+
+    for ( uint32_t i = end_triangles; i < end; ++i )
+    {
+        if ( prims[i]->occluded( r, t_min, t_max ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void linear_bvh::add_leaf_primitives( hitable *h )
+{
+    if ( h->kind() == HITABLE_LIST )
+    {
+        hitable_list *list = (hitable_list*)h;
+        for ( int i = 0; i < list->list_size; ++i )
+        {
+            prims.push_back( list->list[i] );
+        }
+    }
+    else
+    {
+        prims.push_back( h );
+    }
+}
+
+uint32_t linear_bvh::flatten( const bvh_node *node )
+{
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back( linear_bvh_node() );
+
+    bool left_is_node = ( node->left->kind() == HITABLE_BVH_NODE );
+    bool right_is_node = ( node->right->kind() == HITABLE_BVH_NODE );
+
+    if ( !left_is_node && !right_is_node )
+    {
+        // both children are primitives: a single leaf (n==1 nodes
+        // point twice to the same primitive, keep only one).
+        uint32_t first = (uint32_t)prims.size();
+        add_leaf_primitives( node->left );
+        if ( node->right != node->left )
+        {
+            add_leaf_primitives( node->right );
+        }
+
+        set_leaf( index, first, (uint32_t)prims.size(), node->box_t0, node->box_t1, node->moving );
+        return index;
+    }
+
+    // left child is written right after this node
+    if ( left_is_node )
+    {
+        flatten( (bvh_node*)node->left );
+    }
+    else
+    {
+        add_leaf( node->left );
+    }
+
+    uint32_t second = right_is_node ? 
+        flatten( (bvh_node*)node->right ) : 
+        add_leaf( node->right );
+
+    linear_bvh_node &n = nodes[index];
+    n.offset = second;
+    n.nb_prims = 0;
+    n.axis = (uint8_t)node->axis;
+    n.flags = 0;
+    set_node_box( index, node->box_t0, node->box_t1, node->moving );
+    return index;
+}
+
+// t_entry is the distance where the ray enters the box (clamped to t_min).
+// Branchless and NaN robust, like aabb::hit.
+inline bool slab_test( const vec3 &bmin, const vec3 &bmax, const ray &r,
+                      float t_min, float t_max, float &t_entry )
+{
+    const vec3 &inv_dir = r.inv_direction();
+    for ( int a = 0; a < 3; ++a )
+    {
+        float near_plane = r.sign( a ) ? bmax[a] : bmin[a];
+        float far_plane = r.sign( a ) ? bmin[a] : bmax[a];
+        float t0 = ( near_plane - r._origin[a] ) * inv_dir[a];
+        float t1 = ( far_plane - r._origin[a] ) * inv_dir[a] * SLAB_FAR_SCALE;
+
+        t_min = t0 > t_min ? t0 : t_min;
+        t_max = t1 < t_max ? t1 : t_max;
+    }
+
+    t_entry = t_min;
+    return t_min < t_max;
+}
+
+// s: ray time, 0 at shutter open and 1 at shutter close.
+inline bool linear_bvh::node_hit( uint32_t index, float s, const ray &r,
+                                 float t_min, float t_max, float &t_entry ) const
+{
+    const linear_bvh_node &node = node_array[index];
+    if ( !( node.flags & LINEAR_BVH_MOVING ) )
+    {
+        return slab_test( node.bmin, node.bmax, r, t_min, t_max, t_entry );
+    }
+    const linear_bvh_motion &m = motion[index];
+    return slab_test( node.bmin + s * ( m.bmin - node.bmin ), node.bmax + s * ( m.bmax - node.bmax ),
+                      r, t_min, t_max, t_entry );
+}
+
+uint32_t linear_bvh::add_leaf( hitable *h )
+{
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back( linear_bvh_node() );
+
+    aabb leaf_box0, leaf_box1;
+    h->motion_bounding_box( time0, time1, leaf_box0, leaf_box1 );
+    uint32_t first = (uint32_t)prims.size();
+    add_leaf_primitives( h );
+    set_leaf( index, first, (uint32_t)prims.size(), leaf_box0, leaf_box1,
+              worth_interpolating( leaf_box0, leaf_box1, g_bvh_build_params ) );
+    return index;
+}
+
+// prims [first, end) as the leaf at index. More primitives than nb_prims can
+// count (a large list expanded in a leaf) become a balanced subtree of leaves.
+void linear_bvh::set_leaf( uint32_t index, uint32_t first, uint32_t end,
+                           const aabb &box0, const aabb &box1, bool moving )
+{
+    if ( end - first <= LINEAR_BVH_MAX_LEAF_PRIMS )
+    {
+        linear_bvh_node &n = nodes[index];
+        n.offset = first;
+        n.nb_prims = (uint16_t)( end - first );
+        n.axis = sort_leaf( first, end, n.flags );
+        set_node_box( index, box0, box1, moving );
+        return;
+    }
+
+    uint32_t middle = first + ( end - first ) / 2;
+    add_leaf_range( first, middle );
+    uint32_t second = add_leaf_range( middle, end );
+
+    linear_bvh_node &n = nodes[index];
+    n.offset = second;
+    n.nb_prims = 0;
+    n.axis = 0;
+    n.flags = 0;
+    set_node_box( index, box0, box1, moving );
+}
+
+uint32_t linear_bvh::add_leaf_range( uint32_t first, uint32_t end )
+{
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back( linear_bvh_node() );
+
+    aabb box0, box1;
+    prims[first]->motion_bounding_box( time0, time1, box0, box1 );
+    for ( uint32_t i = first + 1; i < end; ++i )
+    {
+        aabb prim_box0, prim_box1;
+        prims[i]->motion_bounding_box( time0, time1, prim_box0, prim_box1 );
+        box0 = surrounding_box( box0, prim_box0 );
+        box1 = surrounding_box( box1, prim_box1 );
+    }
+    set_leaf( index, first, end, box0, box1, worth_interpolating( box0, box1, g_bvh_build_params ) );
+    return index;
+}
+
+bool linear_bvh::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    if ( nb_nodes == 0 )
+    {
+        return false;
+    }
+
+    float s = ( time1 > time0 ) ? ( r.time() - time0 ) / ( time1 - time0 ) : 0.0f;
+
+    if ( g_bvh_traversal == BVH_TRAVERSAL_ORDERED )
+    {
+        return hit_ordered( r, s, t_min, t_max, rec );
+    }
+
+    const int max_stack_size = 64;
+    uint32_t stack[max_stack_size];
+    int stack_size = 0;
+    uint32_t index = 0;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+
+    float t_entry;
+
+    for (;;)
+    {
+        const linear_bvh_node &node = node_array[index];
+        if ( node_hit( index, s, r, t_min, closest_so_far, t_entry ) )
+        {
+            ++tl_stats.nb_node_visits;
+            if ( node.nb_prims > 0 )
+            {
+                hit_anything |= hit_leaf( node, r, t_min, closest_so_far, rec );
+            }
+            else
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size++] = node.offset;
+                index = index + 1;
+                continue;
+            }
+        }
+
+        if ( stack_size == 0 )
+        {
+            break;
+        }
+        index = stack[--stack_size];
+    }
+
+    return hit_anything;
+}
+
+// Children boxes are tested from their parent: the near one (ray direction
+// sign on the split axis) is visited first, the far one is pushed with its
+// entry distance and dropped when it is popped behind the closest hit.
+bool linear_bvh::hit_ordered( const ray &r, float s,
+                             float t_min, float t_max, hit_record &rec ) const
+{
+    float t_entry;
+    if ( !node_hit( 0, s, r, t_min, t_max, t_entry ) )
+    {
+        return false;
+    }
+
+    struct stack_entry
+    {
+        uint32_t index;
+        float t_entry;
+    };
+
+    const int max_stack_size = 64;
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    uint32_t index = 0;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+
+    for (;;)
+    {
+        const linear_bvh_node &node = node_array[index];
+        ++tl_stats.nb_node_visits;
+
+        if ( node.nb_prims > 0 )
+        {
+            hit_anything |= hit_leaf( node, r, t_min, closest_so_far, rec );
+        }
+        else
+        {
+            uint32_t near_index = index + 1;
+            uint32_t far_index = node.offset;
+            if ( r.sign( node.axis ) )
+            {
+                std::swap( near_index, far_index );
+            }
+
+            float t_near, t_far;
+            bool hit_near = node_hit( near_index, s, r, t_min, closest_so_far, t_near );
+            bool hit_far = node_hit( far_index, s, r, t_min, closest_so_far, t_far );
+
+            if ( hit_near && hit_far )
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size].index = far_index;
+                stack[stack_size].t_entry = t_far;
+                ++stack_size;
+                index = near_index;
+                continue;
+            }
+            else if ( hit_near )
+            {
+                index = near_index;
+                continue;
+            }
+            else if ( hit_far )
+            {
+                index = far_index;
+                continue;
+            }
+        }
+
+        // pop the next subtree still in front of the closest hit
+        bool found = false;
+        while ( stack_size > 0 )
+        {
+            stack_entry &e = stack[--stack_size];
+            if ( e.t_entry < closest_so_far )
+            {
+                index = e.index;
+                found = true;
+                break;
+            }
+            ++tl_stats.nb_culled_nodes;
+        }
+
+        if ( !found )
+        {
+            break;
+        }
+    }
+
+    return hit_anything;
+}
+
+// any hit: same stack walk as the unordered closest hit, but it
+// returns at the first primitive hit and never touches a hit_record.
+bool linear_bvh::occluded( const ray &r, float t_min, float t_max ) const
+{
+    if ( nb_nodes == 0 )
+    {
+        return false;
+    }
+
+    float s = ( time1 > time0 ) ? ( r.time() - time0 ) / ( time1 - time0 ) : 0.0f;
+
+    const int max_stack_size = 64;
+    uint32_t stack[max_stack_size];
+    int stack_size = 0;
+    uint32_t index = 0;
+    float t_entry;
+
+    for (;;)
+    {
+        const linear_bvh_node &node = node_array[index];
+        if ( node_hit( index, s, r, t_min, t_max, t_entry ) )
+        {
+            ++tl_stats.nb_node_visits;
+            if ( node.nb_prims > 0 )
+            {
+                if ( occluded_leaf( node, r, t_min, t_max ) )
+                {
+                    return true;
+                }
+            }
+            else
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size++] = node.offset;
+                index = index + 1;
+                continue;
+            }
+        }
+
+        if ( stack_size == 0 )
+        {
+            return false;
+        }
+        index = stack[--stack_size];
+    }
+}
+
+bool linear_bvh::bounding_box( float t0, float t1, aabb &box ) const
+{
+    if ( nb_nodes == 0 )
+    {
+        return false;
+    }
+
+    box = aabb( node_array[0].bmin, node_array[0].bmax );
+    if ( node_array[0].flags & LINEAR_BVH_MOVING )
+    {
+        box = surrounding_box( box, aabb( motion[0].bmin, motion[0].bmax ) );
+    }
+    return true;
+}
+
+#endif // _RAYTRACER_LINEAR_BVH_H_
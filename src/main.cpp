@@ -11,7 +11,7 @@
          "tw"            "Tile width"                      "1"
          "th"            "Tile height"                     "1"
          "windowed"      "Show a preview window"           "0"       "1"
-         "i,input"       "Input filename"
+         "i,input"       "Input filename (mesh scene: .obj or .rtm)"
          "o,output"      "Output filename"                 "out.png"
          "p,passes"      "Output passes as separate files" "0"       "1"
          "m,multi"       "Output one file for each sample" "0"       "1"
@@ -19,6 +19,23 @@
          "ry"            "ROI start y (from top)"          "0"
          "rw"            "ROI width"                       "1"
          "rh"            "ROI height"                      "1"
+         "scene"         "Scene (cornell, motion, book1, book2, spheres, cloud, terrain, sdf, forest, mesh)" "cornell"
+         "scene-size"    "Number of objects in generated scenes" "100000"
+         "compile"       "Flatten the scene graph before the BVH build" "1"
+         "bvh"           "BVH builder (median, sah, lbvh)" "sah"
+         "bvh-bins"      "Number of SAH bins"              "16"
+         "bvh-leaf"      "Max primitives per SAH leaf"     "4"
+         "bvh-trav-cost" "SAH cost of a node, relative to a primitive" "1"
+         "bvh-task-size" "Min primitives per parallel BVH build task" "4096"
+         "morton-bits"   "LBVH morton code bits (30, 63)"  "30"
+         "lbvh-treelet-bits" "LBVH top bits rebuilt with SAH" "0"
+         "motion-growth" "Swept/interpolated area ratio for time-interpolated BVH boxes" "1.25"
+         "accel"         "Traversal structure (tree, linear, qbvh4, qbvh8, cbvh4, cbvh8)" "linear"
+         "traversal"     "BVH traversal (ordered, unordered)" "ordered"
+         "packets"       "Trace primary rays as 4x4 packets (linear accel)" "1"
+         "integrator"    "Path tracer (recursive, wavefront)" "recursive"
+         "bench"         "Benchmark the acceleration structures" "0"   "1000000"
+         "bench-triangles" "Benchmark the triangle kernels (rays)" "0" "100000"
          "x,exit"        "Exit without rendering"          "0"       "1"
          "v,verbose"     "Prints text"                     "0"       "1"
          "extra-verbose" "Prints extra text"               "0"       "1"
@@ -38,8 +55,24 @@
 #include <mutex>
 #include <queue>
 #include <condition_variable>
+#include <vector>
+#include <algorithm>
 #include <assert.h>
 #include <utility> // std::swap in c++11
+#include <stdint.h>
+#include <string.h>
+
+// mapped mesh files
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <windows.h>
+#else
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "../ext/stb_image.h"
@@ -63,35 +96,54 @@ global std::default_random_engine generator;
 global std::uniform_real_distribution<float> distribution(0.0f,1.0f);
 #define RAN01() distribution(generator)
 
+#include "stats.h"
+#include "simd.h"
 #include "vec3.h"
 #include "perlin.h"
 #include "ray.h"
 #include "aabb.h"
+#include "mat34.h"
 #include "utils.h"
 #include "camera.h"
+#include "thread_pool.h"
 #include "hitable.h"
 #include "hitable_list.h"
 #include "pdf.h"
 #include "transforms.h"
+#include "sphere.h"
+#include "mesh.h"
 #include "bvh.h"
+#include "lbvh.h"
+#include "linear_bvh.h"
+#include "wide_bvh.h"
+#include "compressed_bvh.h"
+#include "instance.h"
+#include "packet.h"
+#include "sphere_cloud.h"
 #include "texture.h"
 #include "material.h"
 #include "volume.h"
-#include "sphere.h"
 #include "plane.h"
 #include "box.h"
-#include "thread_pool.h"
+#include "heightfield.h"
+#include "sdf.h"
+#include "mesh_file.h"
+#include "compile.h"
 #include "scenes.h"
+#include "bench.h"
+#include "wavefront.h"
 
 // pgcd(1920,1080) = 120
 // 120 = 2*2*2*3*5
 // pgcd(1280,720) = 80
 // 80 = 2*2*2*2*5
 
-vec3 color( const ray &r, hitable *world, hitable *important_hitables, int max_depth, int depth )
+vec3 color( const ray &r, hitable *world, hitable *important_hitables, int max_depth, int depth );
+
+// radiance along r once its closest hit is known (hrec is set when hit).
+vec3 shade( const ray &r, bool hit, hit_record &hrec, hitable *world, hitable *important_hitables, int max_depth, int depth )
 {
-    hit_record hrec = {};
-    if ( world->hit( r, 0.001f, FLT_MAX, hrec ) )
+    if ( hit )
     {
         scatter_record srec = {};
         vec3 emitted = hrec.mat_ptr->emitted( r, hrec, hrec.u, hrec.v, hrec.p );
@@ -126,6 +178,49 @@ vec3 color( const ray &r, hitable *world, hitable *important_hitables, int max_d
     }
 }
 
+vec3 color( const ray &r, hitable *world, hitable *important_hitables, int max_depth, int depth )
+{
+    hit_record hrec = {};
+    ++tl_stats.nb_rays;
+    bool hit = world->hit( r, 0.001f, r.t_max, hrec );
+    return shade( r, hit, hrec, world, important_hitables, max_depth, depth );
+}
+
+// one sample of every pixel of a block, primary rays traced as a packet.
+// world is a linear_bvh, or a scene_root over one.
+void color_packet( camera *cam, hitable *world, hitable *important_hitables, int max_depth,
+                  int x0, int y0, int w, int h, int image_width, int image_height, vec3 *col )
+{
+    ray_packet p;
+    for ( int j = 0; j < h; ++j )
+    {
+        for ( int i = 0; i < w; ++i )
+        {
+            float u = float( x0 + i + RAN01() ) / float( image_width );
+            float v = float( y0 + j + RAN01() ) / float( image_height );
+            p.rays[p.nb_rays++] = cam->get_ray( u, v );
+        }
+    }
+    init_packet_bounds( p );
+    
+    hit_record recs[MAX_PACKET_SIZE] = {};
+    bool hits[MAX_PACKET_SIZE];
+    const scene_root *root = ( world->kind() == HITABLE_SCENE_ROOT ) ? (scene_root*)world : nullptr;
+    hit_packet( *(linear_bvh*)( root ? root->tree : world ), p, 0.001f, recs, hits );
+    if ( root )
+    {
+        for ( int k = 0; k < p.nb_rays; ++k )
+        {
+            hits[k] = root->hit_unbounded( p.rays[k], 0.001f, hits[k] ? recs[k].t : p.rays[k].t_max, recs[k] ) || hits[k];
+        }
+    }
+    for ( int k = 0; k < p.nb_rays; ++k )
+    {
+        ++tl_stats.nb_rays;
+        col[k] += de_nan( shade( p.rays[k], hits[k], recs[k], world, important_hitables, max_depth, 0 ) );
+    }
+}
+
 global std::mutex g_console_mutex;
 global int g_total_nb_tiles = 0;
 global int g_nb_tiles_finished = 0;
@@ -150,6 +245,7 @@ struct compute_tile_task : public task
     
     virtual void run() override
     {
+        reset_thread_stats();
         for( int j = tile_height-1; j >= 0; --j )
         {
             int y_in_texture_space = tile_origin_y + j;
@@ -184,6 +280,7 @@ struct compute_tile_task : public task
                 *line_buffer_ptr++ = ( 0xff000000 | (ib << 16) | (ig << 8) | (ir << 0) );
             }
         }
+        merge_thread_stats();
     }
     
     int tile_origin_x = 0;
@@ -216,6 +313,22 @@ struct compute_one_sample_task : public task
     
     virtual void run() override
     {
+        reset_thread_stats();
+        if ( wavefront )
+        {
+            run_wavefront();
+            merge_thread_stats();
+            return;
+        }
+        
+        hitable *tree = ( world->kind() == HITABLE_SCENE_ROOT ) ? ( (scene_root*)world )->tree : world;
+        if ( packets && tree && tree->kind() == HITABLE_LINEAR_BVH )
+        {
+            run_packets();
+            merge_thread_stats();
+            return;
+        }
+        
         for( int j = image_height-1; j >= 0; --j )
         {
             float *line_buffer_ptr = 
@@ -242,12 +355,80 @@ struct compute_one_sample_task : public task
                 *line_buffer_ptr++ = col.r();
             }
         }
+        merge_thread_stats();
+    }
+    
+    // same image, PACKET_WIDTH x PACKET_WIDTH pixels blocks at a time.
+    void run_packets()
+    {
+        for ( int y0 = 0; y0 < image_height; y0 += PACKET_WIDTH )
+        {
+            for ( int x0 = 0; x0 < image_width; x0 += PACKET_WIDTH )
+            {
+                int w = std::min( PACKET_WIDTH, image_width - x0 );
+                int h = std::min( PACKET_WIDTH, image_height - y0 );
+                vec3 col[MAX_PACKET_SIZE];
+                for ( int k = 0; k < w * h; ++k )
+                {
+                    col[k] = vec3( 0, 0, 0 );
+                }
+                
+                for ( int s = 0; s < sub_samples; ++s )
+                {
+                    color_packet( cam, world, important_hitables, max_depth,
+                                 x0, y0, w, h, image_width, image_height, col );
+                }
+                
+                for ( int j = 0; j < h; ++j )
+                {
+                    float *pixel_ptr = 
+                        shared_buffer + 
+                        ( image_height - 1 - ( y0 + j ) ) * 4 * image_width + 4 * x0;
+                    for ( int i = 0; i < w; ++i )
+                    {
+                        vec3 c = col[j * w + i] / (float)sub_samples;
+                        
+                        // ABGR
+                        *pixel_ptr++ = 1.0f;
+                        *pixel_ptr++ = c.b();
+                        *pixel_ptr++ = c.g();
+                        *pixel_ptr++ = c.r();
+                    }
+                }
+            }
+        }
+    }
+    
+    void run_wavefront()
+    {
+        std::vector<vec3> col( image_width * image_height, vec3( 0, 0, 0 ) );
+        wavefront_integrator integrator( world, important_hitables, cam, max_depth );
+        integrator.render( image_width, image_height, sub_samples, col.data() );
+        
+        for ( int j = 0; j < image_height; ++j )
+        {
+            float *line_buffer_ptr = 
+                shared_buffer + 
+                ( image_height - 1 - j ) * 4 * image_width;
+            for ( int i = 0; i < image_width; ++i )
+            {
+                vec3 c = col[j * image_width + i] / (float)sub_samples;
+                
+                // ABGR
+                *line_buffer_ptr++ = 1.0f;
+                *line_buffer_ptr++ = c.b();
+                *line_buffer_ptr++ = c.g();
+                *line_buffer_ptr++ = c.r();
+            }
+        }
     }
     
     int image_width = 1;
     int image_height = 1;
     int sub_samples = 1;
     int sample_id = 0;
+    int packets = 0;
+    int wavefront = 0;
     int max_depth;
     float *shared_buffer;
     hitable *world;
@@ -359,7 +540,7 @@ int main( int argc, char **argv )
         ( "tw",            "Tile width", cxxopts::value<int>()->default_value( "1" ) )
         ( "th",            "Tile height", cxxopts::value<int>()->default_value( "1" ) )
         ( "windowed",      "Show a preview window", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
-        ( "i,input",       "Input filename", cxxopts::value<std::string>() )
+        ( "i,input",       "Input filename (mesh scene: .obj or .rtm)", cxxopts::value<std::string>() )
         ( "o,output",      "Output filename", cxxopts::value<std::string>()->default_value( "out.png" ) )
         ( "p,passes",      "Output passes as separate files", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
         ( "m,multi",       "Output one file for each sample", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
@@ -367,6 +548,23 @@ int main( int argc, char **argv )
         ( "ry",            "ROI start y (from top)", cxxopts::value<int>()->default_value( "0" ) )
         ( "rw",            "ROI width", cxxopts::value<int>()->default_value( "1" ) )
         ( "rh",            "ROI height", cxxopts::value<int>()->default_value( "1" ) )
+        ( "scene",         "Scene (cornell, motion, book1, book2, spheres, cloud, terrain, sdf, forest, mesh)", cxxopts::value<std::string>()->default_value( "cornell" ) )
+        ( "scene-size",    "Number of objects in generated scenes", cxxopts::value<int>()->default_value( "100000" ) )
+        ( "compile",       "Flatten the scene graph before the BVH build", cxxopts::value<int>()->default_value( "1" ) )
+        ( "bvh",           "BVH builder (median, sah, lbvh)", cxxopts::value<std::string>()->default_value( "sah" ) )
+        ( "bvh-bins",      "Number of SAH bins", cxxopts::value<int>()->default_value( "16" ) )
+        ( "bvh-leaf",      "Max primitives per SAH leaf", cxxopts::value<int>()->default_value( "4" ) )
+        ( "bvh-trav-cost", "SAH cost of a node, relative to a primitive", cxxopts::value<float>()->default_value( "1" ) )
+        ( "bvh-task-size", "Min primitives per parallel BVH build task", cxxopts::value<int>()->default_value( "4096" ) )
+        ( "morton-bits",   "LBVH morton code bits (30, 63)", cxxopts::value<int>()->default_value( "30" ) )
+        ( "lbvh-treelet-bits", "LBVH top bits rebuilt with SAH (0: off)", cxxopts::value<int>()->default_value( "0" ) )
+        ( "motion-growth", "Interpolate BVH boxes with the ray time above this swept/interpolated area ratio", cxxopts::value<float>()->default_value( "1.25" ) )
+        ( "accel",         "Traversal structure (tree, linear, qbvh4, qbvh8, cbvh4, cbvh8)", cxxopts::value<std::string>()->default_value( "linear" ) )
+        ( "traversal",     "BVH traversal (ordered, unordered)", cxxopts::value<std::string>()->default_value( "ordered" ) )
+        ( "packets",       "Trace primary rays as 4x4 packets (linear accel)", cxxopts::value<int>()->default_value( "1" ) )
+        ( "integrator",    "Path tracer (recursive, wavefront)", cxxopts::value<std::string>()->default_value( "recursive" ) )
+        ( "bench",         "Benchmark the acceleration structures (number of rays)", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1000000" ) )
+        ( "bench-triangles", "Benchmark the triangle kernels (number of rays)", cxxopts::value<int>()->default_value( "0" )->implicit_value( "100000" ) )
         ( "x,exit",        "Exit without rendering", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
         ( "v,verbose",     "Prints text", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
         ( "V,extra-verbose", "Prints extra text", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
@@ -391,6 +589,23 @@ int main( int argc, char **argv )
         int ry;
         int rw;
         int rh;
+        std::string scene;
+        int scene_size;
+        int compile;
+        std::string bvh;
+        int bvh_bins;
+        int bvh_leaf;
+        float bvh_trav_cost;
+        int bvh_task_size;
+        int morton_bits;
+        int lbvh_treelet_bits;
+        float motion_growth;
+        std::string accel;
+        std::string traversal;
+        int packets;
+        std::string integrator;
+        int bench;
+        int bench_triangles;
         int dontrender;
         int verbose;
         int extraverbose;
@@ -412,6 +627,23 @@ int main( int argc, char **argv )
     o.ry = options["ry"].as<int>();
     o.rw = options["rw"].as<int>();
     o.rh = options["rh"].as<int>();
+    o.scene = options["scene"].as<std::string>();
+    o.scene_size = options["scene-size"].as<int>();
+    o.compile = options["compile"].as<int>();
+    o.bvh = options["bvh"].as<std::string>();
+    o.bvh_bins = options["bvh-bins"].as<int>();
+    o.bvh_leaf = options["bvh-leaf"].as<int>();
+    o.bvh_trav_cost = options["bvh-trav-cost"].as<float>();
+    o.bvh_task_size = options["bvh-task-size"].as<int>();
+    o.morton_bits = options["morton-bits"].as<int>();
+    o.lbvh_treelet_bits = options["lbvh-treelet-bits"].as<int>();
+    o.motion_growth = options["motion-growth"].as<float>();
+    o.accel = options["accel"].as<std::string>();
+    o.traversal = options["traversal"].as<std::string>();
+    o.packets = options["packets"].as<int>();
+    o.integrator = options["integrator"].as<std::string>();
+    o.bench = options["bench"].as<int>();
+    o.bench_triangles = options["bench-triangles"].as<int>();
     o.dontrender = options["x"].as<int>();
     o.verbose = options["v"].as<int>();
     o.extraverbose = options["extra-verbose"].as<int>();
@@ -438,11 +670,31 @@ int main( int argc, char **argv )
         std::cout << "ROI y               : " << o.ry << "\n";
         std::cout << "ROI width           : " << o.rw << "\n";
         std::cout << "ROI height          : " << o.rh << "\n";
+        std::cout << "Scene               : " << o.scene << "\n";
+        std::cout << "Scene size          : " << o.scene_size << "\n";
+        std::cout << "BVH builder         : " << o.bvh << "\n";
+        std::cout << "BVH SAH bins        : " << o.bvh_bins << "\n";
+        std::cout << "BVH SAH leaf size   : " << o.bvh_leaf << "\n";
+        std::cout << "BVH traversal cost  : " << o.bvh_trav_cost << "\n";
+        std::cout << "BVH build task size : " << o.bvh_task_size << "\n";
+        std::cout << "LBVH morton bits    : " << o.morton_bits << "\n";
+        std::cout << "LBVH treelet bits   : " << o.lbvh_treelet_bits << "\n";
+        std::cout << "Motion growth       : " << o.motion_growth << "\n";
+        std::cout << "Acceleration        : " << o.accel << "\n";
+        std::cout << "BVH traversal       : " << o.traversal << "\n";
+        std::cout << "Benchmark rays      : " << o.bench << "\n";
+        std::cout << "Triangle bench rays : " << o.bench_triangles << "\n";
         std::cout << "Exit without render : " << o.dontrender << "\n";
         std::cout << "Verbose             : " << o.verbose << "\n";
         std::cout << "Extra verbose       : " << o.extraverbose << "\n";
     }
     
+    if ( o.bench_triangles > 0 )
+    {
+        bench_triangle_kernels( o.bench_triangles );
+        return 0;
+    }
+    
     unsigned int buffer_memory_in_bytes = 0;
     
     unsigned int *image_buffer = nullptr;
@@ -502,13 +754,210 @@ int main( int argc, char **argv )
     camera *cam = nullptr;
     hitable *world = nullptr;
     hitable *important_hitables = nullptr;
-    cornell_box( &world, &important_hitables, &cam, aspect );
+    
+    // before the scene, scenes can build their own bvh_nodes.
+    g_bvh_build_params.builder = 
+        ( o.bvh == "median" ) ? BVH_BUILDER_MEDIAN : 
+        ( o.bvh == "lbvh" )   ? BVH_BUILDER_LBVH : 
+        BVH_BUILDER_SAH;
+    g_bvh_build_params.nb_bins = o.bvh_bins;
+    g_bvh_build_params.max_leaf_size = o.bvh_leaf;
+    g_bvh_build_params.traversal_cost = o.bvh_trav_cost;
+    g_bvh_build_params.task_min_size = o.bvh_task_size;
+    g_bvh_build_params.morton_bits = o.morton_bits;
+    g_bvh_build_params.lbvh_treelet_bits = o.lbvh_treelet_bits;
+    g_bvh_build_params.motion_min_growth = o.motion_growth;
+    g_bvh_traversal = ( o.traversal == "unordered" ) ? BVH_TRAVERSAL_UNORDERED : BVH_TRAVERSAL_ORDERED;
+    
+    auto build_start = std::chrono::high_resolution_clock::now();
+    
+    // the build gets its own pool, gone before the render starts.
+    thread_pool *build_pool = nullptr;
+    if ( o.threads > 1 )
+    {
+        build_pool = new thread_pool( o.threads );
+        g_bvh_build_params.pool = build_pool;
+    }
+    
+    if ( o.scene == "book1" )
+    {
+        mega_big_scene_end_of_book1( &world, &important_hitables, &cam, aspect );
+    }
+    else if ( o.scene == "book2" )
+    {
+        mega_big_scene_end_of_book2( &world, &important_hitables, &cam, aspect );
+    }
+    else if ( o.scene == "spheres" )
+    {
+        many_spheres( &world, &important_hitables, &cam, aspect, o.scene_size );
+    }
+    else if ( o.scene == "motion" )
+    {
+        cornell_motion( &world, &important_hitables, &cam, aspect );
+    }
+    else if ( o.scene == "cloud" )
+    {
+        sphere_cloud_scene( &world, &important_hitables, &cam, aspect, o.scene_size );
+    }
+    else if ( o.scene == "terrain" )
+    {
+        terrain( &world, &important_hitables, &cam, aspect, o.scene_size );
+    }
+    else if ( o.scene == "sdf" )
+    {
+        sdf_scene( &world, &important_hitables, &cam, aspect );
+    }
+    else if ( o.scene == "forest" )
+    {
+        forest( &world, &important_hitables, &cam, aspect, o.scene_size );
+    }
+    else if ( o.scene == "mesh" )
+    {
+        if ( !mesh_scene( &world, &important_hitables, &cam, aspect, o.in_filename.c_str(), build_pool ) )
+        {
+            std::cout << "Cannot read \"" << o.in_filename << "\"\n";
+            return 1;
+        }
+    }
+    else
+    {
+        cornell_box( &world, &important_hitables, &cam, aspect );
+    }
     // TODO(nfauvet): build function should return a list of emitting shapes
     //hitable *light_shape = new xz_rect(213,343,227,332,554,0);
-    bvh_node *bvh_root = new bvh_node(
-        ((hitable_list*)world)->list,
-        ((hitable_list*)world)->list_size,
-        time0, time1 );
+    hitable **prims = ((hitable_list*)world)->list;
+    int nb_prims = ((hitable_list*)world)->list_size;
+    std::vector<hitable*> compiled_prims;
+    if ( o.compile )
+    {
+        int nb_folded = 0;
+        compiled_prims = compile_scene( world, &nb_folded );
+        prims = compiled_prims.data();
+        nb_prims = (int)compiled_prims.size();
+        if ( o.verbose )
+        {
+            std::cout << "Compiled scene      : " << nb_prims << " primitives, " 
+                << nb_folded << " wrappers folded\n";
+        }
+    }
+    
+    // infinite planes go next to the tree, not in it. No tree at all
+    // when nothing has bounds.
+    int nb_bounded = partition_unbounded( prims, nb_prims, time0, time1 );
+    bvh_node *bvh_root = ( nb_bounded > 0 ) ? new bvh_node( prims, nb_bounded, time0, time1 ) : nullptr;
+    
+    if ( build_pool )
+    {
+        g_bvh_build_params.pool = nullptr;
+        delete build_pool;
+    }
+    
+    if ( o.verbose && bvh_root )
+    {
+        std::cout << "BVH SAH cost        : " << bvh_root->sah_cost << "\n";
+    }
+    
+    hitable *accel_root = bvh_root;
+    if ( bvh_root )
+    {
+        if ( o.accel == "linear" )
+        {
+            linear_bvh *lbvh = new linear_bvh( bvh_root, time0, time1 );
+            accel_root = lbvh;
+            if ( o.verbose )
+            {
+                std::cout << "Linear BVH          : " << lbvh->nb_nodes << " nodes, " 
+                    << lbvh->prims.size() << " primitives, "
+                    << ( lbvh->nb_nodes * sizeof(linear_bvh_node) + 
+                        lbvh->motion.size() * sizeof(linear_bvh_motion) ) << " bytes\n";
+            }
+        }
+        else if ( o.accel == "qbvh4" )
+        {
+            qbvh *q = new qbvh( bvh_root, time0, time1 );
+            accel_root = q;
+            if ( o.verbose )
+            {
+                std::cout << "QBVH                : " << q->nodes.size() << " nodes, " 
+                    << ( q->nodes.size() * sizeof(wide_bvh_node<4>) ) << " bytes\n";
+            }
+        }
+        else if ( o.accel == "qbvh8" )
+        {
+            obvh *q = new obvh( bvh_root, time0, time1 );
+            accel_root = q;
+            if ( o.verbose )
+            {
+                std::cout << "OBVH                : " << q->nodes.size() << " nodes, " 
+                    << ( q->nodes.size() * sizeof(wide_bvh_node<8>) ) << " bytes\n";
+            }
+        }
+        else if ( o.accel == "cbvh4" || o.accel == "cbvh8" )
+        {
+            size_t nb_nodes = 0;
+            size_t nb_bytes = 0;
+            if ( o.accel == "cbvh4" )
+            {
+                cbvh4 *c = new cbvh4( bvh_root, time0, time1 );
+                accel_root = c;
+                nb_nodes = c->nodes.size();
+                nb_bytes = nb_nodes * sizeof(compressed_bvh_node<4>);
+            }
+            else
+            {
+                cbvh8 *c = new cbvh8( bvh_root, time0, time1 );
+                accel_root = c;
+                nb_nodes = c->nodes.size();
+                nb_bytes = nb_nodes * sizeof(compressed_bvh_node<8>);
+            }
+            if ( o.verbose )
+            {
+                std::cout << "Compressed BVH      : " << nb_nodes << " nodes, " 
+                    << nb_bytes << " bytes\n";
+            }
+        }
+    }
+    
+    // unbounded primitives next to the tree, or alone when nothing has bounds
+    if ( nb_bounded < nb_prims || !bvh_root )
+    {
+        accel_root = new scene_root( accel_root, prims + nb_bounded, nb_prims - nb_bounded );
+        if ( o.verbose )
+        {
+            std::cout << "Unbounded           : " << ( nb_prims - nb_bounded ) << " primitives next to the BVH\n";
+        }
+    }
+    
+    auto build_end = std::chrono::high_resolution_clock::now();
+    std::cout
+        << std::fixed << std::setprecision(2)
+        << "Build time: "
+        << std::chrono::duration<double, std::milli>(build_end-build_start).count()
+        << "ms\n";
+    
+    if ( o.bench > 0 )
+    {
+        if ( !bvh_root )
+        {
+            std::cout << "Nothing to benchmark, no primitive has bounds.\n";
+            return 1;
+        }
+        linear_bvh *binary = new linear_bvh( bvh_root, time0, time1 );
+        qbvh *q4 = new qbvh( bvh_root, time0, time1 );
+        obvh *q8 = new obvh( bvh_root, time0, time1 );
+        cbvh4 *c4 = new cbvh4( bvh_root, time0, time1 );
+        cbvh8 *c8 = new cbvh8( bvh_root, time0, time1 );
+        bench_entry entries[] = 
+        {
+            { "binary", binary, binary->nb_nodes * sizeof(linear_bvh_node) + binary->motion.size() * sizeof(linear_bvh_motion), binary->prims.size() },
+            { "qbvh4",  q4, q4->nodes.size() * sizeof(wide_bvh_node<4>) + q4->motion.size() * sizeof(wide_bvh_motion<4>), q4->prims.size() },
+            { "qbvh8",  q8, q8->nodes.size() * sizeof(wide_bvh_node<8>) + q8->motion.size() * sizeof(wide_bvh_motion<8>), q8->prims.size() },
+            { "cbvh4",  c4, c4->nodes.size() * sizeof(compressed_bvh_node<4>), c4->prims.size() },
+            { "cbvh8",  c8, c8->nodes.size() * sizeof(compressed_bvh_node<8>), c8->prims.size() },
+        };
+        bench_acceleration_structures( entries, sizeof(entries) / sizeof(entries[0]), cam, o.bench );
+        return 0;
+    }
     
     // percent compute
     int nb_pixels = o.nx * o.ny;
@@ -533,7 +982,7 @@ int main( int argc, char **argv )
     pre_pass_task->uv_buffer = uv_buffer;
     pre_pass_task->depth_min = &depth_min;
     pre_pass_task->depth_max = &depth_max;
-    pre_pass_task->world = (hitable*)bvh_root;
+    pre_pass_task->world = accel_root;
     pre_pass_task->important_hitables = important_hitables;
     pre_pass_task->cam = cam;
     
@@ -547,9 +996,11 @@ int main( int argc, char **argv )
         task->image_height = o.ny;
         task->sub_samples = o.nss;
         task->sample_id = i;
+        task->packets = o.packets;
+        task->wavefront = ( o.integrator == "wavefront" );
         task->max_depth = o.bounces;
         task->shared_buffer = full_image_buffer_float[i];
-        task->world = (hitable*)bvh_root;
+        task->world = accel_root;
         task->important_hitables = important_hitables;
         task->cam = cam;
         
@@ -743,13 +1194,23 @@ int main( int argc, char **argv )
     }
     
     auto time_end = std::chrono::high_resolution_clock::now();
+    double render_ms = std::chrono::duration<double, std::milli>(time_end-time_start).count();
     
     std::cout
         << std::fixed << std::setprecision(2)
-        << "Time: "
-        << std::chrono::duration<double, std::milli>(time_end-time_start).count()
+        << "Render time: "
+        << render_ms
         << "ms\n";
     
+    std::cout
+        << "Rays: " << g_stats.nb_rays
+        << " (" << ( g_stats.nb_rays / ( render_ms * 1000.0 ) ) << " Mrays/s)\n";
+    
+    std::cout
+        << "Node visits (" << o.scene << "): " << g_stats.nb_node_visits
+        << " (" << ( (double)g_stats.nb_node_visits / (double)g_stats.nb_rays ) << " per ray), "
+        << g_stats.nb_culled_nodes << " culled subtrees\n";
+    
     std::cout << "Writing file.\n";
     
     int res = stbi_write_png(
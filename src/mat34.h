@@ -0,0 +1,207 @@
+#ifndef _RAYTRACER_MAT34_H_
+#define _RAYTRACER_MAT34_H_
+
+// Affine transform, row major 3x4: the 3x3 linear part and a translation
+// in the last column. Points and vectors are columns: p' = M * (p, 1).
+struct mat34
+{
+    float m[3][4];
+};
+
+inline mat34 mat34_identity()
+{
+    mat34 r;
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 4; ++j )
+        {
+            r.m[i][j] = ( i == j ) ? 1.0f : 0.0f;
+        }
+    }
+    return r;
+}
+
+inline mat34 mat34_translation( const vec3 &t )
+{
+    mat34 r = mat34_identity();
+    r.m[0][3] = t.x();
+    r.m[1][3] = t.y();
+    r.m[2][3] = t.z();
+    return r;
+}
+
+inline mat34 mat34_scale( const vec3 &s )
+{
+    mat34 r = mat34_identity();
+    r.m[0][0] = s.x();
+    r.m[1][1] = s.y();
+    r.m[2][2] = s.z();
+    return r;
+}
+
+// each axis gets a part of the others: x' = x + xy * y + xz * z...
+inline mat34 mat34_shear( float xy, float xz, float yx, float yz, float zx, float zy )
+{
+    mat34 r = mat34_identity();
+    r.m[0][1] = xy; r.m[0][2] = xz;
+    r.m[1][0] = yx; r.m[1][2] = yz;
+    r.m[2][0] = zx; r.m[2][1] = zy;
+    return r;
+}
+
+// right handed, around a unit axis: mat34_rotation( vec3(0,1,0), a ) turns like rotate_y( h, a ).
+inline mat34 mat34_rotation( const vec3 &axis, float degrees )
+{
+    float radians = ( PI / 180.0f ) * degrees;
+    float c = cosf( radians );
+    float s = sinf( radians );
+    float t = 1.0f - c;
+    float x = axis.x(), y = axis.y(), z = axis.z();
+
+    mat34 r = mat34_identity();
+    r.m[0][0] = t*x*x + c;   r.m[0][1] = t*x*y - s*z; r.m[0][2] = t*x*z + s*y;
+    r.m[1][0] = t*x*y + s*z; r.m[1][1] = t*y*y + c;   r.m[1][2] = t*y*z - s*x;
+    r.m[2][0] = t*x*z - s*y; r.m[2][1] = t*y*z + s*x; r.m[2][2] = t*z*z + c;
+    return r;
+}
+
+// a * b applies b first.
+inline mat34 operator*( const mat34 &a, const mat34 &b )
+{
+    mat34 r;
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 4; ++j )
+        {
+            r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j];
+        }
+        r.m[i][3] += a.m[i][3];
+    }
+    return r;
+}
+
+inline vec3 transform_point( const mat34 &a, const vec3 &p )
+{
+    return vec3( a.m[0][0] * p.x() + a.m[0][1] * p.y() + a.m[0][2] * p.z() + a.m[0][3],
+                 a.m[1][0] * p.x() + a.m[1][1] * p.y() + a.m[1][2] * p.z() + a.m[1][3],
+                 a.m[2][0] * p.x() + a.m[2][1] * p.y() + a.m[2][2] * p.z() + a.m[2][3] );
+}
+
+inline vec3 transform_vector( const mat34 &a, const vec3 &v )
+{
+    return vec3( a.m[0][0] * v.x() + a.m[0][1] * v.y() + a.m[0][2] * v.z(),
+                 a.m[1][0] * v.x() + a.m[1][1] * v.y() + a.m[1][2] * v.z(),
+                 a.m[2][0] * v.x() + a.m[2][1] * v.y() + a.m[2][2] * v.z() );
+}
+
+// normals go through the transposed inverse, pass the inverse transform here.
+inline vec3 transform_normal( const mat34 &inv, const vec3 &n )
+{
+    return vec3( inv.m[0][0] * n.x() + inv.m[1][0] * n.y() + inv.m[2][0] * n.z(),
+                 inv.m[0][1] * n.x() + inv.m[1][1] * n.y() + inv.m[2][1] * n.z(),
+                 inv.m[0][2] * n.x() + inv.m[1][2] * n.y() + inv.m[2][2] * n.z() );
+}
+
+inline mat34 inverse( const mat34 &a )
+{
+    const float (*m)[4] = a.m;
+    float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    float c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    float c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+    float det = m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02;
+    float inv_det = 1.0f / det;
+
+    mat34 r;
+    r.m[0][0] = c00 * inv_det;
+    r.m[0][1] = ( m[0][2] * m[2][1] - m[0][1] * m[2][2] ) * inv_det;
+    r.m[0][2] = ( m[0][1] * m[1][2] - m[0][2] * m[1][1] ) * inv_det;
+    r.m[1][0] = c01 * inv_det;
+    r.m[1][1] = ( m[0][0] * m[2][2] - m[0][2] * m[2][0] ) * inv_det;
+    r.m[1][2] = ( m[0][2] * m[1][0] - m[0][0] * m[1][2] ) * inv_det;
+    r.m[2][0] = c02 * inv_det;
+    r.m[2][1] = ( m[0][1] * m[2][0] - m[0][0] * m[2][1] ) * inv_det;
+    r.m[2][2] = ( m[0][0] * m[1][1] - m[0][1] * m[1][0] ) * inv_det;
+
+    // translation: -R^-1 * t
+    vec3 t = -transform_vector( r, vec3( m[0][3], m[1][3], m[2][3] ) );
+    r.m[0][3] = t.x();
+    r.m[1][3] = t.y();
+    r.m[2][3] = t.z();
+    return r;
+}
+
+// tight box of the transformed box (Arvo): each output axis takes the
+// min/max contribution of every input axis.
+inline aabb transform_box( const mat34 &a, const aabb &b )
+{
+    vec3 bmin, bmax;
+    for ( int i = 0; i < 3; ++i )
+    {
+        bmin[i] = bmax[i] = a.m[i][3];
+        for ( int j = 0; j < 3; ++j )
+        {
+            float e = a.m[i][j] * b.min()[j];
+            float f = a.m[i][j] * b.max()[j];
+            bmin[i] += e < f ? e : f;
+            bmax[i] += e < f ? f : e;
+        }
+    }
+    return aabb( bmin, bmax );
+}
+
+// Unit quaternion, the rotations interpolated between motion keys.
+struct quat
+{
+    float x, y, z, w;
+};
+
+// same turn as mat34_rotation( axis, degrees ).
+inline quat quat_rotation( const vec3 &axis, float degrees )
+{
+    float half = 0.5f * ( PI / 180.0f ) * degrees;
+    float s = sinf( half );
+    return { axis.x() * s, axis.y() * s, axis.z() * s, cosf( half ) };
+}
+
+inline float dot( const quat &a, const quat &b )
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+// constant speed along the shortest arc from a (s = 0) to b (s = 1).
+inline quat slerp( const quat &a, const quat &b, float s )
+{
+    float d = dot( a, b );
+    float sign = ( d < 0.0f ) ? -1.0f : 1.0f;
+    d *= sign;
+    float wa, wb;
+    if ( d > 0.9995f )
+    {
+        // nearly the same, lerp (normalized below)
+        wa = 1.0f - s;
+        wb = s;
+    }
+    else
+    {
+        float theta = acosf( d );
+        float inv_sin = 1.0f / sinf( theta );
+        wa = sinf( ( 1.0f - s ) * theta ) * inv_sin;
+        wb = sinf( s * theta ) * inv_sin;
+    }
+    wb *= sign;
+    quat q = { wa * a.x + wb * b.x, wa * a.y + wb * b.y, wa * a.z + wb * b.z, wa * a.w + wb * b.w };
+    float inv_len = 1.0f / sqrtf( dot( q, q ) );
+    return { q.x * inv_len, q.y * inv_len, q.z * inv_len, q.w * inv_len };
+}
+
+inline mat34 mat34_rotation( const quat &q )
+{
+    float x = q.x, y = q.y, z = q.z, w = q.w;
+    mat34 r = mat34_identity();
+    r.m[0][0] = 1.0f - 2.0f * ( y*y + z*z ); r.m[0][1] = 2.0f * ( x*y - z*w );        r.m[0][2] = 2.0f * ( x*z + y*w );
+    r.m[1][0] = 2.0f * ( x*y + z*w );        r.m[1][1] = 1.0f - 2.0f * ( x*x + z*z ); r.m[1][2] = 2.0f * ( y*z - x*w );
+    r.m[2][0] = 2.0f * ( x*z - y*w );        r.m[2][1] = 2.0f * ( y*z + x*w );        r.m[2][2] = 1.0f - 2.0f * ( x*x + y*y );
+    return r;
+}
+
+#endif // _RAYTRACER_MAT34_H_
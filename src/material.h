@@ -14,16 +14,30 @@
      pdf *pdf_ptr;
  };
  
+ // like hitable_kind: the wavefront integrator groups shading work by it.
+ enum material_kind
+ {
+     MATERIAL_OTHER,
+     MATERIAL_LAMBERTIAN,
+     MATERIAL_METAL,
+     MATERIAL_DIELECTRIC,
+     MATERIAL_DIFFUSE_LIGHT,
+     MATERIAL_ISOTROPIC,
+     MATERIAL_KIND_COUNT,
+ };
+ 
  struct material 
  {
      virtual bool scatter( const ray &r_in, const hit_record &hrec, scatter_record &srec ) const = 0;
      virtual float scattering_pdf( const ray &r_in, const hit_record &rec, const ray &scattered) const = 0;
      virtual vec3 emitted( const ray &r_in, const hit_record &rec, float u, float v, const vec3 &p) const { return vec3(0,0,0); };
+     virtual int kind() const { return MATERIAL_OTHER; }
  };
  
- struct lambertian : public material
+ struct lambertian final : public material
  {
      lambertian( texture *a) : albedo(a) {}
+     virtual int kind() const override { return MATERIAL_LAMBERTIAN; }
      
      virtual float scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const
      {
@@ -43,7 +57,7 @@
      texture *albedo = nullptr;
  };
  
- struct metal : public material
+ struct metal final : public material
  {
      metal( texture *a, float f) : albedo(a) 
      { 
@@ -57,6 +71,8 @@
          }
      }
      
+     virtual int kind() const override { return MATERIAL_METAL; }
+     
      virtual float scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const
      {
          return 1.0f;
@@ -81,9 +97,10 @@
      float fuzz = 1.0f;
  };
  
- struct dielectric : public material
+ struct dielectric final : public material
  {
      dielectric( float ri ) : ref_idx(ri) {}
+     virtual int kind() const override { return MATERIAL_DIELECTRIC; }
      virtual float scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const
      {
          return 1.0f;
@@ -147,9 +164,10 @@
      float ref_idx = 1.0f;
  };
  
- struct diffuse_light : public material
+ struct diffuse_light final : public material
  {
      diffuse_light(texture *E) : emit(E) {}
+     virtual int kind() const override { return MATERIAL_DIFFUSE_LIGHT; }
      virtual float scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const
      {
          return 1.0f;
@@ -176,9 +194,10 @@
      texture *emit;
  };
  
- struct isotropic : public material
+ struct isotropic final : public material
  {
      isotropic( texture *a ) : albedo(a) {}
+     virtual int kind() const override { return MATERIAL_ISOTROPIC; }
      virtual float scattering_pdf(const ray &r_in, const hit_record &rec, const ray &scattered) const
      {
          return 1.0f;
@@ -0,0 +1,780 @@
+#ifndef _RAYTRACER_MESH_H_
+#define _RAYTRACER_MESH_H_
+
+// Indexed triangle meshes. The vertex, normal and uv buffers are shared by
+// all the triangles of a mesh; each triangle is its own small hitable
+// (mesh pointer + face index) so the bvh is built over the triangles and
+// not over one opaque mesh.
+
+// indices of one triangle corner in the mesh buffers, -1 when absent.
+struct mesh_corner
+{
+    int32_t p;
+    int32_t t;
+    int32_t n;
+};
+
+struct triangle_mesh;
+
+struct triangle : public hitable
+{
+    triangle() {}
+    triangle( const triangle_mesh *m, uint32_t i ) : mesh(m), index(i) {}
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    virtual int kind() const override { return HITABLE_TRIANGLE; }
+    // surface data of a hit found by intersect_triangle (or a group test).
+    void set_hit_record( const ray &r, float t, float b0, float b1, float b2, hit_record &rec ) const;
+    inline vec3 vertex( int k ) const;
+
+    const triangle_mesh *mesh = nullptr;
+    uint32_t index = 0;
+};
+
+struct mapped_file;
+struct linear_bvh;
+
+struct triangle_mesh
+{
+    // one triangle hitable per face, call once the buffers are set.
+    void build_triangles()
+    {
+        triangles.resize( nb_triangles );
+        for ( uint32_t i = 0; i < nb_triangles; ++i )
+        {
+            triangles[i] = triangle( this, i );
+        }
+    }
+
+    // buffers from the storage vectors.
+    void use_storage()
+    {
+        positions = position_storage.data();
+        normals = normal_storage.data();
+        uvs = uv_storage.data();
+        corners = corner_storage.data();
+        nb_positions = (uint32_t)position_storage.size();
+        nb_normals = (uint32_t)normal_storage.size();
+        nb_uvs = (uint32_t)( uv_storage.size() / 2 );
+        nb_triangles = (uint32_t)( corner_storage.size() / 3 );
+    }
+
+    // appends the triangles to list, returns the new size.
+    int add_triangles( hitable **list, int list_size )
+    {
+        for ( triangle &t : triangles )
+        {
+            list[list_size++] = &t;
+        }
+        return list_size;
+    }
+
+    aabb bounds() const
+    {
+        vec3 bmin( FLT_MAX, FLT_MAX, FLT_MAX );
+        vec3 bmax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+        for ( uint32_t i = 0; i < nb_positions; ++i )
+        {
+            for ( int a = 0; a < 3; ++a )
+            {
+                bmin[a] = ffmin( bmin[a], positions[i][a] );
+                bmax[a] = ffmax( bmax[a], positions[i][a] );
+            }
+        }
+        return aabb( bmin, bmax );
+    }
+
+    // the storage vectors below, or the blocks of a mapped mesh file.
+    const vec3 *positions = nullptr;
+    const vec3 *normals = nullptr;
+    const float *uvs = nullptr;                 // u, v pairs
+    const mesh_corner *corners = nullptr;       // 3 per triangle
+    uint32_t nb_positions = 0;
+    uint32_t nb_normals = 0;
+    uint32_t nb_uvs = 0;
+    uint32_t nb_triangles = 0;
+
+    std::vector<vec3> position_storage;
+    std::vector<vec3> normal_storage;
+    std::vector<float> uv_storage;
+    std::vector<mesh_corner> corner_storage;
+
+    std::vector<triangle> triangles;
+    material *mat = nullptr;
+    mapped_file *file = nullptr;    // kept mapped as long as the mesh lives
+    linear_bvh *bvh = nullptr;      // prebuilt bvh of a mesh file, over triangles
+};
+
+// Watertight ray/triangle test (Woop, Benthin, Wald, JCGT 2013): the
+// vertices are moved into a space where the ray goes along +z from the
+// origin, the 2D edge functions there are exact on shared edges and
+// vertices, so no ray leaks between two triangles of a mesh.
+// The per ray part (axes permutation and shear), set once per leaf.
+struct triangle_ray
+{
+    triangle_ray( const ray &r )
+    {
+        // axis of the largest direction component becomes z, swap x and y
+        // when it is negative to keep the winding
+        const vec3 &d = r.direction();
+        kz = ( fabsf( d[0] ) > fabsf( d[1] ) ) ? ( ( fabsf( d[0] ) > fabsf( d[2] ) ) ? 0 : 2 )
+                                               : ( ( fabsf( d[1] ) > fabsf( d[2] ) ) ? 1 : 2 );
+        kx = ( kz + 1 ) % 3;
+        ky = ( kx + 1 ) % 3;
+        if ( d[kz] < 0.0f )
+        {
+            std::swap( kx, ky );
+        }
+        sz = r.inv_direction()[kz];
+        sx = d[kx] * sz;
+        sy = d[ky] * sz;
+        origin = r.origin();
+    }
+
+    int kx, ky, kz;
+    float sx, sy, sz;
+    vec3 origin;
+};
+
+// Scalar reference, the group tests below give the same results.
+// b0, b1, b2 are the barycentric weights of p0, p1, p2.
+inline bool intersect_triangle( const triangle_ray &tr, const vec3 &p0, const vec3 &p1, const vec3 &p2,
+                                float t_min, float t_max, float &t, float &b0, float &b1, float &b2 )
+{
+    int kx = tr.kx, ky = tr.ky, kz = tr.kz;
+    vec3 a = p0 - tr.origin;
+    vec3 b = p1 - tr.origin;
+    vec3 c = p2 - tr.origin;
+
+    float ax = a[kx] - tr.sx * a[kz];
+    float ay = a[ky] - tr.sy * a[kz];
+    float bx = b[kx] - tr.sx * b[kz];
+    float by = b[ky] - tr.sy * b[kz];
+    float cx = c[kx] - tr.sx * c[kz];
+    float cy = c[ky] - tr.sy * c[kz];
+
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+
+    // on an edge, float cannot tell the side: redo it in double
+    if ( u == 0.0f || v == 0.0f || w == 0.0f )
+    {
+        u = (float)( (double)cx * (double)by - (double)cy * (double)bx );
+        v = (float)( (double)ax * (double)cy - (double)ay * (double)cx );
+        w = (float)( (double)bx * (double)ay - (double)by * (double)ax );
+    }
+
+    // both faces
+    if ( ( u < 0.0f || v < 0.0f || w < 0.0f ) && ( u > 0.0f || v > 0.0f || w > 0.0f ) )
+    {
+        return false;
+    }
+
+    float det = u + v + w;
+    if ( det == 0.0f )
+    {
+        return false;
+    }
+
+    float az = tr.sz * a[kz];
+    float bz = tr.sz * b[kz];
+    float cz = tr.sz * c[kz];
+    float inv_det = 1.0f / det;
+    t = ( u * az + v * bz + w * cz ) * inv_det;
+    if ( !( t > t_min && t < t_max ) )
+    {
+        return false;
+    }
+
+    b0 = u * inv_det;
+    b1 = v * inv_det;
+    b2 = w * inv_det;
+    return true;
+}
+
+inline bool intersect_triangle( const ray &r, const vec3 &p0, const vec3 &p1, const vec3 &p2,
+                                float t_min, float t_max, float &t, float &b0, float &b1, float &b2 )
+{
+    return intersect_triangle( triangle_ray( r ), p0, p1, p2, t_min, t_max, t, b0, b1, b2 );
+}
+
+// GROUPS -------------------------------------------------------------
+// Triangles stored as 9 float arrays (vertex k, axis a in verts[3 * k + a]),
+// N consecutive ones tested at once. Returns the mask of the lanes hit in
+// ]t_min, t_max[, with their t and barycentrics. The arrays must be
+// readable N floats past first.
+#if RAYTRACER_AVX
+const int TRIANGLE_GROUP_SIZE = 8;
+#else
+const int TRIANGLE_GROUP_SIZE = 4;
+#endif
+
+inline vec3 triangle_group_vertex( const float *const *verts, int k, uint32_t i )
+{
+    return vec3( verts[3 * k][i], verts[3 * k + 1][i], verts[3 * k + 2][i] );
+}
+
+template <int N>
+inline int intersect_triangle_group( const triangle_ray &tr, const float *const *verts, uint32_t first,
+                                     float t_min, float t_max, float *t, float *b0, float *b1, float *b2 )
+{
+    int mask = 0;
+    for ( int i = 0; i < N; ++i )
+    {
+        uint32_t k = first + i;
+        if ( intersect_triangle( tr, triangle_group_vertex( verts, 0, k ), triangle_group_vertex( verts, 1, k ),
+                                 triangle_group_vertex( verts, 2, k ), t_min, t_max, t[i], b0[i], b1[i], b2[i] ) )
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+// lanes with a 0 edge function go through the scalar test and its double fallback.
+template <int N>
+inline int fix_triangle_group_edges( int mask, int edge_mask, const triangle_ray &tr, const float *const *verts, uint32_t first,
+                                     float t_min, float t_max, float *t, float *b0, float *b1, float *b2 )
+{
+    mask &= ~edge_mask;
+    while ( edge_mask )
+    {
+        int i = 0;
+        while ( !( edge_mask & ( 1 << i ) ) )
+        {
+            ++i;
+        }
+        edge_mask &= ~( 1 << i );
+        uint32_t k = first + i;
+        if ( intersect_triangle( tr, triangle_group_vertex( verts, 0, k ), triangle_group_vertex( verts, 1, k ),
+                                 triangle_group_vertex( verts, 2, k ), t_min, t_max, t[i], b0[i], b1[i], b2[i] ) )
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+#if RAYTRACER_SSE
+template <>
+inline int intersect_triangle_group<4>( const triangle_ray &tr, const float *const *verts, uint32_t first,
+                                        float t_min, float t_max, float *t, float *b0, float *b1, float *b2 )
+{
+    __m128 sx = _mm_set1_ps( tr.sx );
+    __m128 sy = _mm_set1_ps( tr.sy );
+    __m128 sz = _mm_set1_ps( tr.sz );
+    __m128 px[3], py[3], pz[3];
+    for ( int k = 0; k < 3; ++k )
+    {
+        __m128 x = _mm_sub_ps( _mm_loadu_ps( verts[3 * k + tr.kx] + first ), _mm_set1_ps( tr.origin[tr.kx] ) );
+        __m128 y = _mm_sub_ps( _mm_loadu_ps( verts[3 * k + tr.ky] + first ), _mm_set1_ps( tr.origin[tr.ky] ) );
+        __m128 z = _mm_sub_ps( _mm_loadu_ps( verts[3 * k + tr.kz] + first ), _mm_set1_ps( tr.origin[tr.kz] ) );
+        px[k] = _mm_sub_ps( x, _mm_mul_ps( sx, z ) );
+        py[k] = _mm_sub_ps( y, _mm_mul_ps( sy, z ) );
+        pz[k] = _mm_mul_ps( sz, z );
+    }
+
+    __m128 u = _mm_sub_ps( _mm_mul_ps( px[2], py[1] ), _mm_mul_ps( py[2], px[1] ) );
+    __m128 v = _mm_sub_ps( _mm_mul_ps( px[0], py[2] ), _mm_mul_ps( py[0], px[2] ) );
+    __m128 w = _mm_sub_ps( _mm_mul_ps( px[1], py[0] ), _mm_mul_ps( py[1], px[0] ) );
+
+    __m128 zero = _mm_setzero_ps();
+    int edge_mask = _mm_movemask_ps( _mm_or_ps( _mm_or_ps( _mm_cmpeq_ps( u, zero ), _mm_cmpeq_ps( v, zero ) ),
+                                                _mm_cmpeq_ps( w, zero ) ) );
+    __m128 any_negative = _mm_or_ps( _mm_or_ps( _mm_cmplt_ps( u, zero ), _mm_cmplt_ps( v, zero ) ), _mm_cmplt_ps( w, zero ) );
+    __m128 any_positive = _mm_or_ps( _mm_or_ps( _mm_cmpgt_ps( u, zero ), _mm_cmpgt_ps( v, zero ) ), _mm_cmpgt_ps( w, zero ) );
+
+    __m128 det = _mm_add_ps( _mm_add_ps( u, v ), w );
+    __m128 inv_det = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+    __m128 tt = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( u, pz[0] ), _mm_mul_ps( v, pz[1] ) ), _mm_mul_ps( w, pz[2] ) ), inv_det );
+
+    __m128 valid = _mm_andnot_ps( _mm_and_ps( any_negative, any_positive ), _mm_cmpneq_ps( det, zero ) );
+    valid = _mm_and_ps( valid, _mm_and_ps( _mm_cmpgt_ps( tt, _mm_set1_ps( t_min ) ), _mm_cmplt_ps( tt, _mm_set1_ps( t_max ) ) ) );
+
+    _mm_storeu_ps( t, tt );
+    _mm_storeu_ps( b0, _mm_mul_ps( u, inv_det ) );
+    _mm_storeu_ps( b1, _mm_mul_ps( v, inv_det ) );
+    _mm_storeu_ps( b2, _mm_mul_ps( w, inv_det ) );
+    int mask = _mm_movemask_ps( valid );
+    return edge_mask ? fix_triangle_group_edges<4>( mask, edge_mask, tr, verts, first, t_min, t_max, t, b0, b1, b2 ) : mask;
+}
+#endif
+
+#if RAYTRACER_AVX
+template <>
+inline int intersect_triangle_group<8>( const triangle_ray &tr, const float *const *verts, uint32_t first,
+                                        float t_min, float t_max, float *t, float *b0, float *b1, float *b2 )
+{
+    __m256 sx = _mm256_set1_ps( tr.sx );
+    __m256 sy = _mm256_set1_ps( tr.sy );
+    __m256 sz = _mm256_set1_ps( tr.sz );
+    __m256 px[3], py[3], pz[3];
+    for ( int k = 0; k < 3; ++k )
+    {
+        __m256 x = _mm256_sub_ps( _mm256_loadu_ps( verts[3 * k + tr.kx] + first ), _mm256_set1_ps( tr.origin[tr.kx] ) );
+        __m256 y = _mm256_sub_ps( _mm256_loadu_ps( verts[3 * k + tr.ky] + first ), _mm256_set1_ps( tr.origin[tr.ky] ) );
+        __m256 z = _mm256_sub_ps( _mm256_loadu_ps( verts[3 * k + tr.kz] + first ), _mm256_set1_ps( tr.origin[tr.kz] ) );
+        px[k] = _mm256_sub_ps( x, _mm256_mul_ps( sx, z ) );
+        py[k] = _mm256_sub_ps( y, _mm256_mul_ps( sy, z ) );
+        pz[k] = _mm256_mul_ps( sz, z );
+    }
+
+    __m256 u = _mm256_sub_ps( _mm256_mul_ps( px[2], py[1] ), _mm256_mul_ps( py[2], px[1] ) );
+    __m256 v = _mm256_sub_ps( _mm256_mul_ps( px[0], py[2] ), _mm256_mul_ps( py[0], px[2] ) );
+    __m256 w = _mm256_sub_ps( _mm256_mul_ps( px[1], py[0] ), _mm256_mul_ps( py[1], px[0] ) );
+
+    __m256 zero = _mm256_setzero_ps();
+    int edge_mask = _mm256_movemask_ps( _mm256_or_ps( _mm256_or_ps( _mm256_cmp_ps( u, zero, _CMP_EQ_OQ ), 
+                                                                    _mm256_cmp_ps( v, zero, _CMP_EQ_OQ ) ),
+                                                      _mm256_cmp_ps( w, zero, _CMP_EQ_OQ ) ) );
+    __m256 any_negative = _mm256_or_ps( _mm256_or_ps( _mm256_cmp_ps( u, zero, _CMP_LT_OQ ), _mm256_cmp_ps( v, zero, _CMP_LT_OQ ) ),
+                                        _mm256_cmp_ps( w, zero, _CMP_LT_OQ ) );
+    __m256 any_positive = _mm256_or_ps( _mm256_or_ps( _mm256_cmp_ps( u, zero, _CMP_GT_OQ ), _mm256_cmp_ps( v, zero, _CMP_GT_OQ ) ),
+                                        _mm256_cmp_ps( w, zero, _CMP_GT_OQ ) );
+
+    __m256 det = _mm256_add_ps( _mm256_add_ps( u, v ), w );
+    __m256 inv_det = _mm256_div_ps( _mm256_set1_ps( 1.0f ), det );
+    __m256 tt = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( u, pz[0] ), _mm256_mul_ps( v, pz[1] ) ), 
+                                              _mm256_mul_ps( w, pz[2] ) ), inv_det );
+
+    __m256 valid = _mm256_andnot_ps( _mm256_and_ps( any_negative, any_positive ), _mm256_cmp_ps( det, zero, _CMP_NEQ_OQ ) );
+    valid = _mm256_and_ps( valid, _mm256_and_ps( _mm256_cmp_ps( tt, _mm256_set1_ps( t_min ), _CMP_GT_OQ ), 
+                                                 _mm256_cmp_ps( tt, _mm256_set1_ps( t_max ), _CMP_LT_OQ ) ) );
+
+    _mm256_storeu_ps( t, tt );
+    _mm256_storeu_ps( b0, _mm256_mul_ps( u, inv_det ) );
+    _mm256_storeu_ps( b1, _mm256_mul_ps( v, inv_det ) );
+    _mm256_storeu_ps( b2, _mm256_mul_ps( w, inv_det ) );
+    int mask = _mm256_movemask_ps( valid );
+    return edge_mask ? fix_triangle_group_edges<8>( mask, edge_mask, tr, verts, first, t_min, t_max, t, b0, b1, b2 ) : mask;
+}
+#endif
+
+bool triangle::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    const mesh_corner *c = &mesh->corners[3 * index];
+    float t, b0, b1, b2;
+    if ( !intersect_triangle( r, mesh->positions[c[0].p], mesh->positions[c[1].p], mesh->positions[c[2].p],
+                              t_min, t_max, t, b0, b1, b2 ) )
+    {
+        return false;
+    }
+    set_hit_record( r, t, b0, b1, b2, rec );
+    return true;
+}
+
+void triangle::set_hit_record( const ray &r, float t, float b0, float b1, float b2, hit_record &rec ) const
+{
+    const mesh_corner *c = &mesh->corners[3 * index];
+    const vec3 &p0 = mesh->positions[c[0].p];
+    const vec3 &p1 = mesh->positions[c[1].p];
+    const vec3 &p2 = mesh->positions[c[2].p];
+
+    rec.t = t;
+    rec.p = r.point_at_parameter( t );
+    rec.mat_ptr = mesh->mat;
+
+    if ( c[0].n >= 0 && c[1].n >= 0 && c[2].n >= 0 )
+    {
+        rec.normal = unit_vector( b0 * mesh->normals[c[0].n] + b1 * mesh->normals[c[1].n] + b2 * mesh->normals[c[2].n] );
+    }
+    else
+    {
+        rec.normal = unit_vector( cross( p1 - p0, p2 - p0 ) );
+    }
+
+    if ( c[0].t >= 0 && c[1].t >= 0 && c[2].t >= 0 )
+    {
+        const float *uv0 = &mesh->uvs[2 * c[0].t];
+        const float *uv1 = &mesh->uvs[2 * c[1].t];
+        const float *uv2 = &mesh->uvs[2 * c[2].t];
+        rec.u = b0 * uv0[0] + b1 * uv1[0] + b2 * uv2[0];
+        rec.v = b0 * uv0[1] + b1 * uv1[1] + b2 * uv2[1];
+    }
+    else
+    {
+        rec.u = b1;
+        rec.v = b2;
+    }
+}
+
+inline vec3 triangle::vertex( int k ) const
+{
+    return mesh->positions[mesh->corners[3 * index + k].p];
+}
+
+bool triangle::occluded( const ray &r, float t_min, float t_max ) const
+{
+    const mesh_corner *c = &mesh->corners[3 * index];
+    float t, b0, b1, b2;
+    return intersect_triangle( r, mesh->positions[c[0].p], mesh->positions[c[1].p], mesh->positions[c[2].p],
+                               t_min, t_max, t, b0, b1, b2 );
+}
+
+// flat boxes are fine: the slab tests scale the far plane up.
+bool triangle::bounding_box( float t0, float t1, aabb &box ) const
+{
+    const mesh_corner *c = &mesh->corners[3 * index];
+    const vec3 &p0 = mesh->positions[c[0].p];
+    const vec3 &p1 = mesh->positions[c[1].p];
+    const vec3 &p2 = mesh->positions[c[2].p];
+    box = aabb( vec3( ffmin( p0.x(), ffmin( p1.x(), p2.x() ) ),
+                      ffmin( p0.y(), ffmin( p1.y(), p2.y() ) ),
+                      ffmin( p0.z(), ffmin( p1.z(), p2.z() ) ) ),
+                vec3( ffmax( p0.x(), ffmax( p1.x(), p2.x() ) ),
+                      ffmax( p0.y(), ffmax( p1.y(), p2.y() ) ),
+                      ffmax( p0.z(), ffmax( p1.z(), p2.z() ) ) ) );
+    return true;
+}
+
+// OBJ LOADER ---------------------------------------------------------
+// v, vt, vn and f lines only (polygons are fanned, negative indices are
+// relative), everything else is skipped. The file is read at once and cut
+// into line aligned chunks parsed in parallel, in two passes: the first
+// one counts the elements of each chunk, which gives every chunk its
+// offsets in the mesh buffers, the second one parses straight into them.
+
+const int OBJ_MIN_CHUNK_SIZE = 1 << 20;
+const int OBJ_MAX_CHUNKS = 256;
+
+struct obj_chunk
+{
+    const char *begin;
+    const char *end;
+    int nb_positions = 0;
+    int nb_uvs = 0;
+    int nb_normals = 0;
+    int nb_triangles = 0;
+};
+
+inline bool obj_is_space( char c ) { return c == ' ' || c == '\t' || c == '\r'; }
+inline bool obj_is_digit( char c ) { return c >= '0' && c <= '9'; }
+
+inline const char *obj_skip_spaces( const char *c )
+{
+    while ( obj_is_space( *c ) )
+    {
+        ++c;
+    }
+    return c;
+}
+
+inline const char *obj_next_line( const char *c )
+{
+    while ( *c != '\n' )
+    {
+        ++c;
+    }
+    return c + 1;
+}
+
+// [-+]digits[.digits][(e|E)[-+]digits], no locale, no allocation.
+inline float obj_parse_float( const char *&c )
+{
+    local_persist const double powers_of_ten[] =
+    {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+        1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+    };
+
+    c = obj_skip_spaces( c );
+    bool negative = ( *c == '-' );
+    if ( *c == '-' || *c == '+' )
+    {
+        ++c;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int nb_digits = 0;
+    for ( ; obj_is_digit( *c ); ++c )
+    {
+        if ( nb_digits < 18 ) { mantissa = mantissa * 10 + ( *c - '0' ); ++nb_digits; }
+        else { ++exponent; }
+    }
+    if ( *c == '.' )
+    {
+        for ( ++c; obj_is_digit( *c ); ++c )
+        {
+            if ( nb_digits < 18 ) { mantissa = mantissa * 10 + ( *c - '0' ); ++nb_digits; --exponent; }
+        }
+    }
+    if ( *c == 'e' || *c == 'E' )
+    {
+        ++c;
+        bool negative_exponent = ( *c == '-' );
+        if ( *c == '-' || *c == '+' )
+        {
+            ++c;
+        }
+        int e = 0;
+        for ( ; obj_is_digit( *c ); ++c )
+        {
+            e = ( e < 10000 ) ? e * 10 + ( *c - '0' ) : e;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+
+    double value = (double)mantissa;
+    while ( exponent > 0 )
+    {
+        int k = ( exponent > 18 ) ? 18 : exponent;
+        value *= powers_of_ten[k];
+        exponent -= k;
+    }
+    while ( exponent < 0 )
+    {
+        int k = ( -exponent > 18 ) ? 18 : -exponent;
+        value /= powers_of_ten[k];
+        exponent += k;
+    }
+    return (float)( negative ? -value : value );
+}
+
+// 0 when there is no index.
+inline int obj_parse_int( const char *&c )
+{
+    bool negative = ( *c == '-' );
+    if ( *c == '-' || *c == '+' )
+    {
+        ++c;
+    }
+    int value = 0;
+    for ( ; obj_is_digit( *c ); ++c )
+    {
+        value = value * 10 + ( *c - '0' );
+    }
+    return negative ? -value : value;
+}
+
+// 1 based (or negative, relative to count) index to a 0 based one, -1 if none.
+inline int32_t obj_resolve_index( int i, int count )
+{
+    if ( i > 0 )
+    {
+        return i - 1;
+    }
+    return ( i < 0 ) ? count + i : -1;
+}
+
+// first pass: element counts of a chunk.
+void count_obj_chunk( obj_chunk &chunk )
+{
+    for ( const char *c = chunk.begin; c < chunk.end; c = obj_next_line( c ) )
+    {
+        c = obj_skip_spaces( c );
+        if ( c[0] == 'v' )
+        {
+            chunk.nb_positions += obj_is_space( c[1] );
+            chunk.nb_uvs += ( c[1] == 't' );
+            chunk.nb_normals += ( c[1] == 'n' );
+        }
+        else if ( c[0] == 'f' && obj_is_space( c[1] ) )
+        {
+            int nb_corners = 0;
+            for ( c = obj_skip_spaces( c + 1 ); *c != '\n'; c = obj_skip_spaces( c ) )
+            {
+                ++nb_corners;
+                while ( !obj_is_space( *c ) && *c != '\n' )
+                {
+                    ++c;
+                }
+            }
+            chunk.nb_triangles += ( nb_corners > 2 ) ? nb_corners - 2 : 0;
+        }
+    }
+}
+
+// second pass: parses into the mesh buffers from the chunk offsets.
+void parse_obj_chunk( const obj_chunk &chunk, triangle_mesh *mesh,
+                      int first_position, int first_uv, int first_normal, int first_triangle )
+{
+    int nb_positions = first_position;
+    int nb_uvs = first_uv;
+    int nb_normals = first_normal;
+    mesh_corner *corner = mesh->corner_storage.data() + 3 * (size_t)first_triangle;
+
+    for ( const char *c = chunk.begin; c < chunk.end; c = obj_next_line( c ) )
+    {
+        c = obj_skip_spaces( c );
+        if ( c[0] == 'v' && obj_is_space( c[1] ) )
+        {
+            ++c;
+            vec3 &p = mesh->position_storage[nb_positions++];
+            p[0] = obj_parse_float( c );
+            p[1] = obj_parse_float( c );
+            p[2] = obj_parse_float( c );
+        }
+        else if ( c[0] == 'v' && c[1] == 't' )
+        {
+            c += 2;
+            float *uv = &mesh->uv_storage[2 * (size_t)nb_uvs++];
+            uv[0] = obj_parse_float( c );
+            uv[1] = obj_parse_float( c );
+        }
+        else if ( c[0] == 'v' && c[1] == 'n' )
+        {
+            c += 2;
+            vec3 &n = mesh->normal_storage[nb_normals++];
+            n[0] = obj_parse_float( c );
+            n[1] = obj_parse_float( c );
+            n[2] = obj_parse_float( c );
+        }
+        else if ( c[0] == 'f' && obj_is_space( c[1] ) )
+        {
+            // p, p/t, p//n or p/t/n corners, fanned around the first one
+            mesh_corner first = {}, previous = {};
+            int nb_corners = 0;
+            for ( c = obj_skip_spaces( c + 1 ); *c != '\n'; c = obj_skip_spaces( c ) )
+            {
+                mesh_corner current;
+                current.p = obj_resolve_index( obj_parse_int( c ), nb_positions );
+                current.t = -1;
+                current.n = -1;
+                if ( *c == '/' )
+                {
+                    ++c;
+                    current.t = obj_resolve_index( obj_parse_int( c ), nb_uvs );
+                    if ( *c == '/' )
+                    {
+                        ++c;
+                        current.n = obj_resolve_index( obj_parse_int( c ), nb_normals );
+                    }
+                }
+                while ( !obj_is_space( *c ) && *c != '\n' )
+                {
+                    ++c;
+                }
+
+                if ( nb_corners == 0 )
+                {
+                    first = current;
+                }
+                else if ( nb_corners >= 2 )
+                {
+                    *corner++ = first;
+                    *corner++ = previous;
+                    *corner++ = current;
+                }
+                previous = current;
+                ++nb_corners;
+            }
+        }
+    }
+}
+
+// nullptr if the file cannot be read. pool may be null.
+triangle_mesh *load_obj( const char *filename, material *mat, thread_pool *pool )
+{
+    FILE *f = fopen( filename, "rb" );
+    if ( !f )
+    {
+        return nullptr;
+    }
+    fseek( f, 0, SEEK_END );
+#ifdef _WIN32
+    long long file_size = _ftelli64( f );
+#else
+    long long file_size = ftello( f );
+#endif
+    fseek( f, 0, SEEK_SET );
+    if ( file_size < 0 )
+    {
+        fclose( f );
+        return nullptr;
+    }
+
+    // a trailing end of line and a 0 stop every scan without bound checks
+    std::vector<char> text( (size_t)file_size + 2 );
+    size_t nb_read = fread( text.data(), 1, (size_t)file_size, f );
+    fclose( f );
+    text[nb_read] = '\n';
+    text[nb_read + 1] = '\0';
+    const char *begin = text.data();
+    const char *end = begin + nb_read + 1;
+
+    // line aligned chunks of 1MB or more
+    int nb_chunks = pool ? (int)std::min<long long>( OBJ_MAX_CHUNKS, file_size / OBJ_MIN_CHUNK_SIZE + 1 ) : 1;
+    std::vector<obj_chunk> chunks( nb_chunks );
+    const char *chunk_begin = begin;
+    for ( int i = 0; i < nb_chunks; ++i )
+    {
+        const char *chunk_end = ( i == nb_chunks - 1 ) ? end : begin + ( end - begin ) * ( i + 1 ) / nb_chunks;
+        chunk_end = ( chunk_end > chunk_begin ) ? obj_next_line( chunk_end - 1 ) : chunk_begin;
+        chunk_end = ( chunk_end > end ) ? end : chunk_end;
+        chunks[i].begin = chunk_begin;
+        chunks[i].end = chunk_end;
+        chunk_begin = chunk_end;
+    }
+
+    auto count = [&]( int, int chunk_begin, int chunk_end )
+    {
+        for ( int i = chunk_begin; i < chunk_end; ++i )
+        {
+            count_obj_chunk( chunks[i] );
+        }
+    };
+    if ( pool ) { parallel_for( pool, nb_chunks, nb_chunks, count ); }
+    else        { count( 0, 0, nb_chunks ); }
+
+    // chunk offsets
+    std::vector<int> first_position( nb_chunks ), first_uv( nb_chunks ), first_normal( nb_chunks ), first_triangle( nb_chunks );
+    int nb_positions = 0, nb_uvs = 0, nb_normals = 0, nb_triangles = 0;
+    for ( int i = 0; i < nb_chunks; ++i )
+    {
+        first_position[i] = nb_positions;
+        first_uv[i] = nb_uvs;
+        first_normal[i] = nb_normals;
+        first_triangle[i] = nb_triangles;
+        nb_positions += chunks[i].nb_positions;
+        nb_uvs += chunks[i].nb_uvs;
+        nb_normals += chunks[i].nb_normals;
+        nb_triangles += chunks[i].nb_triangles;
+    }
+
+    triangle_mesh *mesh = new triangle_mesh();
+    mesh->mat = mat;
+    mesh->position_storage.resize( nb_positions );
+    mesh->uv_storage.resize( 2 * (size_t)nb_uvs );
+    mesh->normal_storage.resize( nb_normals );
+    mesh->corner_storage.resize( 3 * (size_t)nb_triangles );
+
+    auto parse = [&]( int, int chunk_begin, int chunk_end )
+    {
+        for ( int i = chunk_begin; i < chunk_end; ++i )
+        {
+            parse_obj_chunk( chunks[i], mesh, first_position[i], first_uv[i], first_normal[i], first_triangle[i] );
+        }
+    };
+    if ( pool ) { parallel_for( pool, nb_chunks, nb_chunks, parse ); }
+    else        { parse( 0, 0, nb_chunks ); }
+
+    // drop the faces with an index out of the buffers
+    size_t nb_corners = 0;
+    for ( size_t i = 0; i < mesh->corner_storage.size(); i += 3 )
+    {
+        bool valid = true;
+        for ( int k = 0; k < 3; ++k )
+        {
+            const mesh_corner &c = mesh->corner_storage[i + k];
+            valid = valid && ( c.p >= 0 && c.p < nb_positions );
+            valid = valid && ( c.t >= -1 && c.t < nb_uvs ) && ( c.n >= -1 && c.n < nb_normals );
+        }
+        if ( valid )
+        {
+            for ( int k = 0; k < 3; ++k )
+            {
+                mesh->corner_storage[nb_corners++] = mesh->corner_storage[i + k];
+            }
+        }
+    }
+    mesh->corner_storage.resize( nb_corners );
+
+    mesh->use_storage();
+    mesh->build_triangles();
+    return mesh;
+}
+
+#endif // _RAYTRACER_MESH_H_
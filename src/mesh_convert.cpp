@@ -0,0 +1,158 @@
+/** mesh_convert
+ *  Converts an OBJ into a binary mesh file (.rtm, see mesh_file.h) that
+ *  main.exe maps instead of parsing: main.exe --scene mesh -i out.rtm
+ *  @usage: mesh_convert.exe -i in.obj -o out.rtm -t 4
+
+ "i,input"       "Input OBJ filename"
+ "o,output"      "Output mesh filename"            "out.rtm"
+ "t,threads"     "Number of threads"               "1"
+ "bvh"           "Store a prebuilt BVH block"      "1"       "0"
+ "bvh-bins"      "Number of SAH bins"              "16"
+ "bvh-leaf"      "Max primitives per SAH leaf"     "4"
+ "v,verbose"     "Prints text"                     "0"       "1"
+
+ */
+
+#include <iostream>
+#define _USE_MATH_DEFINES
+#include <cmath>
+#include <cstdlib>
+#include <float.h>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <queue>
+#include <condition_variable>
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+#include <utility>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#    define WIN32_LEAN_AND_MEAN
+#    define NOMINMAX
+#    include <windows.h>
+#else
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <fcntl.h>
+#    include <unistd.h>
+#endif
+
+#define _CRT_SECURE_NO_WARNINGS
+#define CXXOPTS_NO_RTTI
+#include "../ext/cxxopts.hpp"
+
+#ifndef PI
+#    define PI 3.14159f
+#endif
+
+#define internal static
+#define global static
+#define local_persist static
+
+global std::default_random_engine generator;
+global std::uniform_real_distribution<float> distribution(0.0f,1.0f);
+#define RAN01() distribution(generator)
+
+#include "stats.h"
+#include "simd.h"
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "mat34.h"
+#include "utils.h"
+#include "thread_pool.h"
+#include "hitable.h"
+#include "hitable_list.h"
+#include "pdf.h"
+#include "sphere.h"
+#include "mesh.h"
+#include "bvh.h"
+#include "lbvh.h"
+#include "linear_bvh.h"
+#include "mesh_file.h"
+
+int main( int argc, char **argv )
+{
+    cxxopts::Options options( "mesh_convert", "OBJ to binary mesh file" );
+    options.add_options()
+        ( "i,input",       "Input OBJ filename", cxxopts::value<std::string>() )
+        ( "o,output",      "Output mesh filename", cxxopts::value<std::string>()->default_value( "out.rtm" ) )
+        ( "t,threads",     "Number of threads", cxxopts::value<int>()->default_value( "1" ) )
+        ( "bvh",           "Store a prebuilt BVH block", cxxopts::value<int>()->default_value( "1" ) )
+        ( "bvh-bins",      "Number of SAH bins", cxxopts::value<int>()->default_value( "16" ) )
+        ( "bvh-leaf",      "Max primitives per SAH leaf", cxxopts::value<int>()->default_value( "4" ) )
+        ( "v,verbose",     "Prints text", cxxopts::value<int>()->default_value( "0" )->implicit_value( "1" ) )
+        ;
+    options.parse( argc, argv );
+    if ( !options.count( "i" ) )
+    {
+        std::cout << options.help() << "\n";
+        return 1;
+    }
+
+    std::string in_filename = options["i"].as<std::string>();
+    std::string out_filename = options["o"].as<std::string>();
+    int threads = options["t"].as<int>();
+    int with_bvh = options["bvh"].as<int>();
+    int verbose = options["v"].as<int>();
+    g_bvh_build_params.nb_bins = options["bvh-bins"].as<int>();
+    g_bvh_build_params.max_leaf_size = options["bvh-leaf"].as<int>();
+
+    thread_pool *pool = nullptr;
+    if ( threads > 1 )
+    {
+        pool = new thread_pool( threads );
+        g_bvh_build_params.pool = pool;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    triangle_mesh *mesh = load_obj( in_filename.c_str(), nullptr, pool );
+    if ( !mesh )
+    {
+        std::cout << "Cannot read \"" << in_filename << "\"\n";
+        return 1;
+    }
+    auto parsed = std::chrono::high_resolution_clock::now();
+
+    linear_bvh *bvh = nullptr;
+    if ( with_bvh && mesh->nb_triangles > 0 )
+    {
+        std::vector<hitable*> prims( mesh->nb_triangles );
+        for ( uint32_t i = 0; i < mesh->nb_triangles; ++i )
+        {
+            prims[i] = &mesh->triangles[i];
+        }
+        bvh_node *root = new bvh_node( prims.data(), (int)prims.size(), 0.0f, 1.0f );
+        bvh = new linear_bvh( root, 0.0f, 1.0f );
+    }
+    auto built = std::chrono::high_resolution_clock::now();
+
+    if ( !write_mesh_file( out_filename.c_str(), mesh, bvh ) )
+    {
+        std::cout << "Cannot write \"" << out_filename << "\"\n";
+        return 1;
+    }
+    auto written = std::chrono::high_resolution_clock::now();
+
+    if ( verbose )
+    {
+        std::cout << "Mesh                : " << mesh->nb_positions << " positions, " << mesh->nb_normals << " normals, "
+            << mesh->nb_uvs << " uvs, " << mesh->nb_triangles << " triangles\n";
+        std::cout << "BVH                 : " << ( bvh ? bvh->nb_nodes : 0 ) << " nodes\n";
+        std::cout << "Parse time          : " << std::chrono::duration<double, std::milli>( parsed - start ).count() << "ms\n";
+        std::cout << "BVH build time      : " << std::chrono::duration<double, std::milli>( built - parsed ).count() << "ms\n";
+        std::cout << "Write time          : " << std::chrono::duration<double, std::milli>( written - built ).count() << "ms\n";
+    }
+
+    if ( pool )
+    {
+        g_bvh_build_params.pool = nullptr;
+        delete pool;
+    }
+    return 0;
+}
@@ -0,0 +1,353 @@
+#ifndef _RAYTRACER_MESH_FILE_H_
+#define _RAYTRACER_MESH_FILE_H_
+
+// Binary mesh file (.rtm), written by mesh_convert from an OBJ and mapped
+// by the renderer: the blocks are used in place as the mesh buffers, no
+// parse and no copy, and the pages are shared by every process rendering
+// the same file. Layout: the header, then each block at an offset aligned
+// on MESH_FILE_ALIGNMENT (mapped views start on a page, so the blocks are
+// aligned in memory too). Absent blocks have a 0 offset.
+//
+//   positions  nb_positions * vec3
+//   normals    nb_normals * vec3
+//   uvs        nb_uvs * 2 floats
+//   corners    nb_triangles * 3 mesh_corner
+//   bvh        nb_bvh_nodes * linear_bvh_node, static, leaf primitives are
+//              triangle indices: the triangles are stored in leaf order.
+//   triangles  with the bvh, the vertices again as linear_bvh_triangles:
+//              9 arrays (x, y, z of each vertex) of nb_triangles floats
+//              plus MESH_FILE_TRIANGLE_PADDING for the group loads.
+//
+// Little endian, for the machines that wrote it.
+
+const char MESH_FILE_MAGIC[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+const uint32_t MESH_FILE_VERSION = 2;
+const uint64_t MESH_FILE_ALIGNMENT = 64;
+const uint64_t MESH_FILE_TRIANGLE_PADDING = 8;
+
+struct mesh_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t nb_positions;
+    uint64_t nb_normals;
+    uint64_t nb_uvs;
+    uint64_t nb_triangles;
+    uint64_t nb_bvh_nodes;
+    uint64_t positions_offset;
+    uint64_t normals_offset;
+    uint64_t uvs_offset;
+    uint64_t corners_offset;
+    uint64_t bvh_offset;
+    uint64_t triangles_offset;
+};
+
+static_assert( sizeof(vec3) == 12, "mesh files store packed vec3" );
+static_assert( sizeof(mesh_corner) == 12, "mesh files store packed corners" );
+static_assert( TRIANGLE_GROUP_SIZE <= MESH_FILE_TRIANGLE_PADDING, "mesh files pad the triangle arrays for the widest group" );
+
+// read only view of a whole file.
+struct mapped_file
+{
+    const uint8_t *data = nullptr;
+    uint64_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+bool map_file( const char *filename, mapped_file *f )
+{
+#ifdef _WIN32
+    f->file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr );
+    if ( f->file == INVALID_HANDLE_VALUE )
+    {
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx( f->file, &size );
+    f->size = (uint64_t)size.QuadPart;
+    f->mapping = ( f->size > 0 ) ? CreateFileMappingA( f->file, nullptr, PAGE_READONLY, 0, 0, nullptr ) : nullptr;
+    f->data = f->mapping ? (const uint8_t*)MapViewOfFile( f->mapping, FILE_MAP_READ, 0, 0, 0 ) : nullptr;
+    if ( !f->data )
+    {
+        if ( f->mapping ) { CloseHandle( f->mapping ); }
+        CloseHandle( f->file );
+        return false;
+    }
+    return true;
+#else
+    int fd = open( filename, O_RDONLY );
+    if ( fd < 0 )
+    {
+        return false;
+    }
+    struct stat st;
+    if ( fstat( fd, &st ) != 0 || st.st_size == 0 )
+    {
+        close( fd );
+        return false;
+    }
+    void *p = mmap( nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd ); // the mapping keeps the file
+    if ( p == MAP_FAILED )
+    {
+        return false;
+    }
+    f->data = (const uint8_t*)p;
+    f->size = (uint64_t)st.st_size;
+    return true;
+#endif
+}
+
+void unmap_file( mapped_file *f )
+{
+    if ( !f->data )
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile( f->data );
+    CloseHandle( f->mapping );
+    CloseHandle( f->file );
+#else
+    munmap( (void*)f->data, (size_t)f->size );
+#endif
+    f->data = nullptr;
+    f->size = 0;
+}
+
+// the block [offset, offset + count * element_size) fits in the file.
+inline bool mesh_block_fits( const mapped_file &f, uint64_t offset, uint64_t count, uint64_t element_size )
+{
+    if ( count == 0 )
+    {
+        return true;
+    }
+    return offset >= sizeof(mesh_file_header) && ( offset % MESH_FILE_ALIGNMENT ) == 0 &&
+           offset <= f.size && count <= ( f.size - offset ) / element_size;
+}
+
+// Indices of a mapped file are only read at render time: check them all
+// once, like load_obj drops the faces out of range.
+inline bool mesh_file_corners_valid( const mesh_file_header &h, const mesh_corner *corners )
+{
+    int64_t nb_positions = (int64_t)h.nb_positions;
+    int64_t nb_uvs = (int64_t)h.nb_uvs;
+    int64_t nb_normals = (int64_t)h.nb_normals;
+    for ( uint64_t i = 0; i < 3 * h.nb_triangles; ++i )
+    {
+        const mesh_corner &c = corners[i];
+        if ( c.p < 0 || c.p >= nb_positions || c.t < -1 || c.t >= nb_uvs || c.n < -1 || c.n >= nb_normals )
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Leaves stay in the triangles (no spheres, nothing moves), children come
+// after their parent (no cycles) and the depth fits the traversal stacks.
+inline bool mesh_file_bvh_valid( const mesh_file_header &h, const linear_bvh_node *nodes )
+{
+    std::vector<uint8_t> depth( (size_t)h.nb_bvh_nodes, 0 );
+    for ( uint64_t i = 0; i < h.nb_bvh_nodes; ++i )
+    {
+        const linear_bvh_node &node = nodes[i];
+        if ( node.flags & LINEAR_BVH_MOVING )
+        {
+            return false;
+        }
+        if ( node.nb_prims > 0 )
+        {
+            if ( (uint64_t)node.offset + node.nb_prims > h.nb_triangles || node.axis != 0 ||
+                 ( node.flags >> LINEAR_BVH_TRIANGLES_SHIFT ) > node.nb_prims )
+            {
+                return false;
+            }
+            continue;
+        }
+        if ( i + 1 >= h.nb_bvh_nodes || node.offset <= i + 1 || node.offset >= h.nb_bvh_nodes ||
+             depth[i] >= BVH_MAX_DEPTH )
+        {
+            return false;
+        }
+        depth[i + 1] = depth[i] + 1;
+        depth[node.offset] = depth[i] + 1;
+    }
+    return true;
+}
+
+// nullptr if the file cannot be mapped or is not a mesh file. When the
+// file has a bvh block, mesh->bvh is set: add it to the scene instead of
+// the triangles.
+triangle_mesh *map_mesh_file( const char *filename, material *mat )
+{
+    mapped_file *f = new mapped_file();
+    if ( !map_file( filename, f ) )
+    {
+        delete f;
+        return nullptr;
+    }
+
+    mesh_file_header h;
+    bool valid = ( f->size >= sizeof(h) );
+    if ( valid )
+    {
+        memcpy( &h, f->data, sizeof(h) );
+        valid = ( memcmp( h.magic, MESH_FILE_MAGIC, sizeof(h.magic) ) == 0 ) &&
+                ( h.version == MESH_FILE_VERSION ) && ( h.header_size == sizeof(h) ) &&
+                ( h.nb_positions < UINT32_MAX ) && ( h.nb_normals < UINT32_MAX ) &&
+                ( h.nb_uvs < UINT32_MAX ) && ( h.nb_triangles < UINT32_MAX ) && ( h.nb_bvh_nodes < UINT32_MAX ) &&
+                mesh_block_fits( *f, h.positions_offset, h.nb_positions, sizeof(vec3) ) &&
+                mesh_block_fits( *f, h.normals_offset, h.nb_normals, sizeof(vec3) ) &&
+                mesh_block_fits( *f, h.uvs_offset, h.nb_uvs, 2 * sizeof(float) ) &&
+                mesh_block_fits( *f, h.corners_offset, h.nb_triangles, 3 * sizeof(mesh_corner) ) &&
+                mesh_block_fits( *f, h.bvh_offset, h.nb_bvh_nodes, sizeof(linear_bvh_node) ) &&
+                ( h.nb_bvh_nodes == 0 || 
+                  mesh_block_fits( *f, h.triangles_offset, 9 * ( h.nb_triangles + MESH_FILE_TRIANGLE_PADDING ), sizeof(float) ) );
+        valid = valid && mesh_file_corners_valid( h, (const mesh_corner*)( f->data + h.corners_offset ) ) &&
+                mesh_file_bvh_valid( h, (const linear_bvh_node*)( f->data + h.bvh_offset ) );
+    }
+    if ( !valid )
+    {
+        unmap_file( f );
+        delete f;
+        return nullptr;
+    }
+
+    triangle_mesh *mesh = new triangle_mesh();
+    mesh->mat = mat;
+    mesh->file = f;
+    mesh->positions = (const vec3*)( f->data + h.positions_offset );
+    mesh->normals = (const vec3*)( f->data + h.normals_offset );
+    mesh->uvs = (const float*)( f->data + h.uvs_offset );
+    mesh->corners = (const mesh_corner*)( f->data + h.corners_offset );
+    mesh->nb_positions = (uint32_t)h.nb_positions;
+    mesh->nb_normals = (uint32_t)h.nb_normals;
+    mesh->nb_uvs = (uint32_t)h.nb_uvs;
+    mesh->nb_triangles = (uint32_t)h.nb_triangles;
+    mesh->build_triangles();
+
+    if ( h.nb_bvh_nodes > 0 )
+    {
+        std::vector<hitable*> prims( mesh->nb_triangles );
+        for ( uint32_t i = 0; i < mesh->nb_triangles; ++i )
+        {
+            prims[i] = &mesh->triangles[i];
+        }
+        const float *triangle_verts[9];
+        for ( int i = 0; i < 9; ++i )
+        {
+            triangle_verts[i] = (const float*)( f->data + h.triangles_offset ) + i * ( h.nb_triangles + MESH_FILE_TRIANGLE_PADDING );
+        }
+        mesh->bvh = new linear_bvh( (const linear_bvh_node*)( f->data + h.bvh_offset ),
+                                    (uint32_t)h.nb_bvh_nodes, std::move( prims ), triangle_verts );
+    }
+    return mesh;
+}
+
+inline uint64_t align_mesh_offset( uint64_t offset )
+{
+    return ( offset + MESH_FILE_ALIGNMENT - 1 ) & ~( MESH_FILE_ALIGNMENT - 1 );
+}
+
+// bvh may be null, else a linear_bvh built over mesh->triangles: the
+// triangles are written in the order of its leaves.
+bool write_mesh_file( const char *filename, const triangle_mesh *mesh, const linear_bvh *bvh )
+{
+    mesh_file_header h = {};
+    memcpy( h.magic, MESH_FILE_MAGIC, sizeof(h.magic) );
+    h.version = MESH_FILE_VERSION;
+    h.header_size = sizeof(h);
+    h.nb_positions = mesh->nb_positions;
+    h.nb_normals = mesh->nb_normals;
+    h.nb_uvs = mesh->nb_uvs;
+    h.nb_triangles = mesh->nb_triangles;
+    h.nb_bvh_nodes = bvh ? bvh->nb_nodes : 0;
+
+    uint64_t offset = sizeof(h);
+    auto place = [&]( uint64_t count, uint64_t element_size ) -> uint64_t
+    {
+        if ( count == 0 )
+        {
+            return 0;
+        }
+        uint64_t block = align_mesh_offset( offset );
+        offset = block + count * element_size;
+        return block;
+    };
+    h.positions_offset = place( h.nb_positions, sizeof(vec3) );
+    h.normals_offset = place( h.nb_normals, sizeof(vec3) );
+    h.uvs_offset = place( h.nb_uvs, 2 * sizeof(float) );
+    h.corners_offset = place( h.nb_triangles, 3 * sizeof(mesh_corner) );
+    h.bvh_offset = place( h.nb_bvh_nodes, sizeof(linear_bvh_node) );
+    uint64_t triangle_stride = h.nb_triangles + MESH_FILE_TRIANGLE_PADDING;
+    h.triangles_offset = place( bvh ? 9 * triangle_stride : 0, sizeof(float) );
+
+    // triangles in leaf order
+    std::vector<mesh_corner> corners( mesh->corners, mesh->corners + 3 * (size_t)mesh->nb_triangles );
+    if ( bvh )
+    {
+        if ( bvh->prims.size() != mesh->nb_triangles || bvh->has_motion )
+        {
+            return false;
+        }
+        for ( size_t i = 0; i < bvh->prims.size(); ++i )
+        {
+            const triangle *t = (const triangle*)bvh->prims[i];
+            for ( int k = 0; k < 3; ++k )
+            {
+                corners[3 * i + k] = mesh->corners[3 * (size_t)t->index + k];
+            }
+        }
+    }
+
+    // the bvh arrays, restrided to the file padding
+    std::vector<float> triangle_data;
+    if ( bvh )
+    {
+        triangle_data.assign( 9 * triangle_stride, 0.0f );
+        for ( uint64_t i = 0; i < h.nb_triangles; ++i )
+        {
+            vec3 v[3] = { mesh->positions[corners[3 * i].p], mesh->positions[corners[3 * i + 1].p], mesh->positions[corners[3 * i + 2].p] };
+            for ( int k = 0; k < 9; ++k )
+            {
+                triangle_data[k * triangle_stride + i] = v[k / 3][k % 3];
+            }
+        }
+    }
+
+    FILE *f = fopen( filename, "wb" );
+    if ( !f )
+    {
+        return false;
+    }
+
+    bool ok = true;
+    uint64_t written = 0;
+    auto write_block = [&]( uint64_t block_offset, const void *data, uint64_t size )
+    {
+        if ( size == 0 )
+        {
+            return;
+        }
+        local_persist const char padding[MESH_FILE_ALIGNMENT] = {};
+        ok = ok && ( fwrite( padding, 1, (size_t)( block_offset - written ), f ) == block_offset - written );
+        ok = ok && ( fwrite( data, 1, (size_t)size, f ) == size );
+        written = block_offset + size;
+    };
+    write_block( 0, &h, sizeof(h) );
+    write_block( h.positions_offset, mesh->positions, h.nb_positions * sizeof(vec3) );
+    write_block( h.normals_offset, mesh->normals, h.nb_normals * sizeof(vec3) );
+    write_block( h.uvs_offset, mesh->uvs, h.nb_uvs * 2 * sizeof(float) );
+    write_block( h.corners_offset, corners.data(), h.nb_triangles * 3 * sizeof(mesh_corner) );
+    write_block( h.bvh_offset, bvh ? bvh->node_array : nullptr, h.nb_bvh_nodes * sizeof(linear_bvh_node) );
+    write_block( h.triangles_offset, triangle_data.data(), triangle_data.size() * sizeof(float) );
+    ok = ( fclose( f ) == 0 ) && ok;
+    return ok;
+}
+
+#endif // _RAYTRACER_MESH_FILE_H_
@@ -0,0 +1,198 @@
+#ifndef _RAYTRACER_PACKET_H_
+#define _RAYTRACER_PACKET_H_
+
+// Packets of coherent primary rays (one sample of a 4x4 pixels block)
+// traced through the linear bvh together: a node is fetched once per packet,
+// first tested against the packet bounds (interval arithmetic over the
+// origins and inverse directions), then ray by ray from the first ray still
+// active. Secondary bounces are incoherent, they stay single rays.
+
+const int PACKET_WIDTH = 4;
+const int MAX_PACKET_SIZE = PACKET_WIDTH * PACKET_WIDTH;
+
+struct ray_packet
+{
+    ray rays[MAX_PACKET_SIZE];
+    int nb_rays = 0;
+    // same octant and finite inverse directions, the bounds below are set.
+    bool coherent = false;
+    vec3 origin_min;
+    vec3 origin_max;
+    vec3 inv_dir_min;
+    vec3 inv_dir_max;
+};
+
+// call once the rays are set.
+inline void init_packet_bounds( ray_packet &p )
+{
+    p.coherent = p.nb_rays > 0;
+    for ( int a = 0; a < 3; ++a )
+    {
+        p.origin_min[a] = p.origin_max[a] = p.rays[0]._origin[a];
+        p.inv_dir_min[a] = p.inv_dir_max[a] = p.rays[0].inv_direction()[a];
+    }
+
+    for ( int k = 0; k < p.nb_rays; ++k )
+    {
+        const ray &r = p.rays[k];
+        p.coherent = p.coherent && ( r.octant() == p.rays[0].octant() );
+        for ( int a = 0; a < 3; ++a )
+        {
+            float inv_dir = r.inv_direction()[a];
+            p.coherent = p.coherent && ( fabsf( inv_dir ) < FLT_MAX );
+            p.origin_min[a] = ffmin( p.origin_min[a], r._origin[a] );
+            p.origin_max[a] = ffmax( p.origin_max[a], r._origin[a] );
+            p.inv_dir_min[a] = ffmin( p.inv_dir_min[a], inv_dir );
+            p.inv_dir_max[a] = ffmax( p.inv_dir_max[a], inv_dir );
+        }
+    }
+}
+
+// [lo, hi] of a * b for a in [a0, a1] and b in [b0, b1].
+inline void interval_mul( float a0, float a1, float b0, float b1, float &lo, float &hi )
+{
+    float p0 = a0 * b0;
+    float p1 = a0 * b1;
+    float p2 = a1 * b0;
+    float p3 = a1 * b1;
+    lo = ffmin( ffmin( p0, p1 ), ffmin( p2, p3 ) );
+    hi = ffmax( ffmax( p0, p1 ), ffmax( p2, p3 ) );
+}
+
+// false when no ray of a coherent packet can hit the box in [t_min, t_max].
+// Rounding is monotonic, so the bounds hold for the per ray float slabs too.
+inline bool packet_may_hit( const ray_packet &p, const vec3 &bmin, const vec3 &bmax, float t_min, float t_max )
+{
+    for ( int a = 0; a < 3; ++a )
+    {
+        float near_plane = p.rays[0].sign( a ) ? bmax[a] : bmin[a];
+        float far_plane = p.rays[0].sign( a ) ? bmin[a] : bmax[a];
+        float near_lo, near_hi, far_lo, far_hi;
+        interval_mul( near_plane - p.origin_max[a], near_plane - p.origin_min[a],
+                      p.inv_dir_min[a], p.inv_dir_max[a], near_lo, near_hi );
+        interval_mul( far_plane - p.origin_max[a], far_plane - p.origin_min[a],
+                      p.inv_dir_min[a], p.inv_dir_max[a], far_lo, far_hi );
+        t_min = ffmax( t_min, near_lo );
+        t_max = ffmin( t_max, far_hi * SLAB_FAR_SCALE );
+    }
+    return t_min < t_max;
+}
+
+// Closest hit of every ray in [t_min, rays[k].t_max], hits[k] tells if
+// recs[k] is set. Same results as bvh.hit() ray by ray.
+void hit_packet( const linear_bvh &bvh, const ray_packet &p, float t_min, hit_record *recs, bool *hits )
+{
+    float closest[MAX_PACKET_SIZE];
+    float s[MAX_PACKET_SIZE];
+    float max_closest = t_min;
+    for ( int k = 0; k < p.nb_rays; ++k )
+    {
+        hits[k] = false;
+        closest[k] = p.rays[k].t_max;
+        s[k] = ( bvh.time1 > bvh.time0 ) ? ( p.rays[k].time() - bvh.time0 ) / ( bvh.time1 - bvh.time0 ) : 0.0f;
+        max_closest = ffmax( max_closest, closest[k] );
+    }
+
+    if ( bvh.nb_nodes == 0 )
+    {
+        return;
+    }
+
+    if ( !p.coherent )
+    {
+        for ( int k = 0; k < p.nb_rays; ++k )
+        {
+            hits[k] = bvh.hit( p.rays[k], t_min, closest[k], recs[k] );
+        }
+        return;
+    }
+
+    struct stack_entry
+    {
+        uint32_t index;
+        int first; // rays before it missed an ancestor
+    };
+
+    const int max_stack_size = 64;
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size].index = 0;
+    stack[stack_size].first = 0;
+    ++stack_size;
+
+    while ( stack_size > 0 )
+    {
+        stack_entry e = stack[--stack_size];
+        const linear_bvh_node &node = bvh.node_array[e.index];
+
+        // moving nodes: the swept box holds every interpolated one
+        vec3 bmin = node.bmin;
+        vec3 bmax = node.bmax;
+        if ( node.flags & LINEAR_BVH_MOVING )
+        {
+            const linear_bvh_motion &m = bvh.motion[e.index];
+            for ( int a = 0; a < 3; ++a )
+            {
+                bmin[a] = ffmin( bmin[a], m.bmin[a] );
+                bmax[a] = ffmax( bmax[a], m.bmax[a] );
+            }
+        }
+
+        if ( !packet_may_hit( p, bmin, bmax, t_min, max_closest ) )
+        {
+            ++tl_stats.nb_culled_nodes;
+            continue;
+        }
+
+        int first = e.first;
+        float t_entry;
+        while ( first < p.nb_rays && !bvh.node_hit( e.index, s[first], p.rays[first], t_min, closest[first], t_entry ) )
+        {
+            ++first;
+        }
+        if ( first == p.nb_rays )
+        {
+            continue;
+        }
+        ++tl_stats.nb_node_visits;
+
+        if ( node.nb_prims > 0 )
+        {
+            // the rays in the leaf box go through its primitives together
+            int ids[MAX_PACKET_SIZE];
+            int nb_ids = 0;
+            for ( int k = first; k < p.nb_rays; ++k )
+            {
+                if ( k == first || bvh.node_hit( e.index, s[k], p.rays[k], t_min, closest[k], t_entry ) )
+                {
+                    ids[nb_ids++] = k;
+                }
+            }
+            bvh.hit_leaf_rays( node, p.rays, ids, nb_ids, t_min, closest, recs, hits );
+            max_closest = t_min;
+            for ( int k = 0; k < p.nb_rays; ++k )
+            {
+                max_closest = ffmax( max_closest, closest[k] );
+            }
+            continue;
+        }
+
+        // all rays share the octant, the near child is the same for all of them
+        uint32_t near_index = e.index + 1;
+        uint32_t far_index = node.offset;
+        if ( p.rays[0].sign( node.axis ) )
+        {
+            std::swap( near_index, far_index );
+        }
+
+        assert( stack_size + 2 <= max_stack_size );
+        stack[stack_size].index = far_index;
+        stack[stack_size].first = first;
+        ++stack_size;
+        stack[stack_size].index = near_index;
+        stack[stack_size].first = first;
+        ++stack_size;
+    }
+}
+
+#endif // _RAYTRACER_PACKET_H_
@@ -3,6 +3,7 @@
  
  struct pdf
  {
+     virtual ~pdf() {}
      virtual float value( const vec3 &direction ) const = 0;
      virtual vec3 generate() const = 0;
  };
@@ -28,6 +28,20 @@
          return true;
      }
      
+     virtual bool occluded(const ray &r, float t0, float t1) const override
+     {
+         float t = (z - r.origin().z()) / r.direction().z();
+         if ( t < t0 || t > t1 )
+         {
+             return false;
+         }
+         float x = r.origin().x() + t * r.direction().x();
+         float y = r.origin().y() + t * r.direction().y();
+         return x >= x0 && x <= x1 && y >= y0 && y <= y1;
+     }
+     
+     virtual int kind() const override { return HITABLE_XY_RECT; }
+     
      virtual bool bounding_box(float t0, float t1, aabb &box) const override
      {
          // small thickness
@@ -66,6 +80,20 @@
          return true;
      }
      
+     virtual bool occluded(const ray &r, float t0, float t1) const override
+     {
+         float t = (y - r.origin().y()) / r.direction().y();
+         if ( t < t0 || t > t1 )
+         {
+             return false;
+         }
+         float x = r.origin().x() + t * r.direction().x();
+         float z = r.origin().z() + t * r.direction().z();
+         return x >= x0 && x <= x1 && z >= z0 && z <= z1;
+     }
+     
+     virtual int kind() const override { return HITABLE_XZ_RECT; }
+     
      virtual bool bounding_box(float t0, float t1, aabb &box) const override
      {
          // small thickness
@@ -75,13 +103,13 @@
      
      virtual float pdf_value( const vec3 &o, const vec3 &v ) const 
      { 
-         hit_record rec;
          // si le rayon que tu m'as file me touche bien
-         if ( this->hit( ray(o,v), 0.0001f, FLT_MAX, rec) )
+         if ( this->occluded( ray(o,v), 0.0001f, FLT_MAX ) )
          {
+             float t = (y - o.y()) / v.y();
              float area = (x1-x0)*(z1-z0);
-             float distance_squared = rec.t * rec.t * v.squared_length();
-             float cosine = fabsf( dot( v, rec.normal ) / v.length() );
+             float distance_squared = t * t * v.squared_length();
+             float cosine = fabsf( v.y() / v.length() );
              return distance_squared / ( cosine * area );
          }
          else
@@ -128,6 +156,20 @@
          return true;
      }
      
+     virtual bool occluded(const ray &r, float t0, float t1) const override
+     {
+         float t = (x - r.origin().x()) / r.direction().x();
+         if ( t < t0 || t > t1 )
+         {
+             return false;
+         }
+         float z = r.origin().z() + t * r.direction().z();
+         float y = r.origin().y() + t * r.direction().y();
+         return z >= z0 && z <= z1 && y >= y0 && y <= y1;
+     }
+     
+     virtual int kind() const override { return HITABLE_YZ_RECT; }
+     
      virtual bool bounding_box(float t0, float t1, aabb &box) const override
      {
          // small thickness
@@ -139,5 +181,138 @@
      float z0, z1, y0, y1, x;
  };
  
+ // Parallelogram q + a * u + b * v, a and b in [0,1], with a given normal:
+ // the scene compile pass (compile.h) bakes transformed or flipped rects into it.
+ struct quad : public hitable
+ {
+     quad() {}
+     quad(const vec3 &_q, const vec3 &_u, const vec3 &_v, const vec3 &n, material *mat) :
+     mat_ptr(mat), q(_q), u(_u), v(_v), normal(n)
+     {
+         vec3 c = cross(u, v);
+         w = c / dot(c, c);
+         plane_normal = unit_vector(c);
+         d = dot(plane_normal, q);
+     }
+     
+     virtual bool hit(const ray &r, float t0, float t1, hit_record &rec) const override
+     {
+         float t = (d - dot(plane_normal, r.origin())) / dot(plane_normal, r.direction());
+         if ( !( t >= t0 && t <= t1 ) ) // NaN too: parallel ray in the plane
+         {
+             return false;
+         }
+         vec3 p = r.point_at_parameter(t);
+         vec3 h = p - q;
+         float a = dot(w, cross(h, v));
+         float b = dot(w, cross(u, h));
+         if ( !( a >= 0.0f && a <= 1.0f && b >= 0.0f && b <= 1.0f ) )
+         {
+             return false;
+         }
+         rec.u = a;
+         rec.v = b;
+         rec.t = t;
+         rec.mat_ptr = mat_ptr;
+         rec.p = p;
+         rec.normal = normal;
+         return true;
+     }
+     
+     virtual bool occluded(const ray &r, float t0, float t1) const override
+     {
+         float t = (d - dot(plane_normal, r.origin())) / dot(plane_normal, r.direction());
+         if ( !( t >= t0 && t <= t1 ) )
+         {
+             return false;
+         }
+         vec3 h = r.point_at_parameter(t) - q;
+         float a = dot(w, cross(h, v));
+         float b = dot(w, cross(u, h));
+         return a >= 0.0f && a <= 1.0f && b >= 0.0f && b <= 1.0f;
+     }
+     
+     virtual bool bounding_box(float t0, float t1, aabb &box) const override
+     {
+         // small thickness, like the rects
+         vec3 corners[3] = { q + u, q + v, q + u + v };
+         vec3 bmin = q;
+         vec3 bmax = q;
+         for ( int i = 0; i < 3; ++i )
+         {
+             for ( int a = 0; a < 3; ++a )
+             {
+                 bmin[a] = ffmin(bmin[a], corners[i][a]);
+                 bmax[a] = ffmax(bmax[a], corners[i][a]);
+             }
+         }
+         vec3 pad(0.0001f, 0.0001f, 0.0001f);
+         box = aabb(bmin - pad, bmax + pad);
+         return true;
+     }
+     
+     material *mat_ptr;
+     vec3 q, u, v;
+     vec3 normal;       // shading normal, flipped or not
+     vec3 plane_normal; // unit cross(u, v)
+     vec3 w;            // cross(u, v) / |cross(u, v)|^2, for the a, b coordinates
+     float d;
+ };
+ 
+ // Infinite plane through point, hit from both sides. No bounds: it stays
+ // out of the bvh, next to it in a scene_root. uv repeat every 1/uv_scale
+ // units along the plane.
+ struct infinite_plane : public hitable
+ {
+     infinite_plane( const vec3 &p, const vec3 &n, material *mat, float scale = 1.0f ) :
+     point(p), normal(unit_vector(n)), uv_scale(scale), mat_ptr(mat)
+     {
+         frame.build_from_w( normal );
+     }
+     
+     virtual bool hit(const ray &r, float t0, float t1, hit_record &rec) const override
+     {
+         float denom = dot( r.direction(), normal );
+         if ( denom == 0.0f )
+         {
+             return false;
+         }
+         float t = dot( point - r.origin(), normal ) / denom;
+         if ( t < t0 || t > t1 )
+         {
+             return false;
+         }
+         rec.t = t;
+         rec.p = r.point_at_parameter(t);
+         vec3 local = rec.p - point;
+         float u = uv_scale * dot( local, frame.u() );
+         float v = uv_scale * dot( local, frame.v() );
+         rec.u = u - floorf(u);
+         rec.v = v - floorf(v);
+         rec.normal = normal;
+         rec.mat_ptr = mat_ptr;
+         return true;
+     }
+     
+     virtual bool occluded(const ray &r, float t0, float t1) const override
+     {
+         float denom = dot( r.direction(), normal );
+         if ( denom == 0.0f )
+         {
+             return false;
+         }
+         float t = dot( point - r.origin(), normal ) / denom;
+         return t >= t0 && t <= t1;
+     }
+     
+     virtual bool bounding_box(float t0, float t1, aabb &box) const override { return false; }
+     virtual int kind() const override { return HITABLE_INFINITE_PLANE; }
+     
+     vec3 point;
+     vec3 normal;
+     onb frame;
+     float uv_scale;
+     material *mat_ptr;
+ };
+ 
 #endif // _RAYTRACER_PLANES_H_
- 
\ No newline at end of file
@@ -1,22 +1,45 @@
  #ifndef _RAYTRACER_RAY_H_
 #define _RAYTRACER_RAY_H_
  
+ // The traversal data is cached at construction: inverse direction (+/-inf
+ // on a zero component), direction sign per axis and its octant (bit a set
+ // when the direction is negative on axis a), and the end of the ray segment.
  struct ray
  {
      ray(){}
-     ray( const vec3 &o, const vec3 &d, float t = 0.0f ) 
-         : _origin(o), _direction(d), _time(t) {}
+     ray( const vec3 &o, const vec3 &d, float t = 0.0f, float tmax = FLT_MAX ) 
+         : _origin(o), _direction(d), _time(t), t_max(tmax)
+     {
+         _octant = 0;
+         for ( int a = 0; a < 3; ++a )
+         {
+             _inv_direction[a] = 1.0f / d[a];
+             _sign[a] = _inv_direction[a] < 0.0f ? 1 : 0;
+             _octant |= _sign[a] << a;
+         }
+     }
      
      vec3 origin() const { return _origin;}
      vec3 direction() const { return _direction;}
      float time() const { return _time; }
      
+     const vec3 &inv_direction() const { return _inv_direction; }
+     const int *sign() const { return _sign; }
+     int sign( int a ) const { return _sign[a]; }
+     int octant() const { return _octant; }
+     
+     // same direction from another origin, keeps the cached data.
+     ray moved( const vec3 &o ) const { ray r = *this; r._origin = o; return r; }
+     
      vec3 point_at_parameter( float t ) const { return _origin + t * _direction; }
      
      vec3 _origin;
      vec3 _direction;
      float _time;
+     vec3 _inv_direction;
+     int _sign[3];
+     int _octant;
+     float t_max;
  };
  
 #endif // _RAYTRACER_RAY_H_
- 
\ No newline at end of file
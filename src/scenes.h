@@ -1,12 +1,18 @@
 #ifndef _RAYTRACER_SCENES_H
 #define _RAYTRACER_SCENES_H
 
-//hitable *mega_big_scene_end_of_book1();
-//hitable *mega_big_scene_end_of_book2();
+void mega_big_scene_end_of_book1( hitable **scene, hitable **important_hitables, camera **cam, float aspect );
+void mega_big_scene_end_of_book2( hitable **scene, hitable **important_hitables, camera **cam, float aspect );
 //hitable *simple_scene();
 //hitable *another_simple();
 //hitable *two_perlin_spheres();
 void cornell_box( hitable **scene, hitable **important_hitables, camera **cam, float aspect );
+void cornell_motion( hitable **scene, hitable **important_hitables, camera **cam, float aspect );
+void many_spheres( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n );
+void sphere_cloud_scene( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n );
+void terrain( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n );
+void sdf_scene( hitable **scene, hitable **important_hitables, camera **cam, float aspect );
+bool mesh_scene( hitable **scene, hitable **important_hitables, camera **cam, float aspect, const char *filename, thread_pool *pool );
 //hitable *cornell_box_volumes();
 
 
@@ -31,14 +37,14 @@ camera cam(
 
 
 
-/*
-hitable *mega_big_scene_end_of_book1()
+void mega_big_scene_end_of_book1( hitable **scene, hitable **important_hitables, camera **cam, float aspect )
 {
     int n = 500;
     int surf_radius = ((int)sqrtf((float)n)) / 2 - 1;
     
-    hitable **list = new hitable*[n+1];
-    list[0] = new sphere(vec3(0,-1000,0), 1000, new lambertian(new constant_texture(vec3(0.5,0.5,0.5))));
+    hitable **list = new hitable*[n+5];
+    hitable **imp_list = new hitable*[1];
+    list[0] = new infinite_plane(vec3(0,0,0), vec3(0,1,0), new lambertian(new constant_texture(vec3(0.5,0.5,0.5))));
     int i = 1;
     for( int a = -surf_radius; a < surf_radius; ++a )
     {
@@ -80,10 +86,17 @@ hitable *mega_big_scene_end_of_book1()
     list[i++] = new sphere(vec3(-4.0f,1.0f,0.0f),1.0f, new lambertian(new constant_texture(vec3(0.4f, 0.2f, 0.1f))));
     list[i++] = new sphere(vec3(4.0f,1.0f,0.0f),1.0f, new metal(new constant_texture(vec3(0.7f, 0.6f, 0.5f)), 0.0f));
     
-    return new hitable_list(list, i);
+    // no sky, so light it from above (out of frame).
+    list[i++] = new sphere(vec3(0.0f,10.0f,0.0f), 3.0f, new diffuse_light(new constant_texture(vec3(8,8,7))));
+    imp_list[0] = list[i-1];
     
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list(list, i);
+    *cam = new camera(vec3( 13.0f, 2.0f, 3.0f ), 
+                      vec3( 0.0f, 0.0f, 0.0f ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      20.0f, aspect, 0.1f, 10.0f, 0.0f, 1.0f );
 }
-*/
 
 // SIMPLE SCENE
 /*
@@ -197,6 +210,236 @@ void cornell_box( hitable **scene, hitable **important_hitables, camera **cam, f
                       40.0f, aspect, 0.0f, 800.0f, 0.0f, 1.0f );
 }
 
+// the cornell box with the big box spinning away while the shutter is open.
+void cornell_motion( hitable **scene, hitable **important_hitables, camera **cam, float aspect )
+{
+    cornell_box( scene, important_hitables, cam, aspect );
+    
+    hitable_list *l = (hitable_list*)*scene;
+    material *aluminium = new metal( new constant_texture(vec3( 0.8f, 0.85f, 0.88f )), 0.0f );
+    hitable *big_box = new box( vec3( -82.5f, -165.0f, -82.5f ), vec3( 82.5f, 165.0f, 82.5f ), aluminium );
+    std::vector<transform_key> keys;
+    keys.push_back( make_transform_key( vec3( 340, 165, 375 ), vec3( 0, 1, 0 ), 15.0f ) );
+    keys.push_back( make_transform_key( vec3( 360, 175, 380 ), vec3( 0, 1, 0 ), 35.0f ) );
+    keys.push_back( make_transform_key( vec3( 385, 190, 385 ), vec3( 0, 1, 0 ), 55.0f, vec3( 0.9f, 0.9f, 0.9f ) ) );
+    keys.push_back( make_transform_key( vec3( 415, 210, 390 ), vec3( 0, 1, 0 ), 75.0f, vec3( 0.8f, 0.8f, 0.8f ) ) );
+    l->list[l->list_size - 1] = new motion_transform( big_box, keys );
+}
+
+// MANY SPHERES -------------------------------------------------------
+// n small spheres in a cube, for build and traversal timings on big scenes.
+void many_spheres( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n )
+{
+    hitable **list = new hitable*[n+2];
+    hitable **imp_list = new hitable*[1];
+    
+    material *white = new lambertian( new constant_texture(vec3(0.73f,0.73f,0.73f)));
+    material *light = new diffuse_light( new constant_texture(vec3(7,7,7)));
+    
+    // keep the density (and the look) about the same whatever n is
+    float size = 100.0f * cbrtf( (float)n / 1000.0f );
+    float radius = 2.0f;
+    
+    int i = 0;
+    for ( int j = 0; j < n; ++j )
+    {
+        list[i++] = new sphere(vec3(size*RAN01(), size*RAN01(), size*RAN01()), radius, white );
+    }
+    
+    list[i++] = new sphere(vec3(0.5f*size, 2.0f*size, 0.5f*size), 0.25f*size, light);
+    imp_list[0] = list[i-1];
+    
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list( list, i );
+    *cam = new camera(vec3( 0.5f*size, 0.5f*size, -1.5f*size ), 
+                      vec3( 0.5f*size, 0.5f*size, 0.5f*size ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      40.0f, aspect, 0.0f, 2.0f*size, 0.0f, 1.0f );
+}
+
+// CLOUD --------------------------------------------------------------
+// the spheres scene as one sphere_cloud, small enough per sphere for tens of millions.
+void sphere_cloud_scene( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n )
+{
+    hitable **list = new hitable*[2];
+    hitable **imp_list = new hitable*[1];
+    
+    material *light = new diffuse_light( new constant_texture(vec3(7,7,7)));
+    
+    sphere_cloud *cloud = new sphere_cloud();
+    cloud->materials.push_back( new lambertian( new constant_texture(vec3(0.73f,0.73f,0.73f))) );
+    cloud->materials.push_back( new lambertian( new constant_texture(vec3(0.65f,0.05f,0.05f))) );
+    cloud->materials.push_back( new lambertian( new constant_texture(vec3(0.12f,0.45f,0.15f))) );
+    cloud->materials.push_back( new metal( new constant_texture(vec3(0.8f,0.8f,0.9f)), 0.1f ) );
+    
+    float size = 100.0f * cbrtf( (float)n / 1000.0f );
+    float radius = 2.0f;
+    
+    cloud->reserve( n );
+    for ( int j = 0; j < n; ++j )
+    {
+        vec3 center( size*RAN01(), size*RAN01(), size*RAN01() );
+        cloud->add( center, radius, (uint8_t)( j % cloud->materials.size() ) );
+    }
+    cloud->build();
+    
+    list[0] = cloud;
+    list[1] = new sphere(vec3(0.5f*size, 2.0f*size, 0.5f*size), 0.25f*size, light);
+    imp_list[0] = list[1];
+    
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list( list, 2 );
+    *cam = new camera(vec3( 0.5f*size, 0.5f*size, -1.5f*size ), 
+                      vec3( 0.5f*size, 0.5f*size, 0.5f*size ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      40.0f, aspect, 0.0f, 2.0f*size, 0.0f, 1.0f );
+}
+
+// TERRAIN ------------------------------------------------------------
+// a smooth heightfield of about n cells of perlin turbulence, always 1000x1000 wide.
+void terrain( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n )
+{
+    hitable **list = new hitable*[2];
+    hitable **imp_list = new hitable*[1];
+    
+    material *ground = new lambertian( new constant_texture(vec3(0.48f,0.53f,0.38f)));
+    material *light = new diffuse_light( new constant_texture(vec3(7,7,7)));
+    
+    int side = (int)sqrtf( (float)n );
+    side = ( side < 1 ) ? 1 : side;
+    float cell = 1000.0f / side;
+    perlin noise;
+    std::vector<float> heights( ( side + 1 ) * ( side + 1 ) );
+    for ( int j = 0; j <= side; ++j )
+    {
+        for ( int i = 0; i <= side; ++i )
+        {
+            heights[j * ( side + 1 ) + i] = 120.0f * noise.turb( vec3( i * cell * 0.004f, 0.5f, j * cell * 0.004f ), 8 );
+        }
+    }
+    
+    list[0] = new heightfield( HEIGHTFIELD_SMOOTH, side, side, vec3( 0.0f, 0.0f, 0.0f ), cell, cell, std::move( heights ), ground );
+    list[1] = new sphere( vec3( 300.0f, 1500.0f, 700.0f ), 400.0f, light );
+    imp_list[0] = list[1];
+    
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list( list, 2 );
+    *cam = new camera(vec3( 500.0f, 300.0f, -250.0f ), 
+                      vec3( 500.0f, 40.0f, 500.0f ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      45.0f, aspect, 0.0f, 800.0f, 0.0f, 1.0f );
+}
+
+// SDF ----------------------------------------------------------------
+// the cornell box with two distance fields: a Menger sponge and a torus
+// blended with a sphere (glass, marched from the inside too).
+void sdf_scene( hitable **scene, hitable **important_hitables, camera **cam, float aspect )
+{
+    hitable **list = new hitable*[8];
+    hitable **imp_list = new hitable*[1];
+    
+    int i = 0;
+    material *red   = new lambertian( new constant_texture(vec3(0.65f,0.05f,0.05f)));
+    material *white = new lambertian( new constant_texture(vec3(0.73f,0.73f,0.73f)));
+    material *green = new lambertian( new constant_texture(vec3(0.12f,0.45f,0.15f)));
+    material *light = new diffuse_light( new constant_texture(vec3(15,15,15)));
+    material *glass = new dielectric( 1.5f );
+    
+    list[i++] = new flip_normals(new yz_rect(0,555,0,555,555, green)); // left
+    list[i++] = new yz_rect(0,555,0,555,  0, red);                     // right
+    list[i++] = new flip_normals(new xz_rect(0,555,0,555,555, white)); // top
+    list[i++] = new xz_rect(213,343,227,332,554, light);               // light
+    imp_list[0] = list[i-1];
+    list[i++] = new xz_rect(0,555,0,555,0, white);                     // bottom
+    list[i++] = new flip_normals(new xy_rect(0,555,0,555,555, white)); // back
+    
+    sdf *sponge = new sdf_menger( vec3( 370.0f, 111.0f, 330.0f ), 110.0f, 4 );
+    list[i++] = new sdf_object( sponge, aabb( vec3( 259.0f, 0.0f, 219.0f ), vec3( 481.0f, 222.0f, 441.0f ) ),
+                                white, 256, 1.0f, 0.01f );
+    
+    // the blend grows the union by k / 4 at most
+    sdf *ring = new sdf_torus( vec3( 170.0f, 60.0f, 170.0f ), 80.0f, 25.0f );
+    sdf *ball = new sdf_sphere( vec3( 170.0f, 130.0f, 170.0f ), 60.0f );
+    sdf *blend = new sdf_smooth_union( ring, ball, 30.0f );
+    list[i++] = new sdf_object( blend, aabb( vec3( 55.0f, 25.0f, 55.0f ), vec3( 285.0f, 200.0f, 285.0f ) ),
+                                glass, SDF_MAX_STEPS, 1.0f, 0.01f );
+    
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list( list, i );
+    *cam = new camera(vec3( 278.0f, 278.0f, -800.0f ), 
+                      vec3( 278.0f, 278.0f, 278.0f ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      40.0f, aspect, 0.0f, 800.0f, 0.0f, 1.0f );
+}
+
+// FOREST -------------------------------------------------------------
+// n instances of two shared trees, to check that memory follows the unique geometry.
+hitable *make_tree_blas( material *trunk, material *leaves, int nb_leaves )
+{
+    hitable **list = new hitable*[nb_leaves + 4];
+    int i = 0;
+    for ( int j = 0; j < 4; ++j )
+    {
+        list[i++] = new sphere( vec3( 0.0f, 0.15f + 0.25f * j, 0.0f ), 0.15f, trunk );
+    }
+    
+    // cone of leaves
+    for ( int j = 0; j < nb_leaves; ++j )
+    {
+        float h = RAN01();
+        float r = 0.8f * ( 1.0f - h ) * sqrtf( RAN01() );
+        float phi = 2.0f * PI * RAN01();
+        vec3 center( r * cosf( phi ), 1.0f + 2.0f * h, r * sinf( phi ) );
+        list[i++] = new sphere( center, 0.25f, leaves );
+    }
+    
+    return make_blas( list, i, 0.0f, 1.0f );
+}
+
+void forest( hitable **scene, hitable **important_hitables, camera **cam, float aspect, int n )
+{
+    hitable **list = new hitable*[3];
+    hitable **imp_list = new hitable*[1];
+    
+    material *ground = new lambertian( new constant_texture(vec3(0.35f,0.3f,0.2f)));
+    material *trunk = new lambertian( new constant_texture(vec3(0.3f,0.2f,0.1f)));
+    material *leaves = new lambertian( new constant_texture(vec3(0.1f,0.4f,0.1f)));
+    material *autumn = new lambertian( new constant_texture(vec3(0.6f,0.3f,0.05f)));
+    material *light = new diffuse_light( new constant_texture(vec3(10,10,9)));
+    
+    hitable *blas[2] = 
+    {
+        make_tree_blas( trunk, leaves, 150 ),
+        make_tree_blas( trunk, leaves, 60 ),
+    };
+    
+    // about 3x3 per tree
+    float half_size = 1.5f * sqrtf( (float)n );
+    instance **instances = new instance*[n];
+    for ( int j = 0; j < n; ++j )
+    {
+        vec3 position( half_size * ( 2.0f * RAN01() - 1.0f ), 0.0f, half_size * ( 2.0f * RAN01() - 1.0f ) );
+        mat34 m = 
+            mat34_translation( position ) * 
+            mat34_rotation( vec3( 0.0f, 1.0f, 0.0f ), 360.0f * RAN01() ) * 
+            mat34_scale( vec3( 1.0f, 1.0f, 1.0f ) * ( 0.7f + 0.6f * RAN01() ) );
+        instances[j] = new instance( blas[j % 2], m, ( RAN01() < 0.1f ) ? autumn : nullptr );
+    }
+    
+    int i = 0;
+    list[i++] = new tlas( instances, n, 0.0f, 1.0f );
+    list[i++] = new xz_rect( -half_size - 10.0f, half_size + 10.0f, -half_size - 10.0f, half_size + 10.0f, 0.0f, ground );
+    list[i++] = new sphere( vec3( 0.0f, 3.0f * half_size + 100.0f, 0.0f ), half_size + 30.0f, light );
+    imp_list[0] = list[i-1];
+    
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list( list, i );
+    *cam = new camera(vec3( 0.0f, 6.0f, -half_size ), 
+                      vec3( 0.0f, 2.0f, 0.0f ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      50.0f, aspect, 0.0f, 10.0f, 0.0f, 1.0f );
+}
+
 // CORNELL BOX VOLUMES --------------------------------------------------
 
 /*
@@ -230,40 +473,34 @@ hitable *cornell_box_volumes()
 
 // MEGA BIG SCENE END OF BOOK 2 -----------------------------------------
 
-/*
-hitable *mega_big_scene_end_of_book2()
+void mega_big_scene_end_of_book2( hitable **scene, hitable **important_hitables, camera **cam, float aspect )
 {
     hitable **list = new hitable*[30];
-    hitable **boxlist = new hitable*[400];
+    hitable **imp_list = new hitable*[1];
     hitable **boxlist2 = new hitable*[1000];
     
     material *white  = new lambertian( new constant_texture(vec3(0.73f,0.73f,0.73f)));
     material *ground = new lambertian( new constant_texture(vec3(0.48f,0.83f,0.53f)));
     
-    // 20x20 floor of boxes of 100x100xrandom_height
+    // 20x20 floor of columns of 100x100xrandom_height
     int nb = 20;
-    int b = 0; // total_nb_boxes
+    std::vector<float> heights( nb * nb );
     for ( int i = 0; i < nb; ++i )
     {
         for ( int j = 0; j < nb; ++j )
         {
-            float w = 100.0f;
-            float x0 = -1000.0f + i * w;
-            float z0 = -1000.0f + j * w;
-            float y0 = 0.0f;
-            float x1 = x0 + w;
-            float y1 = 100.0f * ( RAN01() + 0.01f );
-            float z1 = z0 + w;
-            boxlist[b++] = new box( vec3(x0, y0, z0), vec3(x1, y1, z1), ground );
+            heights[j * nb + i] = 100.0f * ( RAN01() + 0.01f );
         }
     }
     
     int l = 0;
-    list[l++] = new bvh_node( boxlist, b, 0.0f, 1.0f );
+    list[l++] = new heightfield( HEIGHTFIELD_COLUMNS, nb, nb, vec3( -1000.0f, 0.0f, -1000.0f ), 100.0f, 100.0f,
+                                 std::move( heights ), ground );
     
     // cornell light
     material *light = new diffuse_light( new constant_texture(vec3(7,7,7)));
     list[l++] = new xz_rect(123, 423, 147, 412, 554, light);
+    imp_list[0] = list[l-1];
     
     // motion blurred sphere
     vec3 center(400,400,200);
@@ -294,7 +531,9 @@ hitable *mega_big_scene_end_of_book2()
     // textured sphere
     int nx, ny, nn;
     unsigned char *tex_data = stbi_load("../data/earth.jpg", &nx, &ny, &nn, 0);
-    material *emat = new lambertian(new image_texture(tex_data, nx, ny));
+    material *emat = tex_data ?
+        new lambertian(new image_texture(tex_data, nx, ny)) :
+        new lambertian(new constant_texture(vec3(0.2f, 0.3f, 0.7f)));
     list[l++] = new sphere(vec3(400,200,400), 100, emat);
     
     // noise sphere
@@ -309,9 +548,61 @@ hitable *mega_big_scene_end_of_book2()
     }
     list[l++] = new translate( new rotate_y( new bvh_node(boxlist2, ns, 0.0f, 1.0f), 15.0f), vec3(-100.0f,270.0f,395.0f));
     
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list(list, l);
+    *cam = new camera(vec3( 478.0f, 278.0f, -600.0f ), 
+                      vec3( 278.0f, 278.0f, 0.0f ), 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      40.0f, aspect, 0.0f, 800.0f, 0.0f, 1.0f );
+}
+
+// MESH ---------------------------------------------------------------
+// an .obj or .rtm (see mesh_convert) mesh on a floor, framed from the
+// front (+z) of its bounds.
+bool mesh_scene( hitable **scene, hitable **important_hitables, camera **cam, float aspect, const char *filename, thread_pool *pool )
+{
+    material *white = new lambertian( new constant_texture(vec3(0.73f,0.73f,0.73f)));
+    material *ground = new lambertian( new constant_texture(vec3(0.4f,0.4f,0.4f)));
+    material *light = new diffuse_light( new constant_texture(vec3(10,10,10)));
+    
+    size_t length = strlen( filename );
+    bool mapped = ( length > 4 ) && ( strcmp( filename + length - 4, ".rtm" ) == 0 );
+    triangle_mesh *mesh = mapped ? map_mesh_file( filename, white ) : load_obj( filename, white, pool );
+    if ( !mesh )
+    {
+        return false;
+    }
     
-    return new hitable_list(list, l);
+    aabb bounds = mesh->bounds();
+    vec3 center = 0.5f * ( bounds.min() + bounds.max() );
+    float size = ( bounds.max() - bounds.min() ).length();
+    
+    // a prebuilt bvh is kept whole, under the scene one
+    int n = mesh->bvh ? 1 : (int)mesh->triangles.size();
+    hitable **list = new hitable*[n+2];
+    hitable **imp_list = new hitable*[1];
+    
+    int i = 0;
+    if ( mesh->bvh )
+    {
+        list[i++] = mesh->bvh;
+    }
+    else
+    {
+        i = mesh->add_triangles( list, 0 );
+    }
+    list[i++] = new xz_rect( center.x() - 5.0f * size, center.x() + 5.0f * size, 
+                             center.z() - 5.0f * size, center.z() + 5.0f * size, bounds.min().y(), ground );
+    list[i++] = new sphere( center + vec3( 0.5f * size, 2.0f * size, 1.5f * size ), 0.5f * size, light );
+    imp_list[0] = list[i-1];
+    
+    *important_hitables = new hitable_list( imp_list, 1 );
+    *scene = new hitable_list( list, i );
+    *cam = new camera(center + vec3( 0.0f, 0.25f * size, 1.5f * size ), 
+                      center, 
+                      vec3( 0.0f, 1.0f, 0.0f ), 
+                      40.0f, aspect, 0.0f, 1.5f * size, 0.0f, 1.0f );
+    return true;
 }
-*/
 
 #endif //_RAYTRACER_SCENES_H
@@ -0,0 +1,545 @@
+#ifndef _RAYTRACER_SDF_H_
+#define _RAYTRACER_SDF_H_
+
+// Signed distance fields: shapes given by f(p), the distance from p to the
+// surface, negative inside. Rays sphere trace them inside a box around the
+// shape, stepping by f / lipschitz (no surface can be closer) until f gets
+// under epsilon. Fields are small trees of sdf nodes. Every node evaluates
+// one point (float) or SDF_LANES points at once (sdf_float), so that the
+// rays of a packet march together, one field evaluation for all of them.
+
+#if RAYTRACER_AVX
+const int SDF_LANES = 8;
+
+struct sdf_float
+{
+    sdf_float() {}
+    sdf_float( __m256 a ) : v(a) {}
+    sdf_float( float a ) : v(_mm256_set1_ps(a)) {}
+    static sdf_float load( const float *p ) { return _mm256_loadu_ps( p ); }
+    void store( float *p ) const { _mm256_storeu_ps( p, v ); }
+    __m256 v;
+};
+
+inline sdf_float operator+( sdf_float a, sdf_float b ) { return _mm256_add_ps( a.v, b.v ); }
+inline sdf_float operator-( sdf_float a, sdf_float b ) { return _mm256_sub_ps( a.v, b.v ); }
+inline sdf_float operator*( sdf_float a, sdf_float b ) { return _mm256_mul_ps( a.v, b.v ); }
+inline sdf_float operator/( sdf_float a, sdf_float b ) { return _mm256_div_ps( a.v, b.v ); }
+inline sdf_float operator-( sdf_float a ) { return _mm256_xor_ps( a.v, _mm256_set1_ps( -0.0f ) ); }
+inline sdf_float sdf_min( sdf_float a, sdf_float b ) { return _mm256_min_ps( a.v, b.v ); }
+inline sdf_float sdf_max( sdf_float a, sdf_float b ) { return _mm256_max_ps( a.v, b.v ); }
+inline sdf_float sdf_abs( sdf_float a ) { return _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a.v ); }
+inline sdf_float sdf_sqrt( sdf_float a ) { return _mm256_sqrt_ps( a.v ); }
+inline sdf_float sdf_floor( sdf_float a ) { return _mm256_floor_ps( a.v ); }
+
+#elif RAYTRACER_SSE
+const int SDF_LANES = 4;
+
+struct sdf_float
+{
+    sdf_float() {}
+    sdf_float( __m128 a ) : v(a) {}
+    sdf_float( float a ) : v(_mm_set1_ps(a)) {}
+    static sdf_float load( const float *p ) { return _mm_loadu_ps( p ); }
+    void store( float *p ) const { _mm_storeu_ps( p, v ); }
+    __m128 v;
+};
+
+inline sdf_float operator+( sdf_float a, sdf_float b ) { return _mm_add_ps( a.v, b.v ); }
+inline sdf_float operator-( sdf_float a, sdf_float b ) { return _mm_sub_ps( a.v, b.v ); }
+inline sdf_float operator*( sdf_float a, sdf_float b ) { return _mm_mul_ps( a.v, b.v ); }
+inline sdf_float operator/( sdf_float a, sdf_float b ) { return _mm_div_ps( a.v, b.v ); }
+inline sdf_float operator-( sdf_float a ) { return _mm_xor_ps( a.v, _mm_set1_ps( -0.0f ) ); }
+inline sdf_float sdf_min( sdf_float a, sdf_float b ) { return _mm_min_ps( a.v, b.v ); }
+inline sdf_float sdf_max( sdf_float a, sdf_float b ) { return _mm_max_ps( a.v, b.v ); }
+inline sdf_float sdf_abs( sdf_float a ) { return _mm_andnot_ps( _mm_set1_ps( -0.0f ), a.v ); }
+inline sdf_float sdf_sqrt( sdf_float a ) { return _mm_sqrt_ps( a.v ); }
+// no SSE4.1 round: truncate, then one less where that went up (negatives).
+inline sdf_float sdf_floor( sdf_float a )
+{
+    __m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32( a.v ) );
+    return _mm_sub_ps( t, _mm_and_ps( _mm_cmpgt_ps( t, a.v ), _mm_set1_ps( 1.0f ) ) );
+}
+
+#else
+const int SDF_LANES = 1;
+
+struct sdf_float
+{
+    sdf_float() {}
+    sdf_float( float a ) : v(a) {}
+    static sdf_float load( const float *p ) { return *p; }
+    void store( float *p ) const { *p = v; }
+    float v;
+};
+
+inline sdf_float operator+( sdf_float a, sdf_float b ) { return a.v + b.v; }
+inline sdf_float operator-( sdf_float a, sdf_float b ) { return a.v - b.v; }
+inline sdf_float operator*( sdf_float a, sdf_float b ) { return a.v * b.v; }
+inline sdf_float operator/( sdf_float a, sdf_float b ) { return a.v / b.v; }
+inline sdf_float operator-( sdf_float a ) { return -a.v; }
+inline sdf_float sdf_min( sdf_float a, sdf_float b ) { return a.v < b.v ? a.v : b.v; }
+inline sdf_float sdf_max( sdf_float a, sdf_float b ) { return a.v > b.v ? a.v : b.v; }
+inline sdf_float sdf_abs( sdf_float a ) { return fabsf( a.v ); }
+inline sdf_float sdf_sqrt( sdf_float a ) { return sqrtf( a.v ); }
+inline sdf_float sdf_floor( sdf_float a ) { return floorf( a.v ); }
+#endif
+
+// same results as the lanes, min and max included (second operand on NaN).
+inline float sdf_min( float a, float b ) { return a < b ? a : b; }
+inline float sdf_max( float a, float b ) { return a > b ? a : b; }
+inline float sdf_abs( float a ) { return fabsf( a ); }
+inline float sdf_sqrt( float a ) { return sqrtf( a ); }
+inline float sdf_floor( float a ) { return floorf( a ); }
+
+// a point, or SDF_LANES points
+template<typename T>
+struct sdf_vec
+{
+    T x, y, z;
+};
+
+template<typename T>
+inline T sdf_length( T x, T y ) { return sdf_sqrt( x * x + y * y ); }
+
+template<typename T>
+inline T sdf_length( T x, T y, T z ) { return sdf_sqrt( x * x + y * y + z * z ); }
+
+// box of half sizes h around the origin, edges rounded by r.
+template<typename T>
+inline T sdf_box_distance( T x, T y, T z, const vec3 &h, float r )
+{
+    T qx = sdf_abs( x ) - ( h.x() - r );
+    T qy = sdf_abs( y ) - ( h.y() - r );
+    T qz = sdf_abs( z ) - ( h.z() - r );
+    T outside = sdf_length( sdf_max( qx, T(0.0f) ), sdf_max( qy, T(0.0f) ), sdf_max( qz, T(0.0f) ) );
+    T inside = sdf_min( sdf_max( qx, sdf_max( qy, qz ) ), T(0.0f) );
+    return outside + inside - r;
+}
+
+struct sdf
+{
+    virtual float distance( const sdf_vec<float> &p ) const = 0;
+    virtual sdf_float distance( const sdf_vec<sdf_float> &p ) const = 0;
+};
+
+// shapes write a single templated eval(), for a point and for the lanes.
+template<typename D>
+struct sdf_shape : public sdf
+{
+    virtual float distance( const sdf_vec<float> &p ) const override
+    {
+        return static_cast<const D*>( this )->eval( p );
+    }
+    virtual sdf_float distance( const sdf_vec<sdf_float> &p ) const override
+    {
+        return static_cast<const D*>( this )->eval( p );
+    }
+};
+
+struct sdf_sphere final : public sdf_shape<sdf_sphere>
+{
+    sdf_sphere( const vec3 &c, float r ) : center(c), radius(r) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        return sdf_length( p.x - center.x(), p.y - center.y(), p.z - center.z() ) - radius;
+    }
+    vec3 center;
+    float radius;
+};
+
+struct sdf_box final : public sdf_shape<sdf_box>
+{
+    sdf_box( const vec3 &c, const vec3 &half_size, float rounding = 0.0f ) : center(c), half(half_size), r(rounding) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        return sdf_box_distance( p.x - center.x(), p.y - center.y(), p.z - center.z(), half, r );
+    }
+    vec3 center;
+    vec3 half;
+    float r;
+};
+
+// in the xz plane
+struct sdf_torus final : public sdf_shape<sdf_torus>
+{
+    sdf_torus( const vec3 &c, float major, float minor ) : center(c), major_radius(major), minor_radius(minor) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        T q = sdf_length( p.x - center.x(), p.z - center.z() ) - major_radius;
+        return sdf_length( q, p.y - center.y() ) - minor_radius;
+    }
+    vec3 center;
+    float major_radius;
+    float minor_radius;
+};
+
+// Menger sponge of half size s: a cube with crosses carved out at every
+// level, each 3 times smaller than the previous one.
+struct sdf_menger final : public sdf_shape<sdf_menger>
+{
+    sdf_menger( const vec3 &c, float s, int levels ) : center(c), size(s), nb_levels(levels) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        // unit cube space
+        float inv_size = 1.0f / size;
+        T x = ( p.x - center.x() ) * inv_size;
+        T y = ( p.y - center.y() ) * inv_size;
+        T z = ( p.z - center.z() ) * inv_size;
+        T d = sdf_box_distance( x, y, z, vec3( 1.0f, 1.0f, 1.0f ), 0.0f );
+
+        float s = 1.0f;
+        for ( int m = 0; m < nb_levels; ++m )
+        {
+            // position in the current cell, in [-1, 1[
+            T ax = x * s; ax = ax - 2.0f * sdf_floor( ax * 0.5f ) - 1.0f;
+            T ay = y * s; ay = ay - 2.0f * sdf_floor( ay * 0.5f ) - 1.0f;
+            T az = z * s; az = az - 2.0f * sdf_floor( az * 0.5f ) - 1.0f;
+            s *= 3.0f;
+            T rx = sdf_abs( 1.0f - 3.0f * sdf_abs( ax ) );
+            T ry = sdf_abs( 1.0f - 3.0f * sdf_abs( ay ) );
+            T rz = sdf_abs( 1.0f - 3.0f * sdf_abs( az ) );
+            // the cross through the cell, along each axis
+            T da = sdf_max( rx, ry );
+            T db = sdf_max( ry, rz );
+            T dc = sdf_max( rz, rx );
+            T cross = ( sdf_min( da, sdf_min( db, dc ) ) - 1.0f ) / s;
+            d = sdf_max( d, cross );
+        }
+        return d * size;
+    }
+    vec3 center;
+    float size;
+    int nb_levels;
+};
+
+struct sdf_union final : public sdf_shape<sdf_union>
+{
+    sdf_union( const sdf *_a, const sdf *_b ) : a(_a), b(_b) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        return sdf_min( a->distance( p ), b->distance( p ) );
+    }
+    const sdf *a;
+    const sdf *b;
+};
+
+struct sdf_intersection final : public sdf_shape<sdf_intersection>
+{
+    sdf_intersection( const sdf *_a, const sdf *_b ) : a(_a), b(_b) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        return sdf_max( a->distance( p ), b->distance( p ) );
+    }
+    const sdf *a;
+    const sdf *b;
+};
+
+// a minus b
+struct sdf_subtraction final : public sdf_shape<sdf_subtraction>
+{
+    sdf_subtraction( const sdf *_a, const sdf *_b ) : a(_a), b(_b) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        return sdf_max( a->distance( p ), -b->distance( p ) );
+    }
+    const sdf *a;
+    const sdf *b;
+};
+
+// union blended over a distance k (polynomial smooth min).
+struct sdf_smooth_union final : public sdf_shape<sdf_smooth_union>
+{
+    sdf_smooth_union( const sdf *_a, const sdf *_b, float _k ) : a(_a), b(_b), k(_k) {}
+    template<typename T> T eval( const sdf_vec<T> &p ) const
+    {
+        T da = a->distance( p );
+        T db = b->distance( p );
+        T h = sdf_min( sdf_max( 0.5f + ( 0.5f / k ) * ( db - da ), T(0.0f) ), T(1.0f) );
+        return db + ( da - db ) * h - k * h * ( 1.0f - h );
+    }
+    const sdf *a;
+    const sdf *b;
+    float k;
+};
+
+const int SDF_MAX_STEPS = 128;
+
+// One ray marching the field, from t to t_exit (the box exit). side is the
+// sign of the field where it starts, -1 when it marches inside the shape.
+struct sdf_march
+{
+    float t;
+    float t_exit;
+    float side;
+    float scale; // ray parameter per unit of distance
+    int steps;
+};
+
+// The field is only marched in box: it must hold the shape. Steps are
+// f / lipschitz, lipschitz > 1 for fields that overestimate the distance
+// (sharp blends, deformations). Rays give up after max_steps evaluations.
+struct sdf_object : public hitable
+{
+    sdf_object( const sdf *f, const aabb &box, material *mat, int steps = SDF_MAX_STEPS,
+                float lipschitz = 1.0f, float eps = 0.001f )
+        : field(f), bmin(box.min()), bmax(box.max()), mat_ptr(mat), max_steps(steps),
+          inv_lipschitz(1.0f / lipschitz), epsilon(eps) {}
+
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual void hit_rays( const ray *rays, const int *ids, int n, float t_min,
+                           float *closest, hit_record *recs, bool *hits ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override
+    {
+        box = aabb( bmin, bmax );
+        return true;
+    }
+    virtual int kind() const override { return HITABLE_SDF; }
+
+    bool begin_march( const ray &r, float t_min, float t_max, sdf_march &m ) const;
+    bool march( const ray &r, float t_min, float t_max, float &t ) const;
+    void distances( const float *x, const float *y, const float *z, float *d, int n ) const;
+    vec3 normal( const vec3 &p ) const;
+    void set_hit_record( const ray &r, float t, hit_record &rec ) const;
+
+    const sdf *field;
+    vec3 bmin;
+    vec3 bmax;
+    material *mat_ptr;
+    int max_steps;
+    float inv_lipschitz;
+    float epsilon;
+};
+
+// false when r misses the box in ]t_min, t_max[. A ray starting in the
+// box may start on the surface it leaves (secondary rays): it steps away
+// until the field is clear of it, then marches on that side.
+bool sdf_object::begin_march( const ray &r, float t_min, float t_max, sdf_march &m ) const
+{
+    const vec3 &inv_dir = r.inv_direction();
+    float t_enter = t_min;
+    float t_exit = t_max;
+    for ( int a = 0; a < 3; ++a )
+    {
+        float near_plane = r.sign( a ) ? bmax[a] : bmin[a];
+        float far_plane = r.sign( a ) ? bmin[a] : bmax[a];
+        float t0 = ( near_plane - r._origin[a] ) * inv_dir[a];
+        float t1 = ( far_plane - r._origin[a] ) * inv_dir[a] * SLAB_FAR_SCALE;
+        t_enter = ffmax( t0, t_enter );
+        t_exit = ffmin( t1, t_exit );
+    }
+    if ( !( t_enter < t_exit ) )
+    {
+        return false;
+    }
+
+    m.t = t_enter;
+    m.t_exit = ffmin( t_exit, t_max );
+    m.side = 1.0f;
+    m.scale = inv_lipschitz / r.direction().length();
+    m.steps = 0;
+    if ( t_enter > t_min )
+    {
+        // enters the box, so from outside the shape
+        return true;
+    }
+
+    vec3 p = r.point_at_parameter( m.t );
+    float f = field->distance( sdf_vec<float>{ p.x(), p.y(), p.z() } );
+    while ( fabsf( f ) < epsilon )
+    {
+        m.t += epsilon * m.scale;
+        if ( ++m.steps >= max_steps || m.t >= m.t_exit )
+        {
+            return false;
+        }
+        p = r.point_at_parameter( m.t );
+        f = field->distance( sdf_vec<float>{ p.x(), p.y(), p.z() } );
+    }
+    m.side = ( f < 0.0f ) ? -1.0f : 1.0f;
+    return true;
+}
+
+bool sdf_object::march( const ray &r, float t_min, float t_max, float &t ) const
+{
+    sdf_march m;
+    if ( !begin_march( r, t_min, t_max, m ) )
+    {
+        return false;
+    }
+    for ( ; m.steps < max_steps; ++m.steps )
+    {
+        vec3 p = r.point_at_parameter( m.t );
+        float f = m.side * field->distance( sdf_vec<float>{ p.x(), p.y(), p.z() } );
+        if ( f < epsilon )
+        {
+            t = m.t;
+            return true;
+        }
+        m.t += f * m.scale;
+        if ( m.t >= m.t_exit )
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool sdf_object::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    float t;
+    if ( !march( r, t_min, t_max, t ) )
+    {
+        return false;
+    }
+    set_hit_record( r, t, rec );
+    return true;
+}
+
+bool sdf_object::occluded( const ray &r, float t_min, float t_max ) const
+{
+    float t;
+    return march( r, t_min, t_max, t );
+}
+
+// Same marches as march(), SDF_LANES rays at a time: every step evaluates
+// the field once for all the lanes. A lane whose ray is done (hit, out of
+// the box or of steps) takes the next ray, so the lanes stay busy.
+void sdf_object::hit_rays( const ray *rays, const int *ids, int n, float t_min,
+                           float *closest, hit_record *recs, bool *hits ) const
+{
+    float ox[SDF_LANES], oy[SDF_LANES], oz[SDF_LANES];
+    float dx[SDF_LANES], dy[SDF_LANES], dz[SDF_LANES];
+    float t[SDF_LANES], f[SDF_LANES];
+    sdf_march m[SDF_LANES];
+    int lane_ray[SDF_LANES];
+    int next = 0;
+    int nb_active = 0;
+
+    for ( int lane = 0; lane < SDF_LANES; ++lane )
+    {
+        lane_ray[lane] = -1;
+        ox[lane] = oy[lane] = oz[lane] = 0.0f;
+        dx[lane] = dy[lane] = dz[lane] = 0.0f;
+        t[lane] = 0.0f;
+    }
+
+    for ( ;; )
+    {
+        // refill the idle lanes
+        for ( int lane = 0; lane < SDF_LANES && next < n; ++lane )
+        {
+            while ( lane_ray[lane] < 0 && next < n )
+            {
+                int k = ids[next++];
+                if ( begin_march( rays[k], t_min, closest[k], m[lane] ) )
+                {
+                    const ray &r = rays[k];
+                    lane_ray[lane] = k;
+                    ox[lane] = r._origin.x(); oy[lane] = r._origin.y(); oz[lane] = r._origin.z();
+                    dx[lane] = r._direction.x(); dy[lane] = r._direction.y(); dz[lane] = r._direction.z();
+                    t[lane] = m[lane].t;
+                    ++nb_active;
+                }
+            }
+        }
+        if ( nb_active == 0 )
+        {
+            return;
+        }
+
+        sdf_float lt = sdf_float::load( t );
+        sdf_vec<sdf_float> p;
+        p.x = sdf_float::load( ox ) + lt * sdf_float::load( dx );
+        p.y = sdf_float::load( oy ) + lt * sdf_float::load( dy );
+        p.z = sdf_float::load( oz ) + lt * sdf_float::load( dz );
+        field->distance( p ).store( f );
+
+        for ( int lane = 0; lane < SDF_LANES; ++lane )
+        {
+            int k = lane_ray[lane];
+            if ( k < 0 )
+            {
+                continue;
+            }
+            sdf_march &lm = m[lane];
+            float d = lm.side * f[lane];
+            bool done = false;
+            if ( d < epsilon )
+            {
+                set_hit_record( rays[k], lm.t, recs[k] );
+                closest[k] = lm.t;
+                hits[k] = true;
+                done = true;
+            }
+            else
+            {
+                lm.t += d * lm.scale;
+                done = ( lm.t >= lm.t_exit ) || ( ++lm.steps >= max_steps );
+            }
+            t[lane] = lm.t;
+            if ( done )
+            {
+                lane_ray[lane] = -1;
+                --nb_active;
+            }
+        }
+    }
+}
+
+// the field at n points, SDF_LANES at a time.
+void sdf_object::distances( const float *x, const float *y, const float *z, float *d, int n ) const
+{
+    for ( int i = 0; i < n; i += SDF_LANES )
+    {
+        float lx[SDF_LANES], ly[SDF_LANES], lz[SDF_LANES], ld[SDF_LANES];
+        for ( int lane = 0; lane < SDF_LANES; ++lane )
+        {
+            int j = ( i + lane < n ) ? i + lane : n - 1;
+            lx[lane] = x[j];
+            ly[lane] = y[j];
+            lz[lane] = z[j];
+        }
+        sdf_vec<sdf_float> p = { sdf_float::load( lx ), sdf_float::load( ly ), sdf_float::load( lz ) };
+        field->distance( p ).store( ld );
+        for ( int lane = 0; lane < SDF_LANES && i + lane < n; ++lane )
+        {
+            d[i + lane] = ld[lane];
+        }
+    }
+}
+
+// gradient by finite differences, over the corners of a tetrahedron
+// (4 evaluations instead of 6 for central differences).
+vec3 sdf_object::normal( const vec3 &p ) const
+{
+    local_persist const float k[4][3] = { { 1, -1, -1 }, { -1, -1, 1 }, { -1, 1, -1 }, { 1, 1, 1 } };
+    float h = 0.5f * epsilon;
+    float x[4], y[4], z[4], d[4];
+    for ( int i = 0; i < 4; ++i )
+    {
+        x[i] = p.x() + h * k[i][0];
+        y[i] = p.y() + h * k[i][1];
+        z[i] = p.z() + h * k[i][2];
+    }
+    distances( x, y, z, d, 4 );
+
+    vec3 n( 0.0f, 0.0f, 0.0f );
+    for ( int i = 0; i < 4; ++i )
+    {
+        n += d[i] * vec3( k[i][0], k[i][1], k[i][2] );
+    }
+    return unit_vector( n );
+}
+
+void sdf_object::set_hit_record( const ray &r, float t, hit_record &rec ) const
+{
+    rec.t = t;
+    rec.p = r.point_at_parameter( t );
+    rec.normal = normal( rec.p );
+    get_sphere_uv( rec.normal, rec.u, rec.v );
+    rec.mat_ptr = mat_ptr;
+}
+
+#endif // _RAYTRACER_SDF_H_
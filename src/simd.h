@@ -0,0 +1,28 @@
+#ifndef _RAYTRACER_SIMD_H_
+#define _RAYTRACER_SIMD_H_
+
+// Instruction sets we can use, as enabled by the compiler flags
+// (/arch:AVX2 with msvc, -mavx2 with gcc/clang). x64 always has SSE2.
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#    define RAYTRACER_SSE 1
+#else
+#    define RAYTRACER_SSE 0
+#endif
+
+#if defined(__AVX__)
+#    define RAYTRACER_AVX 1
+#else
+#    define RAYTRACER_AVX 0
+#endif
+
+#if defined(__AVX2__)
+#    define RAYTRACER_AVX2 1
+#else
+#    define RAYTRACER_AVX2 0
+#endif
+
+#if RAYTRACER_SSE || RAYTRACER_AVX
+#    include <immintrin.h>
+#endif
+
+#endif // _RAYTRACER_SIMD_H_
@@ -6,16 +6,20 @@
      public:
      
      sphere() {}
-     sphere(vec3 cen, float r, material *the_mat) : center(cen), radius(r), mat(the_mat) {}
+     sphere(vec3 cen, float r, material *the_mat, bool flip_normal = false) 
+         : center(cen), radius(r), mat(the_mat), flip(flip_normal) {}
      virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+     virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
      virtual bool bounding_box( float t0, float t1, aabb &box) const override;
      
      virtual float pdf_value( const vec3 &o, const vec3 &v ) const override;
      virtual vec3 random( const vec3 &o ) const override;
+     virtual int kind() const override { return HITABLE_SPHERE; }
      
      material *mat = nullptr;
      vec3 center = vec3(0,0,0);
      float radius = 1.0f;
+     bool flip = false; // inward normals, a flip_normals folded by the scene compiler
  };
  
  bool sphere::hit(const ray &r, float t_min, float t_max, hit_record &rec) const
@@ -40,6 +44,10 @@
              rec.p = r.point_at_parameter(rec.t);
              rec.normal = (rec.p - center) / radius;
              get_sphere_uv( rec.normal, rec.u, rec.v );
+             if ( flip )
+             {
+                 rec.normal = -rec.normal;
+             }
              return true;
          }
          
@@ -51,6 +59,10 @@
              rec.p = r.point_at_parameter(rec.t);
              rec.normal = (rec.p - center) / radius;
              get_sphere_uv( rec.normal, rec.u, rec.v );
+             if ( flip )
+             {
+                 rec.normal = -rec.normal;
+             }
              return true;
          }
      }
@@ -58,6 +70,33 @@
      return false;
  }
  
+ // one of the two roots in ]t_min, t_max[, no normal and no uv.
+ inline bool sphere_occludes( const vec3 &center, float radius, const ray &r, float t_min, float t_max )
+ {
+     vec3 oc = r.origin() - center;
+     float a = dot( r.direction(), r.direction() );
+     float b = dot( oc, r.direction() );
+     float c = dot( oc, oc ) - radius * radius;
+     float discriminant = b*b - a*c;
+     if ( discriminant > 0.0f )
+     {
+         float sq = sqrtf(discriminant);
+         float temp = (-b - sq) / a;
+         if (temp < t_max && temp > t_min)
+         {
+             return true;
+         }
+         temp = (-b + sq) / a;
+         return temp < t_max && temp > t_min;
+     }
+     return false;
+ }
+ 
+ bool sphere::occluded( const ray &r, float t_min, float t_max ) const
+ {
+     return sphere_occludes( center, radius, r, t_min, t_max );
+ }
+ 
  bool sphere::bounding_box( float t0, float t1, aabb &box) const
  {
      box = aabb(center - vec3(radius, radius, radius),
@@ -67,9 +106,8 @@
  
  float sphere::pdf_value( const vec3 &o, const vec3 &v ) const
  {
-     hit_record hrec = {};
-     // find where the ray hit me
-     if ( this->hit( ray( o, v ), 0.001f, FLT_MAX, hrec ) )
+     // does the ray hit me
+     if ( this->occluded( ray( o, v ), 0.001f, FLT_MAX ) )
      {
          // encompassing cone of the sphere viewd from "o"
          float cos_theta_max = sqrtf( 1.0f - radius * radius / ( center - o ).squared_length() );
@@ -126,7 +164,13 @@
      radius(r), mat_ptr(m) {}
      
      virtual bool hit(const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+     virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+     {
+         return sphere_occludes( center(r.time()), radius, r, t_min, t_max );
+     }
      virtual bool bounding_box( float t0, float t1, aabb &box) const override;
+     virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override;
+     virtual int kind() const override { return HITABLE_MOVING_SPHERE; }
      
      inline vec3 center(float t) const;
      
@@ -184,14 +228,21 @@
  
  bool moving_sphere::bounding_box( float t0, float t1, aabb &box) const
  {
-     aabb box0 = aabb(center0 - vec3(radius, radius, radius),
-                      center0 + vec3(radius, radius, radius));
-     aabb box1 = aabb(center1 - vec3(radius, radius, radius),
-                      center1 + vec3(radius, radius, radius));
+     aabb box0, box1;
+     motion_bounding_box( t0, t1, box0, box1 );
      box = surrounding_box(box0, box1);
      return true;
  }
  
+ // the center moves linearly, so do the boxes: exact at any time in between.
+ bool moving_sphere::motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const
+ {
+     vec3 rad = vec3(radius, radius, radius);
+     box0 = aabb(center(t0) - rad, center(t0) + rad);
+     box1 = aabb(center(t1) - rad, center(t1) + rad);
+     return true;
+ }
+ 
 #endif // _RAYTRACER_SPHERE_H_
  
  
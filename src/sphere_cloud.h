@@ -0,0 +1,432 @@
+#ifndef _RAYTRACER_SPHERE_CLOUD_H_
+#define _RAYTRACER_SPHERE_CLOUD_H_
+
+// Millions of static spheres (particles, point clouds) as one hitable:
+// centers, radii and material indices in flat arrays, no object per
+// sphere. The cloud has its own bvh over them, the arrays are sorted in
+// leaf order so a leaf is a range of at most SPHERE_CLOUD_LEAF_SIZE
+// spheres tested together (SSE 4, AVX 8 at a time).
+// About 25 bytes per sphere: 17 of data, 8 of nodes.
+
+#if RAYTRACER_AVX
+const int SPHERE_GROUP_SIZE = 8;
+#else
+const int SPHERE_GROUP_SIZE = 4;
+#endif
+const int SPHERE_CLOUD_LEAF_SIZE = 8;
+const int SPHERE_CLOUD_MAX_MATERIALS = 256;
+
+struct sphere_cloud : public hitable
+{
+    sphere_cloud() {}
+    // add the spheres, then build() once.
+    void reserve( size_t n );
+    void add( const vec3 &center, float r, uint8_t material_index );
+    void build();
+
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    virtual int kind() const override { return HITABLE_SPHERE_CLOUD; }
+
+    uint32_t build_node( uint32_t *indices, uint32_t begin, uint32_t end );
+    size_t memory_bytes() const;
+
+    std::vector<float> cx, cy, cz;
+    std::vector<float> radius;
+    std::vector<uint8_t> mat_index;
+    std::vector<material*> materials;   // at most SPHERE_CLOUD_MAX_MATERIALS
+    std::vector<linear_bvh_node> nodes;
+    uint32_t nb_spheres = 0;
+};
+
+void sphere_cloud::reserve( size_t n )
+{
+    cx.reserve( n + SPHERE_GROUP_SIZE ); cy.reserve( n + SPHERE_GROUP_SIZE ); cz.reserve( n + SPHERE_GROUP_SIZE );
+    radius.reserve( n + SPHERE_GROUP_SIZE );
+    mat_index.reserve( n );
+}
+
+void sphere_cloud::add( const vec3 &center, float r, uint8_t material_index )
+{
+    cx.push_back( center.x() ); cy.push_back( center.y() ); cz.push_back( center.z() );
+    radius.push_back( r );
+    mat_index.push_back( material_index );
+}
+
+size_t sphere_cloud::memory_bytes() const
+{
+    return ( cx.capacity() + cy.capacity() + cz.capacity() + radius.capacity() ) * sizeof(float) +
+           mat_index.capacity() + nodes.capacity() * sizeof(linear_bvh_node);
+}
+
+// in place reorder of one array, tmp is reused between the arrays.
+template <typename T>
+void gather_cloud_array( std::vector<T> &a, const uint32_t *indices, uint32_t n, std::vector<T> &tmp )
+{
+    tmp.resize( n );
+    for ( uint32_t i = 0; i < n; ++i )
+    {
+        tmp[i] = a[indices[i]];
+    }
+    std::copy( tmp.begin(), tmp.end(), a.begin() );
+}
+
+void sphere_cloud::build()
+{
+    nb_spheres = (uint32_t)cx.size();
+    nodes.clear();
+    if ( nb_spheres == 0 )
+    {
+        return;
+    }
+
+    // median splits over an index array, the leaves are ranges of it
+    std::vector<uint32_t> indices( nb_spheres );
+    for ( uint32_t i = 0; i < nb_spheres; ++i )
+    {
+        indices[i] = i;
+    }
+    nodes.reserve( 2 * ( nb_spheres / SPHERE_CLOUD_LEAF_SIZE ) + 1 );
+    build_node( indices.data(), 0, nb_spheres );
+    nodes.shrink_to_fit();
+
+    // one array at a time, to keep the build peak low
+    {
+        std::vector<float> tmp;
+        gather_cloud_array( cx, indices.data(), nb_spheres, tmp );
+        gather_cloud_array( cy, indices.data(), nb_spheres, tmp );
+        gather_cloud_array( cz, indices.data(), nb_spheres, tmp );
+        gather_cloud_array( radius, indices.data(), nb_spheres, tmp );
+    }
+    {
+        std::vector<uint8_t> tmp;
+        gather_cloud_array( mat_index, indices.data(), nb_spheres, tmp );
+    }
+
+    // readable past the last leaf by the group loads
+    cx.resize( nb_spheres + SPHERE_GROUP_SIZE, 0.0f );
+    cy.resize( nb_spheres + SPHERE_GROUP_SIZE, 0.0f );
+    cz.resize( nb_spheres + SPHERE_GROUP_SIZE, 0.0f );
+    radius.resize( nb_spheres + SPHERE_GROUP_SIZE, 0.0f );
+}
+
+uint32_t sphere_cloud::build_node( uint32_t *indices, uint32_t begin, uint32_t end )
+{
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back( linear_bvh_node() );
+
+    vec3 bmin( FLT_MAX, FLT_MAX, FLT_MAX ), bmax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+    vec3 cmin( FLT_MAX, FLT_MAX, FLT_MAX ), cmax( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+    for ( uint32_t i = begin; i < end; ++i )
+    {
+        uint32_t k = indices[i];
+        vec3 c( cx[k], cy[k], cz[k] );
+        for ( int a = 0; a < 3; ++a )
+        {
+            bmin[a] = ffmin( bmin[a], c[a] - radius[k] );
+            bmax[a] = ffmax( bmax[a], c[a] + radius[k] );
+            cmin[a] = ffmin( cmin[a], c[a] );
+            cmax[a] = ffmax( cmax[a], c[a] );
+        }
+    }
+    nodes[index].bmin = bmin;
+    nodes[index].bmax = bmax;
+    nodes[index].flags = 0;
+
+    uint32_t count = end - begin;
+    if ( count <= SPHERE_CLOUD_LEAF_SIZE )
+    {
+        nodes[index].offset = begin;
+        nodes[index].nb_prims = (uint16_t)count;
+        nodes[index].axis = 0;
+        return index;
+    }
+
+    vec3 extent = cmax - cmin;
+    int axis = ( extent[0] > extent[1] ) ? ( ( extent[0] > extent[2] ) ? 0 : 2 ) : ( ( extent[1] > extent[2] ) ? 1 : 2 );
+    const float *centers = ( axis == 0 ) ? cx.data() : ( axis == 1 ) ? cy.data() : cz.data();
+
+    // median rounded to full leaves on the left
+    uint32_t half = ( count / 2 + SPHERE_CLOUD_LEAF_SIZE - 1 ) / SPHERE_CLOUD_LEAF_SIZE * SPHERE_CLOUD_LEAF_SIZE;
+    uint32_t mid = begin + ( ( half < count ) ? half : count / 2 );
+    std::nth_element( indices + begin, indices + mid, indices + end,
+                      [centers]( uint32_t a, uint32_t b ) { return centers[a] < centers[b]; } );
+
+    build_node( indices, begin, mid );
+    uint32_t second = build_node( indices, mid, end );
+    nodes[index].offset = second;
+    nodes[index].nb_prims = 0;
+    nodes[index].axis = (uint8_t)axis;
+    return index;
+}
+
+// Spheres first..first+N against one ray, same test as sphere::hit.
+// Returns the mask of the lanes hit in ]t_min, t_max[ and their t.
+template <int N>
+inline int intersect_sphere_group( const sphere_cloud &c, uint32_t first, const ray &r, float t_min, float t_max, float *t )
+{
+    int mask = 0;
+    for ( int i = 0; i < N; ++i )
+    {
+        uint32_t k = first + i;
+        vec3 oc = r.origin() - vec3( c.cx[k], c.cy[k], c.cz[k] );
+        float a = dot( r.direction(), r.direction() );
+        float b = dot( oc, r.direction() );
+        float cc = dot( oc, oc ) - c.radius[k] * c.radius[k];
+        float discriminant = b*b - a*cc;
+        if ( discriminant > 0.0f )
+        {
+            float sq = sqrtf( discriminant );
+            t[i] = ( -b - sq ) / a;
+            if ( !( t[i] < t_max && t[i] > t_min ) )
+            {
+                t[i] = ( -b + sq ) / a;
+            }
+            if ( t[i] < t_max && t[i] > t_min )
+            {
+                mask |= 1 << i;
+            }
+        }
+    }
+    return mask;
+}
+
+#if RAYTRACER_SSE
+template <>
+inline int intersect_sphere_group<4>( const sphere_cloud &c, uint32_t first, const ray &r, float t_min, float t_max, float *t )
+{
+    const vec3 &o = r.origin();
+    const vec3 &d = r.direction();
+    __m128 dx = _mm_set1_ps( d.x() ), dy = _mm_set1_ps( d.y() ), dz = _mm_set1_ps( d.z() );
+    __m128 ocx = _mm_sub_ps( _mm_set1_ps( o.x() ), _mm_loadu_ps( c.cx.data() + first ) );
+    __m128 ocy = _mm_sub_ps( _mm_set1_ps( o.y() ), _mm_loadu_ps( c.cy.data() + first ) );
+    __m128 ocz = _mm_sub_ps( _mm_set1_ps( o.z() ), _mm_loadu_ps( c.cz.data() + first ) );
+    __m128 rad = _mm_loadu_ps( c.radius.data() + first );
+
+    __m128 a = _mm_set1_ps( dot( d, d ) );
+    __m128 b = _mm_add_ps( _mm_add_ps( _mm_mul_ps( ocx, dx ), _mm_mul_ps( ocy, dy ) ), _mm_mul_ps( ocz, dz ) );
+    __m128 cc = _mm_sub_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( ocx, ocx ), _mm_mul_ps( ocy, ocy ) ), _mm_mul_ps( ocz, ocz ) ),
+                            _mm_mul_ps( rad, rad ) );
+    __m128 disc = _mm_sub_ps( _mm_mul_ps( b, b ), _mm_mul_ps( a, cc ) );
+    __m128 sq = _mm_sqrt_ps( disc );
+    __m128 neg_b = _mm_sub_ps( _mm_setzero_ps(), b );
+    __m128 t0 = _mm_div_ps( _mm_sub_ps( neg_b, sq ), a );
+    __m128 t1 = _mm_div_ps( _mm_add_ps( neg_b, sq ), a );
+
+    __m128 lo = _mm_set1_ps( t_min ), hi = _mm_set1_ps( t_max );
+    __m128 valid0 = _mm_and_ps( _mm_cmplt_ps( t0, hi ), _mm_cmpgt_ps( t0, lo ) );
+    __m128 valid1 = _mm_and_ps( _mm_cmplt_ps( t1, hi ), _mm_cmpgt_ps( t1, lo ) );
+    __m128 tt = _mm_or_ps( _mm_and_ps( valid0, t0 ), _mm_andnot_ps( valid0, t1 ) );
+    _mm_storeu_ps( t, tt );
+    return _mm_movemask_ps( _mm_and_ps( _mm_cmpgt_ps( disc, _mm_setzero_ps() ), _mm_or_ps( valid0, valid1 ) ) );
+}
+#endif
+
+#if RAYTRACER_AVX
+template <>
+inline int intersect_sphere_group<8>( const sphere_cloud &c, uint32_t first, const ray &r, float t_min, float t_max, float *t )
+{
+    const vec3 &o = r.origin();
+    const vec3 &d = r.direction();
+    __m256 dx = _mm256_set1_ps( d.x() ), dy = _mm256_set1_ps( d.y() ), dz = _mm256_set1_ps( d.z() );
+    __m256 ocx = _mm256_sub_ps( _mm256_set1_ps( o.x() ), _mm256_loadu_ps( c.cx.data() + first ) );
+    __m256 ocy = _mm256_sub_ps( _mm256_set1_ps( o.y() ), _mm256_loadu_ps( c.cy.data() + first ) );
+    __m256 ocz = _mm256_sub_ps( _mm256_set1_ps( o.z() ), _mm256_loadu_ps( c.cz.data() + first ) );
+    __m256 rad = _mm256_loadu_ps( c.radius.data() + first );
+
+    __m256 a = _mm256_set1_ps( dot( d, d ) );
+    __m256 b = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ocx, dx ), _mm256_mul_ps( ocy, dy ) ), _mm256_mul_ps( ocz, dz ) );
+    __m256 cc = _mm256_sub_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( ocx, ocx ), _mm256_mul_ps( ocy, ocy ) ),
+                                              _mm256_mul_ps( ocz, ocz ) ),
+                               _mm256_mul_ps( rad, rad ) );
+    __m256 disc = _mm256_sub_ps( _mm256_mul_ps( b, b ), _mm256_mul_ps( a, cc ) );
+    __m256 sq = _mm256_sqrt_ps( disc );
+    __m256 neg_b = _mm256_sub_ps( _mm256_setzero_ps(), b );
+    __m256 t0 = _mm256_div_ps( _mm256_sub_ps( neg_b, sq ), a );
+    __m256 t1 = _mm256_div_ps( _mm256_add_ps( neg_b, sq ), a );
+
+    __m256 lo = _mm256_set1_ps( t_min ), hi = _mm256_set1_ps( t_max );
+    __m256 valid0 = _mm256_and_ps( _mm256_cmp_ps( t0, hi, _CMP_LT_OQ ), _mm256_cmp_ps( t0, lo, _CMP_GT_OQ ) );
+    __m256 valid1 = _mm256_and_ps( _mm256_cmp_ps( t1, hi, _CMP_LT_OQ ), _mm256_cmp_ps( t1, lo, _CMP_GT_OQ ) );
+    __m256 tt = _mm256_blendv_ps( t1, t0, valid0 );
+    _mm256_storeu_ps( t, tt );
+    return _mm256_movemask_ps( _mm256_and_ps( _mm256_cmp_ps( disc, _mm256_setzero_ps(), _CMP_GT_OQ ), _mm256_or_ps( valid0, valid1 ) ) );
+}
+#endif
+
+// ordered traversal, like linear_bvh::hit_ordered.
+bool sphere_cloud::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    float t_entry;
+    if ( nodes.empty() || !slab_test( nodes[0].bmin, nodes[0].bmax, r, t_min, t_max, t_entry ) )
+    {
+        return false;
+    }
+
+    struct stack_entry
+    {
+        uint32_t index;
+        float t_entry;
+    };
+
+    const int max_stack_size = 64;
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    uint32_t index = 0;
+
+    int best = -1;
+    float closest_so_far = t_max;
+
+    for (;;)
+    {
+        const linear_bvh_node &node = nodes[index];
+        ++tl_stats.nb_node_visits;
+
+        if ( node.nb_prims > 0 )
+        {
+            for ( uint32_t first = node.offset; first < node.offset + node.nb_prims; first += SPHERE_GROUP_SIZE )
+            {
+                float t[SPHERE_GROUP_SIZE];
+                int mask = intersect_sphere_group<SPHERE_GROUP_SIZE>( *this, first, r, t_min, closest_so_far, t );
+                uint32_t nb_lanes = node.offset + node.nb_prims - first;
+                if ( nb_lanes < SPHERE_GROUP_SIZE )
+                {
+                    mask &= ( 1 << nb_lanes ) - 1;
+                }
+                // lowest lane first on ties, like a loop over the spheres
+                for ( int lane = 0; mask; ++lane, mask >>= 1 )
+                {
+                    if ( ( mask & 1 ) && t[lane] < closest_so_far )
+                    {
+                        closest_so_far = t[lane];
+                        best = (int)first + lane;
+                    }
+                }
+            }
+        }
+        else
+        {
+            uint32_t near_index = index + 1;
+            uint32_t far_index = node.offset;
+            if ( r.sign( node.axis ) )
+            {
+                std::swap( near_index, far_index );
+            }
+
+            float t_near, t_far;
+            bool hit_near = slab_test( nodes[near_index].bmin, nodes[near_index].bmax, r, t_min, closest_so_far, t_near );
+            bool hit_far = slab_test( nodes[far_index].bmin, nodes[far_index].bmax, r, t_min, closest_so_far, t_far );
+
+            if ( hit_near && hit_far )
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size].index = far_index;
+                stack[stack_size].t_entry = t_far;
+                ++stack_size;
+                index = near_index;
+                continue;
+            }
+            else if ( hit_near || hit_far )
+            {
+                index = hit_near ? near_index : far_index;
+                continue;
+            }
+        }
+
+        // pop the next subtree still in front of the closest hit
+        bool found = false;
+        while ( stack_size > 0 )
+        {
+            stack_entry &e = stack[--stack_size];
+            if ( e.t_entry < closest_so_far )
+            {
+                index = e.index;
+                found = true;
+                break;
+            }
+            ++tl_stats.nb_culled_nodes;
+        }
+
+        if ( !found )
+        {
+            break;
+        }
+    }
+
+    if ( best < 0 )
+    {
+        return false;
+    }
+
+    vec3 center( cx[best], cy[best], cz[best] );
+    rec.t = closest_so_far;
+    rec.p = r.point_at_parameter( rec.t );
+    rec.normal = ( rec.p - center ) / radius[best];
+    get_sphere_uv( rec.normal, rec.u, rec.v );
+    rec.mat_ptr = materials[mat_index[best]];
+    return true;
+}
+
+bool sphere_cloud::occluded( const ray &r, float t_min, float t_max ) const
+{
+    if ( nodes.empty() )
+    {
+        return false;
+    }
+
+    const int max_stack_size = 64;
+    uint32_t stack[max_stack_size];
+    int stack_size = 0;
+    uint32_t index = 0;
+    float t_entry;
+
+    for (;;)
+    {
+        const linear_bvh_node &node = nodes[index];
+        if ( slab_test( node.bmin, node.bmax, r, t_min, t_max, t_entry ) )
+        {
+            ++tl_stats.nb_node_visits;
+            if ( node.nb_prims == 0 )
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size++] = node.offset;
+                index = index + 1;
+                continue;
+            }
+
+            for ( uint32_t first = node.offset; first < node.offset + node.nb_prims; first += SPHERE_GROUP_SIZE )
+            {
+                float t[SPHERE_GROUP_SIZE];
+                int mask = intersect_sphere_group<SPHERE_GROUP_SIZE>( *this, first, r, t_min, t_max, t );
+                uint32_t nb_lanes = node.offset + node.nb_prims - first;
+                if ( nb_lanes < SPHERE_GROUP_SIZE )
+                {
+                    mask &= ( 1 << nb_lanes ) - 1;
+                }
+                if ( mask )
+                {
+                    return true;
+                }
+            }
+        }
+
+        if ( stack_size == 0 )
+        {
+            return false;
+        }
+        index = stack[--stack_size];
+    }
+}
+
+bool sphere_cloud::bounding_box( float t0, float t1, aabb &box ) const
+{
+    if ( nodes.empty() )
+    {
+        return false;
+    }
+    box = aabb( nodes[0].bmin, nodes[0].bmax );
+    return true;
+}
+
+#endif // _RAYTRACER_SPHERE_CLOUD_H_
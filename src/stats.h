@@ -0,0 +1,30 @@
+#ifndef _RAYTRACER_STATS_H_
+#define _RAYTRACER_STATS_H_
+
+// counters are per thread so the hot loops never touch shared memory.
+// tasks reset them when they start and merge them in g_stats when done.
+struct render_stats
+{
+    uint64_t nb_rays = 0;
+    uint64_t nb_node_visits = 0;  // bvh nodes entered (box hit)
+    uint64_t nb_culled_nodes = 0; // subtrees skipped because behind the closest hit
+};
+
+global thread_local render_stats tl_stats;
+global render_stats g_stats;
+global std::mutex g_stats_mutex;
+
+inline void reset_thread_stats()
+{
+    tl_stats = render_stats();
+}
+
+inline void merge_thread_stats()
+{
+    std::unique_lock<std::mutex> g(g_stats_mutex);
+    g_stats.nb_rays += tl_stats.nb_rays;
+    g_stats.nb_node_visits += tl_stats.nb_node_visits;
+    g_stats.nb_culled_nodes += tl_stats.nb_culled_nodes;
+}
+
+#endif // _RAYTRACER_STATS_H_
@@ -139,4 +139,73 @@ struct thread_pool
     work_queue queue;
 };
 
+// Lets a thread wait for a set of tasks. Tasks can add more tasks to the
+// set before they are done, the wait ends when everything is done.
+struct task_counter
+{
+    void add( int n = 1 )
+    {
+        std::unique_lock<std::mutex> g(mutex);
+        pending += n;
+    }
+    
+    void done()
+    {
+        std::unique_lock<std::mutex> g(mutex);
+        if ( --pending == 0 )
+        {
+            all_done_condition.notify_all();
+        }
+    }
+    
+    void wait()
+    {
+        std::unique_lock<std::mutex> g(mutex);
+        while ( pending > 0 )
+        {
+            all_done_condition.wait(g);
+        }
+    }
+    
+    int pending = 0;
+    std::mutex mutex;
+    std::condition_variable all_done_condition;
+};
+
+template <typename F>
+struct range_task : public task
+{
+    range_task( const F &f, int c, int b, int e, task_counter *counter ) 
+        : fn(f), chunk(c), begin(b), end(e), pending(counter) {}
+    
+    virtual void run() override
+    {
+        fn( chunk, begin, end );
+        pending->done();
+    }
+    
+    F fn;
+    int chunk;
+    int begin;
+    int end;
+    task_counter *pending;
+};
+
+// Runs fn( chunk, begin, end ) over nb_chunks slices of [0, n) on the pool
+// and waits for all of them. Never call it from a pool thread: if all of
+// them wait, nobody is left to run the slices.
+template <typename F>
+void parallel_for( thread_pool *pool, int n, int nb_chunks, const F &fn )
+{
+    task_counter pending;
+    pending.add( nb_chunks );
+    for ( int c = 0; c < nb_chunks; ++c )
+    {
+        int begin = (int)( (int64_t)n * c / nb_chunks );
+        int end = (int)( (int64_t)n * ( c + 1 ) / nb_chunks );
+        pool->addTask( new range_task<F>( fn, c, begin, end, &pending ) );
+    }
+    pending.wait();
+}
+
 #endif // _RAYTRACER_THREAD_POOL_H_
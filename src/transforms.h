@@ -4,8 +4,14 @@
 struct translate : public hitable
 {
     translate( hitable *p, const vec3 &t ) : ptr(p), offset(t) {}
+    virtual int kind() const override { return HITABLE_TRANSLATE; }
     virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
     virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+    {
+        return ptr->occluded( r.moved( r.origin() - offset ), t_min, t_max );
+    }
     
     hitable *ptr;
     vec3 offset;
@@ -14,7 +20,7 @@ struct translate : public hitable
 bool translate::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
 {
     // move the ray the opposite direction of the object position
-    ray moved_r( r.origin() - offset, r.direction(), r.time() );
+    ray moved_r = r.moved( r.origin() - offset );
     if ( ptr->hit( moved_r, t_min, t_max, rec ) )
     {
         // move the result back into the right position
@@ -40,13 +46,29 @@ bool translate::bounding_box( float t0, float t1, aabb &box ) const
     }
 }
 
+bool translate::motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const
+{
+    if( ptr->motion_bounding_box( t0, t1, box0, box1 ) )
+    {
+        box0 = aabb( box0.min() + offset, box0.max() + offset );
+        box1 = aabb( box1.min() + offset, box1.max() + offset );
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
 // ----------------------------------------------------------------------------
 
 struct rotate_y : public hitable
 {
     rotate_y( hitable *p, float angle );
+    virtual int kind() const override { return HITABLE_ROTATE_Y; }
     virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
     virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
     
     hitable *ptr;
     float sin_theta;
@@ -108,7 +130,7 @@ bool rotate_y::hit( const ray &r, float t_min, float t_max, hit_record &rec ) co
     origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
     direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
     direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
-    ray rotated_r( origin, direction, r.time() );
+    ray rotated_r( origin, direction, r.time(), r.t_max );
     if ( ptr->hit( rotated_r, t_min, t_max, rec ) )
     {
         // un-rotate result hitpoint.
@@ -129,19 +151,340 @@ bool rotate_y::hit( const ray &r, float t_min, float t_max, hit_record &rec ) co
     }
 }
 
+bool rotate_y::occluded( const ray &r, float t_min, float t_max ) const
+{
+    vec3 origin = r.origin();
+    vec3 direction = r.direction();
+    origin[0] = cos_theta * r.origin()[0] - sin_theta * r.origin()[2];
+    origin[2] = sin_theta * r.origin()[0] + cos_theta * r.origin()[2];
+    direction[0] = cos_theta * r.direction()[0] - sin_theta * r.direction()[2];
+    direction[2] = sin_theta * r.direction()[0] + cos_theta * r.direction()[2];
+    return ptr->occluded( ray( origin, direction, r.time(), r.t_max ), t_min, t_max );
+}
+
 bool rotate_y::bounding_box( float t0, float t1, aabb &box ) const
 {
     box = bbox;
     return hasbox;
 }
 
+// ----------------------------------------------------------------------------
 
+// Any affine transform (rotation, scale, shear, translation) of an object,
+// with the inverse cached: one matrix instead of a chain of translate and
+// rotate_y, and the compile pass folds chains into it (see compile.h).
+// Also the instances of the two level bvh, see instance.h.
+struct instance : public hitable
+{
+    instance( hitable *b, const mat34 &object_to_world, material *mat = nullptr )
+        : blas(b), mat_ptr(mat)
+    {
+        set_transform( object_to_world );
+    }
 
+    virtual int kind() const override { return HITABLE_INSTANCE; }
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    virtual bool motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+    {
+        ray local( transform_point( world_to_object, r.origin() ),
+                   transform_vector( world_to_object, r.direction() ),
+                   r.time(), r.t_max );
+        return blas->occluded( local, t_min, t_max );
+    }
 
+    void set_transform( const mat34 &m )
+    {
+        object_to_world = m;
+        world_to_object = inverse( m );
+    }
 
+    hitable *blas;               // shared, not owned
+    mat34 object_to_world;
+    mat34 world_to_object;
+    material *mat_ptr = nullptr; // replaces the blas materials when set
+};
 
+// The direction is not normalized in object space, so hit distances
+// are the same in both spaces.
+bool instance::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    ray local( transform_point( world_to_object, r.origin() ),
+               transform_vector( world_to_object, r.direction() ),
+               r.time(), r.t_max );
+    if ( !blas->hit( local, t_min, t_max, rec ) )
+    {
+        return false;
+    }
 
+    rec.p = r.point_at_parameter( rec.t );
+    rec.normal = unit_vector( transform_normal( world_to_object, rec.normal ) );
+    if ( mat_ptr )
+    {
+        rec.mat_ptr = mat_ptr;
+    }
+    return true;
+}
+
+bool instance::bounding_box( float t0, float t1, aabb &box ) const
+{
+    if ( !blas->bounding_box( t0, t1, box ) )
+    {
+        return false;
+    }
+    box = transform_box( object_to_world, box );
+    return true;
+}
 
+bool instance::motion_bounding_box( float t0, float t1, aabb &box0, aabb &box1 ) const
+{
+    if ( !blas->motion_bounding_box( t0, t1, box0, box1 ) )
+    {
+        return false;
+    }
+    box0 = transform_box( object_to_world, box0 );
+    box1 = transform_box( object_to_world, box1 );
+    return true;
+}
 
+// ----------------------------------------------------------------------------
+
+// one key of a motion_transform: scale, then rotate, then translate.
+struct transform_key
+{
+    vec3 translation = vec3( 0, 0, 0 );
+    quat rotation = { 0.0f, 0.0f, 0.0f, 1.0f };
+    vec3 scale = vec3( 1, 1, 1 );
+};
+
+inline transform_key make_transform_key( const vec3 &translation, const vec3 &axis = vec3( 0, 1, 0 ),
+                                         float degrees = 0.0f, const vec3 &scale = vec3( 1, 1, 1 ) )
+{
+    transform_key k;
+    k.translation = translation;
+    k.rotation = quat_rotation( axis, degrees );
+    k.scale = scale;
+    return k;
+}
+
+// samples per segment for its bounds
+const int MOTION_BOUNDS_STEPS = 8;
+
+// Motion blur of any object: keys evenly spaced over [time0, time1], the
+// translation and scale interpolated linearly between two keys and the
+// rotation along the arc, at the ray time. The geometry is not copied per
+// key. Each segment between two keys has its own bounds: the compile pass
+// puts one motion_segment per segment in the bvh, a fast object is then
+// a trail of small boxes instead of one box over its whole path.
+struct motion_transform : public hitable
+{
+    motion_transform( hitable *p, const std::vector<transform_key> &k, float t0 = 0.0f, float t1 = 1.0f );
+    virtual int kind() const override { return HITABLE_MOTION_TRANSFORM; }
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+    
+    int nb_segments() const { return (int)keys.size() - 1; }
+    // segment at this ray time, and the position in it in [0, 1].
+    int segment( float time, float &f ) const;
+    transform_key key_at( int segment, float f ) const;
+    bool hit_segment( const ray &r, int segment, float f, float t_min, float t_max, hit_record &rec ) const;
+    bool occluded_segment( const ray &r, int segment, float f, float t_min, float t_max ) const;
+    
+    hitable *ptr;
+    std::vector<transform_key> keys;  // at least two
+    std::vector<aabb> segment_bounds; // world space, over each segment
+    float time0, time1;
+    bool hasbox;
+};
+
+inline mat34 key_object_to_world( const transform_key &k )
+{
+    mat34 m = mat34_rotation( k.rotation );
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 3; ++j )
+        {
+            m.m[i][j] *= k.scale[j];
+        }
+        m.m[i][3] = k.translation[i];
+    }
+    return m;
+}
+
+// S^-1 R^T T^-1, without the general inverse.
+inline mat34 key_world_to_object( const transform_key &k )
+{
+    mat34 r = mat34_rotation( k.rotation );
+    mat34 m;
+    for ( int i = 0; i < 3; ++i )
+    {
+        for ( int j = 0; j < 3; ++j )
+        {
+            m.m[i][j] = r.m[j][i] / k.scale[i];
+        }
+        m.m[i][3] = 0.0f;
+    }
+    vec3 t = -transform_vector( m, k.translation );
+    m.m[0][3] = t.x();
+    m.m[1][3] = t.y();
+    m.m[2][3] = t.z();
+    return m;
+}
+
+motion_transform::motion_transform( hitable *p, const std::vector<transform_key> &k, float t0, float t1 )
+    : ptr(p), keys(k), time0(t0), time1(t1)
+{
+    if ( keys.empty() )
+    {
+        keys.push_back( transform_key() );
+    }
+    if ( keys.size() == 1 )
+    {
+        keys.push_back( keys[0] );
+    }
+    
+    aabb local;
+    hasbox = ptr->bounding_box( time0, time1, local );
+    if ( !hasbox )
+    {
+        return;
+    }
+    
+    // farthest local point from the origin, for the arcs
+    float radius = 0.0f;
+    for ( int c = 0; c < 8; ++c )
+    {
+        vec3 corner( ( c & 1 ) ? local.max().x() : local.min().x(),
+                     ( c & 2 ) ? local.max().y() : local.min().y(),
+                     ( c & 4 ) ? local.max().z() : local.min().z() );
+        radius = ffmax( radius, corner.length() );
+    }
+    
+    for ( int s = 0; s < nb_segments(); ++s )
+    {
+        const transform_key &a = keys[s];
+        const transform_key &b = keys[s + 1];
+        aabb bounds = transform_box( key_object_to_world( a ), local );
+        for ( int i = 1; i <= MOTION_BOUNDS_STEPS; ++i )
+        {
+            bounds = surrounding_box( bounds, transform_box( key_object_to_world( key_at( s, (float)i / MOTION_BOUNDS_STEPS ) ), local ) );
+        }
+        
+        // between two samples a point turns by step at most, away from
+        // the chord by its radius times (1 - cos(step / 2)), plus what the
+        // scale changes meanwhile.
+        float step = 2.0f * acosf( ffmin( fabsf( dot( a.rotation, b.rotation ) ), 1.0f ) ) / MOTION_BOUNDS_STEPS;
+        float scale_a = ffmax( ffmax( fabsf( a.scale.x() ), fabsf( a.scale.y() ) ), fabsf( a.scale.z() ) );
+        float scale_b = ffmax( ffmax( fabsf( b.scale.x() ), fabsf( b.scale.y() ) ), fabsf( b.scale.z() ) );
+        float pad = radius * ( ffmax( scale_a, scale_b ) * ( 1.0f - cosf( 0.5f * step ) ) +
+                               fabsf( scale_b - scale_a ) / MOTION_BOUNDS_STEPS * sinf( 0.5f * step ) );
+        vec3 p( pad, pad, pad );
+        segment_bounds.push_back( aabb( bounds.min() - p, bounds.max() + p ) );
+    }
+}
+
+int motion_transform::segment( float time, float &f ) const
+{
+    float s = ( time1 > time0 ) ? ( time - time0 ) / ( time1 - time0 ) : 0.0f;
+    s = ffmin( ffmax( s, 0.0f ), 1.0f ) * nb_segments();
+    int k = (int)s;
+    k = ( k < nb_segments() ) ? k : nb_segments() - 1;
+    f = s - k;
+    return k;
+}
+
+transform_key motion_transform::key_at( int segment, float f ) const
+{
+    const transform_key &a = keys[segment];
+    const transform_key &b = keys[segment + 1];
+    transform_key k;
+    k.translation = a.translation + f * ( b.translation - a.translation );
+    k.rotation = slerp( a.rotation, b.rotation, f );
+    k.scale = a.scale + f * ( b.scale - a.scale );
+    return k;
+}
+
+// like instance::hit, with the transform of this time.
+bool motion_transform::hit_segment( const ray &r, int segment, float f, float t_min, float t_max, hit_record &rec ) const
+{
+    mat34 world_to_object = key_world_to_object( key_at( segment, f ) );
+    ray local( transform_point( world_to_object, r.origin() ),
+               transform_vector( world_to_object, r.direction() ),
+               r.time(), r.t_max );
+    if ( !ptr->hit( local, t_min, t_max, rec ) )
+    {
+        return false;
+    }
+    
+    rec.p = r.point_at_parameter( rec.t );
+    rec.normal = unit_vector( transform_normal( world_to_object, rec.normal ) );
+    return true;
+}
+
+bool motion_transform::occluded_segment( const ray &r, int segment, float f, float t_min, float t_max ) const
+{
+    mat34 world_to_object = key_world_to_object( key_at( segment, f ) );
+    ray local( transform_point( world_to_object, r.origin() ),
+               transform_vector( world_to_object, r.direction() ),
+               r.time(), r.t_max );
+    return ptr->occluded( local, t_min, t_max );
+}
+
+bool motion_transform::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    float f;
+    int s = segment( r.time(), f );
+    // unbounded objects have no segment boxes to test first
+    return ( !hasbox || segment_bounds[s].hit( r, t_min, t_max ) ) && hit_segment( r, s, f, t_min, t_max, rec );
+}
+
+bool motion_transform::occluded( const ray &r, float t_min, float t_max ) const
+{
+    float f;
+    int s = segment( r.time(), f );
+    // unbounded objects have no segment boxes to test first
+    return ( !hasbox || segment_bounds[s].hit( r, t_min, t_max ) ) && occluded_segment( r, s, f, t_min, t_max );
+}
+
+bool motion_transform::bounding_box( float t0, float t1, aabb &box ) const
+{
+    if ( !hasbox )
+    {
+        return false;
+    }
+    box = segment_bounds[0];
+    for ( size_t s = 1; s < segment_bounds.size(); ++s )
+    {
+        box = surrounding_box( box, segment_bounds[s] );
+    }
+    return true;
+}
+
+// one segment of a motion_transform, alone in the bvh with the bounds of
+// this segment only. Rays at other times miss it.
+struct motion_segment : public hitable
+{
+    motion_segment( const motion_transform *m, int s ) : motion(m), index(s) {}
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override
+    {
+        float f;
+        return motion->segment( r.time(), f ) == index && motion->hit_segment( r, index, f, t_min, t_max, rec );
+    }
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override
+    {
+        float f;
+        return motion->segment( r.time(), f ) == index && motion->occluded_segment( r, index, f, t_min, t_max );
+    }
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override
+    {
+        box = motion->segment_bounds[index];
+        return true;
+    }
+    
+    const motion_transform *motion;
+    int index;
+};
 
 #endif //_RAYTRACER_TRANSFORMS_H_
@@ -31,21 +31,26 @@
          if ( boundary->hit( r, rec1.t + 0.0001f, FLT_MAX, rec2 ) )
          {
              if ( rec1.t < t_min ) rec1.t = t_min;
-             if ( rec1.t > t_max ) rec1.t = t_max;
+             if ( rec2.t > t_max ) rec2.t = t_max;
              if ( rec1.t >= rec2.t ) // no volume or too thin
              {
                  return false;
              }
              if ( rec1.t < 0 ) rec1.t = 0;
              
-             float distance_inside_boundary = (rec2.t = rec1.t) * r.direction().length();
+             float distance_inside_boundary = (rec2.t - rec1.t) * r.direction().length();
              // random hit distance inside the volume
              float hit_distance = -(1.0f/density)*std::logf(RAN01());
-             rec.t = rec1.t + hit_distance / r.direction().length();
-             rec.p = r.point_at_parameter( rec.t );
-             rec.normal = vec3(1,0,0); // arbitrary. why?
-             rec.mat_ptr = phase_function;
-             return true;
+             // traversals shrink t_max to the closest hit so far,
+             // a scattering event behind it is not a hit.
+             if ( hit_distance < distance_inside_boundary )
+             {
+                 rec.t = rec1.t + hit_distance / r.direction().length();
+                 rec.p = r.point_at_parameter( rec.t );
+                 rec.normal = vec3(1,0,0); // arbitrary. why?
+                 rec.mat_ptr = phase_function;
+                 return true;
+             }
          }
      }
      
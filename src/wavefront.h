@@ -0,0 +1,216 @@
+#ifndef _RAYTRACER_WAVEFRONT_H_
+#define _RAYTRACER_WAVEFRONT_H_
+
+// Wavefront integrator: instead of one recursive color() call per sample,
+// a batch of paths is advanced one stage at a time over all of them:
+// generate camera rays, extend (closest hit), shade (emission and scatter,
+// grouped by material kind so each kernel runs over a coherent batch),
+// connect (light/bsdf mixture sampling of the diffuse bounces).
+// Same estimator as color(): throughput and radiance are accumulated
+// along the path instead of on the way back up the recursion.
+
+const int WAVEFRONT_BATCH_SIZE = 1 << 14;
+
+// path states, one array per field.
+struct wavefront_paths
+{
+    void resize( int n )
+    {
+        rays.resize( n );
+        throughput.resize( n );
+        radiance.resize( n );
+        pixel.resize( n );
+        depth.resize( n );
+        hits.resize( n );
+        albedo.resize( n );
+        pdfs.resize( n );
+    }
+
+    std::vector<ray> rays;          // next segment to extend
+    std::vector<vec3> throughput;
+    std::vector<vec3> radiance;
+    std::vector<int> pixel;         // index in the accumulation buffer
+    std::vector<int> depth;
+    std::vector<hit_record> hits;
+    std::vector<vec3> albedo;       // diffuse bounce waiting in the connect queue
+    std::vector<pdf*> pdfs;         // its material pdf, freed by connect
+};
+
+struct wavefront_integrator
+{
+    wavefront_integrator( hitable *w, hitable *imp, camera *c, int max_depth )
+        : world(w), important_hitables(imp), cam(c), max_depth(max_depth)
+    {
+        paths.resize( WAVEFRONT_BATCH_SIZE );
+        extend_queue.reserve( WAVEFRONT_BATCH_SIZE );
+        next_extend_queue.reserve( WAVEFRONT_BATCH_SIZE );
+        connect_queue.reserve( WAVEFRONT_BATCH_SIZE );
+    }
+
+    // adds sub_samples de_nan'ed samples to each pixel of out (width * height,
+    // row 0 at v = 0 like the camera).
+    void render( int width, int height, int sub_samples, vec3 *out );
+
+    void generate( int first_path, int nb_paths, int width, int height, int sub_samples );
+    void extend();
+    void shade();
+    template <typename M> void shade_kernel( const std::vector<int> &queue );
+    void connect();
+    void finish( int path );
+
+    hitable *world;
+    hitable *important_hitables;
+    camera *cam;
+    int max_depth;
+
+    wavefront_paths paths;
+    vec3 *accum = nullptr;
+    std::vector<int> extend_queue;
+    std::vector<int> next_extend_queue;
+    std::vector<int> shade_queues[MATERIAL_KIND_COUNT];
+    std::vector<int> connect_queue;
+};
+
+void wavefront_integrator::render( int width, int height, int sub_samples, vec3 *out )
+{
+    accum = out;
+    int nb_paths = width * height * sub_samples;
+    for ( int first = 0; first < nb_paths; first += WAVEFRONT_BATCH_SIZE )
+    {
+        generate( first, std::min( WAVEFRONT_BATCH_SIZE, nb_paths - first ), width, height, sub_samples );
+        while ( !extend_queue.empty() )
+        {
+            extend();
+            shade();
+            connect();
+            std::swap( extend_queue, next_extend_queue );
+            next_extend_queue.clear();
+        }
+    }
+    accum = nullptr;
+}
+
+void wavefront_integrator::generate( int first_path, int nb_paths, int width, int height, int sub_samples )
+{
+    extend_queue.clear();
+    for ( int k = 0; k < nb_paths; ++k )
+    {
+        int pixel = ( first_path + k ) / sub_samples;
+        int i = pixel % width;
+        int j = pixel / width;
+        float u = float( i + RAN01() ) / float( width );
+        float v = float( j + RAN01() ) / float( height );
+
+        paths.rays[k] = cam->get_ray( u, v );
+        paths.throughput[k] = vec3( 1, 1, 1 );
+        paths.radiance[k] = vec3( 0, 0, 0 );
+        paths.pixel[k] = pixel;
+        paths.depth[k] = 0;
+        extend_queue.push_back( k );
+    }
+}
+
+// closest hits, misses end their path (no background).
+void wavefront_integrator::extend()
+{
+    for ( int k = 0; k < MATERIAL_KIND_COUNT; ++k )
+    {
+        shade_queues[k].clear();
+    }
+
+    for ( int path : extend_queue )
+    {
+        ++tl_stats.nb_rays;
+        hit_record &hrec = paths.hits[path];
+        hrec = {};
+        if ( world->hit( paths.rays[path], 0.001f, paths.rays[path].t_max, hrec ) )
+        {
+            shade_queues[hrec.mat_ptr->kind()].push_back( path );
+        }
+        else
+        {
+            finish( path );
+        }
+    }
+}
+
+void wavefront_integrator::shade()
+{
+    // extend() bucketed the hits by material kind (a counting sort): paths
+    // stay in increasing order inside a queue, which keeps the state arrays
+    // streaming. The material types are final: calls through M are not virtual.
+    connect_queue.clear();
+    shade_kernel<lambertian>( shade_queues[MATERIAL_LAMBERTIAN] );
+    shade_kernel<metal>( shade_queues[MATERIAL_METAL] );
+    shade_kernel<dielectric>( shade_queues[MATERIAL_DIELECTRIC] );
+    shade_kernel<diffuse_light>( shade_queues[MATERIAL_DIFFUSE_LIGHT] );
+    shade_kernel<isotropic>( shade_queues[MATERIAL_ISOTROPIC] );
+    shade_kernel<material>( shade_queues[MATERIAL_OTHER] );
+}
+
+// emission and scatter of one material type, see shade() in main.cpp.
+template <typename M>
+void wavefront_integrator::shade_kernel( const std::vector<int> &queue )
+{
+    for ( int path : queue )
+    {
+        const hit_record &hrec = paths.hits[path];
+        const M *mat = (const M*)hrec.mat_ptr;
+        const ray &r = paths.rays[path];
+
+        scatter_record srec = {};
+        vec3 emitted = mat->emitted( r, hrec, hrec.u, hrec.v, hrec.p );
+        if ( ( paths.depth[path] < max_depth ) && mat->scatter( r, hrec, srec ) )
+        {
+            if ( srec.is_specular )
+            {
+                paths.throughput[path] *= srec.albedo;
+                paths.rays[path] = srec.specular_ray;
+                ++paths.depth[path];
+                next_extend_queue.push_back( path );
+            }
+            else
+            {
+                paths.radiance[path] += paths.throughput[path] * emitted;
+                paths.albedo[path] = srec.albedo;
+                paths.pdfs[path] = srec.pdf_ptr;
+                connect_queue.push_back( path );
+            }
+        }
+        else
+        {
+            paths.radiance[path] += paths.throughput[path] * emitted;
+            finish( path );
+        }
+    }
+}
+
+// diffuse bounces: half light sampling, half material pdf.
+void wavefront_integrator::connect()
+{
+    for ( int path : connect_queue )
+    {
+        const hit_record &hrec = paths.hits[path];
+        const ray &r = paths.rays[path];
+
+        hitable_pdf p_important( important_hitables, hrec.p );
+        mixture_pdf p( &p_important, paths.pdfs[path] );
+        ray scattered = ray( hrec.p, p.generate(), r.time() );
+        float pdf_val = p.value( scattered.direction() );
+        delete paths.pdfs[path];
+        paths.pdfs[path] = nullptr;
+        float spdf = hrec.mat_ptr->scattering_pdf( r, hrec, scattered );
+
+        paths.throughput[path] *= paths.albedo[path] * spdf / pdf_val;
+        paths.rays[path] = scattered;
+        ++paths.depth[path];
+        next_extend_queue.push_back( path );
+    }
+}
+
+void wavefront_integrator::finish( int path )
+{
+    accum[paths.pixel[path]] += de_nan( paths.radiance[path] );
+}
+
+#endif // _RAYTRACER_WAVEFRONT_H_
@@ -0,0 +1,527 @@
+#ifndef _RAYTRACER_WIDE_BVH_H_
+#define _RAYTRACER_WIDE_BVH_H_
+
+// N-ary bvh (N=4: QBVH, N=8: OBVH) collapsed from the binary bvh_node tree.
+// Children boxes are stored SoA so one SIMD slab test checks all of them.
+template <int N>
+struct wide_bvh_node
+{
+    float bmin[3][N];
+    float bmax[3][N];
+    int32_t child[N];     // >= 0: inner node index, < 0: leaf starting at primitive ~child
+    uint16_t nb_prims[N]; // 0 for inner nodes and empty slots
+    int32_t moving;       // children boxes interpolated with the ray time, see wide_bvh_motion
+};
+
+// children boxes at shutter close of moving nodes (the node's own are at shutter open).
+template <int N>
+struct wide_bvh_motion
+{
+    float bmin[3][N];
+    float bmax[3][N];
+};
+
+// children boxes at time s in [0,1], written in out (planes only).
+template <int N>
+inline void interpolate_wide_node( const wide_bvh_node<N> &node, const wide_bvh_motion<N> &m, 
+                                  float s, wide_bvh_node<N> &out )
+{
+    for ( int a = 0; a < 3; ++a )
+    {
+        for ( int i = 0; i < N; ++i )
+        {
+            out.bmin[a][i] = node.bmin[a][i] + s * ( m.bmin[a][i] - node.bmin[a][i] );
+            out.bmax[a][i] = node.bmax[a][i] + s * ( m.bmax[a][i] - node.bmax[a][i] );
+        }
+    }
+}
+
+// Entry distance of each child in t_entry, returns the mask of hit children.
+// Planes are picked by direction sign, so empty slots (min > max) never hit.
+template <int N>
+inline int wide_slab_test( const wide_bvh_node<N> &node, const ray &r, float t_min, float t_max, float *t_entry )
+{
+    const vec3 &inv_dir = r.inv_direction();
+    int mask = 0;
+    for ( int i = 0; i < N; ++i )
+    {
+        float t_near = t_min;
+        float t_far = t_max;
+        for ( int a = 0; a < 3; ++a )
+        {
+            const float *near_plane = r.sign( a ) ? node.bmax[a] : node.bmin[a];
+            const float *far_plane = r.sign( a ) ? node.bmin[a] : node.bmax[a];
+            float t0 = ( near_plane[i] - r._origin[a] ) * inv_dir[a];
+            float t1 = ( far_plane[i] - r._origin[a] ) * inv_dir[a] * SLAB_FAR_SCALE;
+            t_near = t0 > t_near ? t0 : t_near;
+            t_far = t1 < t_far ? t1 : t_far;
+        }
+        t_entry[i] = t_near;
+        if ( t_near < t_far )
+        {
+            mask |= ( 1 << i );
+        }
+    }
+    return mask;
+}
+
+#if RAYTRACER_SSE
+template <>
+inline int wide_slab_test<4>( const wide_bvh_node<4> &node, const ray &r, float t_min, float t_max, float *t_entry )
+{
+    __m128 t_near = _mm_set1_ps( t_min );
+    __m128 t_far = _mm_set1_ps( t_max );
+    for ( int a = 0; a < 3; ++a )
+    {
+        __m128 o = _mm_set1_ps( r._origin[a] );
+        __m128 id = _mm_set1_ps( r.inv_direction()[a] );
+        __m128 id_far = _mm_set1_ps( r.inv_direction()[a] * SLAB_FAR_SCALE );
+        const float *near_plane = r.sign( a ) ? node.bmax[a] : node.bmin[a];
+        const float *far_plane = r.sign( a ) ? node.bmin[a] : node.bmax[a];
+        __m128 t0 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( near_plane ), o ), id );
+        __m128 t1 = _mm_mul_ps( _mm_sub_ps( _mm_loadu_ps( far_plane ), o ), id_far );
+        // NaN in the first operand returns the second one: NaN slabs are ignored.
+        t_near = _mm_max_ps( t0, t_near );
+        t_far = _mm_min_ps( t1, t_far );
+    }
+    _mm_storeu_ps( t_entry, t_near );
+    return _mm_movemask_ps( _mm_cmplt_ps( t_near, t_far ) );
+}
+#endif
+
+#if RAYTRACER_AVX
+template <>
+inline int wide_slab_test<8>( const wide_bvh_node<8> &node, const ray &r, float t_min, float t_max, float *t_entry )
+{
+    __m256 t_near = _mm256_set1_ps( t_min );
+    __m256 t_far = _mm256_set1_ps( t_max );
+    for ( int a = 0; a < 3; ++a )
+    {
+        __m256 o = _mm256_set1_ps( r._origin[a] );
+        __m256 id = _mm256_set1_ps( r.inv_direction()[a] );
+        __m256 id_far = _mm256_set1_ps( r.inv_direction()[a] * SLAB_FAR_SCALE );
+        const float *near_plane = r.sign( a ) ? node.bmax[a] : node.bmin[a];
+        const float *far_plane = r.sign( a ) ? node.bmin[a] : node.bmax[a];
+        __m256 t0 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( near_plane ), o ), id );
+        __m256 t1 = _mm256_mul_ps( _mm256_sub_ps( _mm256_loadu_ps( far_plane ), o ), id_far );
+        t_near = _mm256_max_ps( t0, t_near );
+        t_far = _mm256_min_ps( t1, t_far );
+    }
+    _mm256_storeu_ps( t_entry, t_near );
+    return _mm256_movemask_ps( _mm256_cmp_ps( t_near, t_far, _CMP_LT_OQ ) );
+}
+#endif
+
+const uint32_t WIDE_BVH_MAX_LEAF_PRIMS = UINT16_MAX;
+
+template <int N>
+struct wide_bvh : public hitable
+{
+    wide_bvh() {}
+    wide_bvh( const bvh_node *root, float time0, float time1 );
+
+    virtual bool hit( const ray &r, float t_min, float t_max, hit_record &rec ) const override;
+    virtual bool occluded( const ray &r, float t_min, float t_max ) const override;
+    virtual bool bounding_box( float t0, float t1, aabb &box ) const override;
+
+    uint32_t collapse( const bvh_node *node );
+    void add_primitives( hitable *h );
+    int32_t leaf_child( uint32_t first, uint16_t &nb );
+    uint32_t add_leaf_range( uint32_t first, uint32_t end );
+    void set_child( uint32_t index, int i, int32_t child, uint16_t nb,
+                   aabb child_box, aabb child_box1, bool child_moving );
+
+    std::vector< wide_bvh_node<N> > nodes;
+    std::vector< wide_bvh_motion<N> > motion; // empty when nothing moves
+    std::vector<hitable*> prims;
+    bool has_motion = false;
+    aabb bounds;
+    float time0 = 0.0f;
+    float time1 = 1.0f;
+};
+
+typedef wide_bvh<4> qbvh;
+typedef wide_bvh<8> obvh;
+
+template <int N>
+wide_bvh<N>::wide_bvh( const bvh_node *root, float t0, float t1 )
+    : bounds(root->box), time0(t0), time1(t1)
+{
+    collapse( root );
+    if ( !has_motion )
+    {
+        motion.clear();
+    }
+}
+
+template <int N>
+void wide_bvh<N>::add_primitives( hitable *h )
+{
+    if ( h->kind() == HITABLE_LIST )
+    {
+        hitable_list *list = (hitable_list*)h;
+        for ( int i = 0; i < list->list_size; ++i )
+        {
+            prims.push_back( list->list[i] );
+        }
+    }
+    else
+    {
+        prims.push_back( h );
+    }
+}
+
+// Pulls the children of the largest binary nodes up until there are N of them,
+// then makes a wide node out of them.
+template <int N>
+uint32_t wide_bvh<N>::collapse( const bvh_node *node )
+{
+    hitable *children[N];
+    int nb_children = 0;
+    children[nb_children++] = node->left;
+    if ( node->right != node->left )
+    {
+        children[nb_children++] = node->right;
+    }
+
+    while ( nb_children < N )
+    {
+        int best = -1;
+        float best_area = -1.0f;
+        for ( int i = 0; i < nb_children; ++i )
+        {
+            if ( children[i]->kind() == HITABLE_BVH_NODE )
+            {
+                float area = surface_area( ((bvh_node*)children[i])->box );
+                if ( area > best_area )
+                {
+                    best_area = area;
+                    best = i;
+                }
+            }
+        }
+
+        if ( best < 0 )
+        {
+            break;
+        }
+
+        bvh_node *expanded = (bvh_node*)children[best];
+        children[best] = expanded->left;
+        if ( expanded->right != expanded->left )
+        {
+            children[nb_children++] = expanded->right;
+        }
+    }
+
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back( wide_bvh_node<N>() );
+    motion.push_back( wide_bvh_motion<N>() );
+
+    for ( int i = 0; i < N; ++i )
+    {
+        // empty slot: inverted box, empty leaf
+        aabb child_box = aabb( vec3( FLT_MAX, FLT_MAX, FLT_MAX ), vec3( -FLT_MAX, -FLT_MAX, -FLT_MAX ) );
+        aabb child_box1 = child_box;
+        bool child_moving = false;
+        int32_t child = ~0;
+        uint16_t nb = 0;
+
+        if ( i < nb_children )
+        {
+            hitable *h = children[i];
+            if ( h->kind() == HITABLE_BVH_NODE )
+            {
+                bvh_node *n = (bvh_node*)h;
+                child_box = n->box_t0;
+                child_box1 = n->box_t1;
+                child_moving = n->moving;
+                bool left_is_node = ( n->left->kind() == HITABLE_BVH_NODE );
+                bool right_is_node = ( n->right->kind() == HITABLE_BVH_NODE );
+                if ( !left_is_node && !right_is_node )
+                {
+                    // no room left to pull up its primitives: one leaf with all of them.
+                    uint32_t first = (uint32_t)prims.size();
+                    add_primitives( n->left );
+                    if ( n->right != n->left )
+                    {
+                        add_primitives( n->right );
+                    }
+                    child = leaf_child( first, nb );
+                }
+                else
+                {
+                    child = (int32_t)collapse( n );
+                }
+            }
+            else
+            {
+                h->motion_bounding_box( time0, time1, child_box, child_box1 );
+                child_moving = worth_interpolating( child_box, child_box1, g_bvh_build_params );
+                uint32_t first = (uint32_t)prims.size();
+                add_primitives( h );
+                child = leaf_child( first, nb );
+            }
+        }
+
+        // nodes may have been reallocated by the recursion
+        set_child( index, i, child, nb, child_box, child_box1, child_moving );
+    }
+
+    return index;
+}
+
+// child slot for the prims from first to the end of the array: a leaf, or
+// an inner node when there are more of them than nb_prims can count (a
+// large list expanded in a leaf).
+template <int N>
+int32_t wide_bvh<N>::leaf_child( uint32_t first, uint16_t &nb )
+{
+    uint32_t end = (uint32_t)prims.size();
+    if ( end - first > WIDE_BVH_MAX_LEAF_PRIMS )
+    {
+        nb = 0;
+        return (int32_t)add_leaf_range( first, end );
+    }
+    nb = (uint16_t)( end - first );
+    return ~(int32_t)first;
+}
+
+// node splitting prims [first, end) evenly between its N children.
+template <int N>
+uint32_t wide_bvh<N>::add_leaf_range( uint32_t first, uint32_t end )
+{
+    uint32_t index = (uint32_t)nodes.size();
+    nodes.push_back( wide_bvh_node<N>() );
+    motion.push_back( wide_bvh_motion<N>() );
+
+    uint32_t step = ( end - first + N - 1 ) / N;
+    for ( int i = 0; i < N; ++i )
+    {
+        aabb child_box = aabb( vec3( FLT_MAX, FLT_MAX, FLT_MAX ), vec3( -FLT_MAX, -FLT_MAX, -FLT_MAX ) );
+        aabb child_box1 = child_box;
+        bool child_moving = false;
+        int32_t child = ~0;
+        uint16_t nb = 0;
+
+        uint32_t begin = std::min( first + i * step, end );
+        uint32_t last = std::min( begin + step, end );
+        if ( begin < last )
+        {
+            prims[begin]->motion_bounding_box( time0, time1, child_box, child_box1 );
+            for ( uint32_t p = begin + 1; p < last; ++p )
+            {
+                aabb box0, box1;
+                prims[p]->motion_bounding_box( time0, time1, box0, box1 );
+                child_box = surrounding_box( child_box, box0 );
+                child_box1 = surrounding_box( child_box1, box1 );
+            }
+            child_moving = worth_interpolating( child_box, child_box1, g_bvh_build_params );
+            if ( last - begin > WIDE_BVH_MAX_LEAF_PRIMS )
+            {
+                child = (int32_t)add_leaf_range( begin, last );
+            }
+            else
+            {
+                child = ~(int32_t)begin;
+                nb = (uint16_t)( last - begin );
+            }
+        }
+
+        set_child( index, i, child, nb, child_box, child_box1, child_moving );
+    }
+
+    return index;
+}
+
+template <int N>
+void wide_bvh<N>::set_child( uint32_t index, int i, int32_t child, uint16_t nb,
+                             aabb child_box, aabb child_box1, bool child_moving )
+{
+    if ( !child_moving )
+    {
+        child_box = child_box1 = surrounding_box( child_box, child_box1 );
+    }
+
+    wide_bvh_node<N> &w = nodes[index];
+    wide_bvh_motion<N> &m = motion[index];
+    for ( int a = 0; a < 3; ++a )
+    {
+        w.bmin[a][i] = child_box.min()[a];
+        w.bmax[a][i] = child_box.max()[a];
+        m.bmin[a][i] = child_box1.min()[a];
+        m.bmax[a][i] = child_box1.max()[a];
+    }
+    w.moving = w.moving || child_moving;
+    has_motion = has_motion || child_moving;
+    w.child[i] = child;
+    w.nb_prims[i] = nb;
+}
+
+template <int N>
+bool wide_bvh<N>::hit( const ray &r, float t_min, float t_max, hit_record &rec ) const
+{
+    if ( nodes.empty() || !bounds.hit( r, t_min, t_max ) )
+    {
+        return false;
+    }
+
+    float s = ( time1 > time0 ) ? ( r.time() - time0 ) / ( time1 - time0 ) : 0.0f;
+    wide_bvh_node<N> moved;
+
+    struct stack_entry
+    {
+        int32_t child;
+        uint32_t nb_prims;
+        float t_entry;
+    };
+
+    const int max_stack_size = 64 * N;
+    stack_entry stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size].child = 0;
+    stack[stack_size].nb_prims = 0;
+    stack[stack_size].t_entry = t_min;
+    ++stack_size;
+
+    bool hit_anything = false;
+    float closest_so_far = t_max;
+    hit_record temp_rec;
+
+    while ( stack_size > 0 )
+    {
+        stack_entry e = stack[--stack_size];
+        if ( e.t_entry >= closest_so_far )
+        {
+            ++tl_stats.nb_culled_nodes;
+            continue;
+        }
+
+        if ( e.child < 0 )
+        {
+            uint32_t first = (uint32_t)~e.child;
+            for ( uint32_t i = first; i < first + e.nb_prims; ++i )
+            {
+                if ( prims[i]->hit( r, t_min, closest_so_far, temp_rec ) )
+                {
+                    hit_anything = true;
+                    closest_so_far = temp_rec.t;
+                    rec = temp_rec;
+                }
+            }
+            continue;
+        }
+
+        const wide_bvh_node<N> &node = nodes[e.child];
+        ++tl_stats.nb_node_visits;
+
+        const wide_bvh_node<N> *boxes = &node;
+        if ( node.moving )
+        {
+            interpolate_wide_node<N>( node, motion[e.child], s, moved );
+            boxes = &moved;
+        }
+
+        float t_entry[N];
+        int mask = wide_slab_test<N>( *boxes, r, t_min, closest_so_far, t_entry );
+
+        // hit children sorted far to near, so the nearest is on top of the stack
+        int order[N];
+        int nb_hit = 0;
+        for ( int i = 0; i < N; ++i )
+        {
+            if ( mask & ( 1 << i ) )
+            {
+                int j = nb_hit++;
+                while ( j > 0 && t_entry[order[j-1]] < t_entry[i] )
+                {
+                    order[j] = order[j-1];
+                    --j;
+                }
+                order[j] = i;
+            }
+        }
+
+        assert( stack_size + nb_hit <= max_stack_size );
+        for ( int k = 0; k < nb_hit; ++k )
+        {
+            int i = order[k];
+            stack[stack_size].child = node.child[i];
+            stack[stack_size].nb_prims = node.nb_prims[i];
+            stack[stack_size].t_entry = t_entry[i];
+            ++stack_size;
+        }
+    }
+
+    return hit_anything;
+}
+
+// any hit: children are pushed in slot order, no sort.
+template <int N>
+bool wide_bvh<N>::occluded( const ray &r, float t_min, float t_max ) const
+{
+    if ( nodes.empty() || !bounds.hit( r, t_min, t_max ) )
+    {
+        return false;
+    }
+
+    float s = ( time1 > time0 ) ? ( r.time() - time0 ) / ( time1 - time0 ) : 0.0f;
+    wide_bvh_node<N> moved;
+
+    const int max_stack_size = 64 * N;
+    uint32_t stack[max_stack_size];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while ( stack_size > 0 )
+    {
+        uint32_t index = stack[--stack_size];
+        const wide_bvh_node<N> &node = nodes[index];
+        ++tl_stats.nb_node_visits;
+
+        const wide_bvh_node<N> *boxes = &node;
+        if ( node.moving )
+        {
+            interpolate_wide_node<N>( node, motion[index], s, moved );
+            boxes = &moved;
+        }
+
+        float t_entry[N];
+        int mask = wide_slab_test<N>( *boxes, r, t_min, t_max, t_entry );
+        for ( int i = 0; i < N; ++i )
+        {
+            if ( !( mask & ( 1 << i ) ) )
+            {
+                continue;
+            }
+
+            if ( node.child[i] < 0 )
+            {
+                uint32_t first = (uint32_t)~node.child[i];
+                for ( uint32_t p = first; p < first + node.nb_prims[i]; ++p )
+                {
+                    if ( prims[p]->occluded( r, t_min, t_max ) )
+                    {
+                        return true;
+                    }
+                }
+            }
+            else
+            {
+                assert( stack_size < max_stack_size );
+                stack[stack_size++] = (uint32_t)node.child[i];
+            }
+        }
+    }
+
+    return false;
+}
+
+template <int N>
+bool wide_bvh<N>::bounding_box( float t0, float t1, aabb &box ) const
+{
+    box = bounds;
+    return true;
+}
+
+#endif // _RAYTRACER_WIDE_BVH_H_